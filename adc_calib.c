@@ -0,0 +1,136 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "adc_calib.h"
+
+#define CALIB_LINE_LEN 256
+
+/*
+ * Lines start with the cache version, so entries measured by an older
+ * producer are ignored, and dropped when the file is next written.
+ * Version 2: PWM rate measured over at most 16383 cycles (DMA Lite limit).
+ */
+#define CALIB_VERSION "2"
+#define CALIB_FMT "v" CALIB_VERSION " %63s %u %u %u %lf %lf %d"
+
+/**
+ * calib_board_id() - Get an identifier of this board
+ * @id: destination
+ * @len: size of @id
+ *
+ * Uses the serial number from the device tree. Falls back to the host name
+ * on machines without one.
+ */
+void calib_board_id(char *id, int len)
+{
+	FILE *f = fopen("/proc/device-tree/serial-number", "r");
+	int i = 0;
+
+	if (f) {
+		i = fread(id, 1, len - 1, f);
+		fclose(f);
+	}
+	if (i <= 0 && gethostname(id, len - 1))
+		strcpy(id, "unknown");
+	id[len - 1] = 0;
+	if (i > 0)
+		id[i] = 0;
+
+	/* Keep the key a single word */
+	for (i = 0; id[i]; i++)
+		if (id[i] <= ' ')
+			id[i] = '_';
+}
+
+static int key_match(const struct adc_calib_key *a, const struct adc_calib_key *b)
+{
+	return !strcmp(a->board, b->board) && a->spi_hz == b->spi_hz &&
+	       a->pwm_freq == b->pwm_freq && a->pwm_range == b->pwm_range;
+}
+
+/**
+ * calib_load() - Find cached calibration for a board and configuration
+ * @path: cache file
+ * @key: board and clock configuration
+ * @cal: calibration found
+ *
+ * Return: 0 on success, -ENOENT if there is no cached calibration
+ */
+int calib_load(const char *path, const struct adc_calib_key *key, struct adc_calib *cal)
+{
+	char line[CALIB_LINE_LEN];
+	int ret = -ENOENT;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -ENOENT;
+
+	while (fgets(line, sizeof(line), f)) {
+		struct adc_calib_key k;
+		struct adc_calib c;
+
+		if (sscanf(line, CALIB_FMT, k.board, &k.spi_hz, &k.pwm_freq,
+			   &k.pwm_range, &c.spi_hz, &c.pwm_hz, &c.timer_ppb) != 7)
+			continue;
+
+		/* The latest entry wins */
+		if (key_match(&k, key) && c.spi_hz > 0 && c.pwm_hz > 0) {
+			*cal = c;
+			ret = 0;
+		}
+	}
+	fclose(f);
+
+	return ret;
+}
+
+/**
+ * calib_store() - Add or replace cached calibration
+ * @path: cache file
+ * @key: board and clock configuration
+ * @cal: measured values
+ *
+ * Other entries are kept. The file is rewritten through a temporary file
+ * so a crash never leaves a truncated cache behind.
+ *
+ * Return: 0 on success, negative errno on failure
+ */
+int calib_store(const char *path, const struct adc_calib_key *key, const struct adc_calib *cal)
+{
+	char line[CALIB_LINE_LEN], tmp[CALIB_LINE_LEN];
+	FILE *in, *out;
+	int ret = 0;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	out = fopen(tmp, "w");
+	if (!out)
+		return -errno;
+
+	in = fopen(path, "r");
+	while (in && fgets(line, sizeof(line), in)) {
+		struct adc_calib_key k;
+		struct adc_calib c;
+
+		if (sscanf(line, CALIB_FMT, k.board, &k.spi_hz, &k.pwm_freq,
+			   &k.pwm_range, &c.spi_hz, &c.pwm_hz, &c.timer_ppb) == 7 &&
+		    !key_match(&k, key))
+			fputs(line, out);
+	}
+	if (in)
+		fclose(in);
+
+	fprintf(out, "v" CALIB_VERSION " %s %u %u %u %.3f %.6f %d\n", key->board,
+		key->spi_hz, key->pwm_freq, key->pwm_range, cal->spi_hz,
+		cal->pwm_hz, cal->timer_ppb);
+
+	if (fclose(out) || rename(tmp, path)) {
+		ret = -errno;
+		unlink(tmp);
+	}
+
+	return ret;
+}
@@ -0,0 +1,27 @@
+#ifndef MVA_ADC_CALIB_H
+#define MVA_ADC_CALIB_H
+
+#include <stdint.h>
+
+/* Measured clocks are cached here, one line per board and configuration */
+#define CALIB_CACHE_FILE "/var/tmp/rpi_adc_calib"
+#define CALIB_KEY_LEN 64
+
+struct adc_calib_key {
+	char board[CALIB_KEY_LEN];	/* board serial number */
+	uint32_t spi_hz;		/* SPI clock set by init_spi() */
+	uint32_t pwm_freq;		/* PWM clock */
+	uint32_t pwm_range;		/* PWM cycles per conversion */
+};
+
+struct adc_calib {
+	double spi_hz;		/* measured SPI bit rate */
+	double pwm_hz;		/* measured conversion trigger rate (usec timer) */
+	int32_t timer_ppb;	/* usec timer drift against CLOCK_MONOTONIC */
+};
+
+void calib_board_id(char *id, int len);
+int calib_load(const char *path, const struct adc_calib_key *key, struct adc_calib *cal);
+int calib_store(const char *path, const struct adc_calib_key *key, const struct adc_calib *cal);
+
+#endif
@@ -0,0 +1,258 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "adc_capmap.h"
+
+/**
+ * capmap_open() - Map a capture file
+ * @m: reader
+ * @path: capture file, may still be being written
+ *
+ * Return: 0 on success, -EINVAL if it is not a capture, negative errno on
+ * other failures
+ */
+int capmap_open(struct capmap *m, const char *path)
+{
+	struct stat st;
+	uint64_t i, nmarks, avail;
+	void *b;
+	int ret;
+
+	memset(m, 0, sizeof(*m));
+	m->fd = open(path, O_RDONLY);
+	if (m->fd < 0)
+		return -errno;
+
+	ret = cap_read_header(m->fd, &m->hdr);
+	if (ret)
+		goto err_close;
+
+	if (fstat(m->fd, &st)) {
+		ret = -errno;
+		goto err_close;
+	}
+
+	avail = (st.st_size > m->hdr.hdr_size) ?
+		(st.st_size - m->hdr.hdr_size) / sizeof(struct cap_block) : 0;
+	m->nblocks = (m->hdr.nblocks && m->hdr.nblocks < avail) ? m->hdr.nblocks : avail;
+	m->nwords = ADC_FRAME_WORDS(&m->hdr.info) ? : 1;
+	if (!m->nblocks) {
+		ret = -ENODATA;
+		goto err_close;
+	}
+
+	m->size = m->hdr.hdr_size + m->nblocks * sizeof(struct cap_block);
+	b = mmap(NULL, m->size, PROT_READ, MAP_SHARED, m->fd, 0);
+	if (b == MAP_FAILED) {
+		ret = -errno;
+		goto err_close;
+	}
+	m->base = b;
+	m->blocks = (const struct cap_block *)(m->base + m->hdr.hdr_size);
+	madvise(b, m->size, MADV_RANDOM);
+
+	/* The 32-bit usecs wraps every 71 minutes, far longer than a stride */
+	nmarks = (m->nblocks + CAPMAP_MARK_STRIDE - 1) / CAPMAP_MARK_STRIDE;
+	m->marks = malloc(nmarks * sizeof(*m->marks));
+	if (!m->marks) {
+		ret = -ENOMEM;
+		goto err_unmap;
+	}
+	m->marks[0] = m->blocks[0].usecs;
+	for (i = 1; i < nmarks; i++) {
+		uint32_t us = m->blocks[i * CAPMAP_MARK_STRIDE].usecs;
+		uint64_t hi = m->marks[i - 1] & ~(uint64_t)UINT32_MAX;
+
+		if (us < (uint32_t)m->marks[i - 1])
+			hi += 1ULL << 32;
+		m->marks[i] = hi | us;
+	}
+
+	return 0;
+
+err_unmap:
+	munmap(b, m->size);
+err_close:
+	close(m->fd);
+	m->fd = -1;
+
+	return ret;
+}
+
+void capmap_close(struct capmap *m)
+{
+	if (m->base)
+		munmap((void *)m->base, m->size);
+	if (m->fd >= 0)
+		close(m->fd);
+	free(m->marks);
+	memset(m, 0, sizeof(*m));
+	m->fd = -1;
+}
+
+/**
+ * capmap_time() - 64-bit time of a block
+ * @m: reader
+ * @blk: block number, below m->nblocks
+ *
+ * Return: block time in nanoseconds
+ */
+uint64_t capmap_time(const struct capmap *m, uint64_t blk)
+{
+	uint64_t mark = m->marks[blk / CAPMAP_MARK_STRIDE];
+	uint32_t us = m->blocks[blk].usecs;
+	uint64_t hi = mark & ~(uint64_t)UINT32_MAX;
+
+	if (us < (uint32_t)mark)
+		hi += 1ULL << 32;
+
+	return (hi | us) * 1000;
+}
+
+/**
+ * capmap_find() - First block at or after a time
+ * @m: reader
+ * @time_ns: time, see capmap_time()
+ *
+ * Touches a few pages of the file: the marks narrow the search down to a
+ * stride of blocks.
+ *
+ * Return: block number, m->nblocks if all blocks are before @time_ns
+ */
+uint64_t capmap_find(const struct capmap *m, uint64_t time_ns)
+{
+	uint64_t nmarks = (m->nblocks + CAPMAP_MARK_STRIDE - 1) / CAPMAP_MARK_STRIDE;
+	uint64_t lo = 0, hi = nmarks, mid;
+
+	if (time_ns <= m->marks[0] * 1000)
+		return 0;
+
+	/* Last mark at or before time_ns */
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (m->marks[mid] * 1000 <= time_ns)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	/* First block of its stride at or after time_ns */
+	lo *= CAPMAP_MARK_STRIDE;
+	hi = lo + CAPMAP_MARK_STRIDE;
+	if (hi > m->nblocks)
+		hi = m->nblocks;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (capmap_time(m, mid) < time_ns)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/**
+ * capmap_chan() - Samples of a channel in a block
+ * @m: reader
+ * @blk: block number
+ * @word: word in frame (channel)
+ * @s: span into the mapping
+ *
+ * Return: 0 on success, -EINVAL if there is no such block or channel
+ */
+int capmap_chan(const struct capmap *m, uint64_t blk, unsigned int word, struct cap_span *s)
+{
+	if (blk >= m->nblocks || word >= m->nwords)
+		return -EINVAL;
+
+	s->p = &m->blocks[blk].samples[word];
+	s->n = MAX_SAMPS / m->nwords;
+	s->stride = m->nwords;
+
+	return 0;
+}
+
+/* Advise the pages of blocks [b0, b1) */
+static void capmap_advise(const struct capmap *m, uint64_t b0, uint64_t b1, int advice)
+{
+	const uintptr_t mask = sysconf(_SC_PAGESIZE) - 1;
+	uintptr_t start = (uintptr_t)&m->blocks[b0] & ~mask;
+	uintptr_t end = ((uintptr_t)&m->blocks[b1] + mask) & ~mask;
+
+	if (b1 > b0)
+		madvise((void *)start, end - start, advice);
+}
+
+/**
+ * capmap_iter_init() - Start streaming a channel over a time range
+ * @it: iterator
+ * @m: reader
+ * @word: word in frame (channel)
+ * @t0: start time, see capmap_time()
+ * @t1: end time, UINT64_MAX for the end of the file
+ *
+ * Return: 0 on success, -EINVAL if there is no such channel
+ */
+int capmap_iter_init(struct capmap_iter *it, const struct capmap *m, unsigned int word,
+		     uint64_t t0, uint64_t t1)
+{
+	if (word >= m->nwords)
+		return -EINVAL;
+
+	it->m = m;
+	it->word = word;
+	it->blk = capmap_find(m, t0);
+	it->end = capmap_find(m, t1);
+	it->ra_end = it->blk;
+	it->kept = it->blk;
+	capmap_advise(m, it->blk, it->end, MADV_SEQUENTIAL);
+
+	return 0;
+}
+
+/**
+ * capmap_iter_next() - Next block of the range
+ * @it: iterator
+ * @s: channel samples of the block
+ * @time_ns: block time, may be NULL
+ *
+ * Keeps CAPMAP_RA_BLOCKS to twice that read ahead, and drops the pages of
+ * blocks more than CAPMAP_RA_BLOCKS behind. Spans of dropped blocks stay
+ * valid, their pages are read in again when used.
+ *
+ * Return: 0 on success, -ENODATA at the end of the range
+ */
+int capmap_iter_next(struct capmap_iter *it, struct cap_span *s, uint64_t *time_ns)
+{
+	const struct capmap *m = it->m;
+
+	if (it->blk >= it->end)
+		return -ENODATA;
+
+	if (it->ra_end < it->end && it->ra_end - it->blk < CAPMAP_RA_BLOCKS) {
+		uint64_t to = it->blk + 2 * CAPMAP_RA_BLOCKS;
+
+		if (to > it->end)
+			to = it->end;
+		capmap_advise(m, it->ra_end, to, MADV_WILLNEED);
+		it->ra_end = to;
+	}
+
+	if (it->blk - it->kept >= 2 * CAPMAP_RA_BLOCKS) {
+		capmap_advise(m, it->kept, it->blk - CAPMAP_RA_BLOCKS, MADV_DONTNEED);
+		it->kept = it->blk - CAPMAP_RA_BLOCKS;
+	}
+
+	capmap_chan(m, it->blk, it->word, s);
+	if (time_ns)
+		*time_ns = capmap_time(m, it->blk);
+	it->blk++;
+
+	return 0;
+}
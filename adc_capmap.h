@@ -0,0 +1,90 @@
+#ifndef MVA_ADC_CAPMAP_H
+#define MVA_ADC_CAPMAP_H
+
+/*
+ * Memory mapped capture reader.
+ *
+ * Maps a capture file (adc_capture.h) read-only and hands out blocks and
+ * channels as pointers into the mapping, so nothing is copied or parsed
+ * up front. Samples are converted to codes or volts only when asked for.
+ *
+ * Block times are the 1MHz block timestamp in nanoseconds, extended to 64
+ * bits over its wraps from the first block of the file. Lookups by time
+ * use a table of every CAPMAP_MARK_STRIDE'th block time, built when the
+ * file is opened by touching one page per stride.
+ *
+ * The mapping is advised MADV_RANDOM. The iterator reads ahead and drops
+ * what it has passed, so streaming through files larger than RAM keeps a
+ * bounded resident set.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "adc_capture.h"
+#include "adc_common.h"
+
+#define CAPMAP_MARK_STRIDE	64
+#define CAPMAP_RA_BLOCKS	256	/* iterator readahead window, ~0.5MB */
+
+/* Samples of one channel in a block, every stride'th sample word */
+struct cap_span {
+	const uint16_t *p;
+	unsigned int n;
+	unsigned int stride;
+};
+
+struct capmap {
+	int fd;
+	const uint8_t *base;
+	size_t size;
+	struct cap_header hdr;
+	const struct cap_block *blocks;
+	uint64_t nblocks;	/* complete blocks, also of an unfinished capture */
+	unsigned int nwords;	/* frame words (channels) */
+	uint64_t *marks;	/* 64-bit usecs of every CAPMAP_MARK_STRIDE'th block */
+};
+
+struct capmap_iter {
+	const struct capmap *m;
+	uint64_t blk;		/* next block */
+	uint64_t end;
+	unsigned int word;
+	uint64_t ra_end;	/* blocks up to here were advised WILLNEED */
+	uint64_t kept;		/* blocks from here are still mapped in */
+};
+
+static inline uint16_t cap_span_code(const struct cap_span *s, unsigned int i)
+{
+	return s->p[(size_t)i * s->stride] & ADC_CODE_MASK;
+}
+
+static inline double cap_span_volts(const struct cap_span *s, unsigned int i)
+{
+	return ADC_VOLTAGE(cap_span_code(s, i));
+}
+
+static inline const struct cap_block *capmap_block(const struct capmap *m, uint64_t blk)
+{
+	return &m->blocks[blk];
+}
+
+int capmap_open(struct capmap *m, const char *path);
+void capmap_close(struct capmap *m);
+uint64_t capmap_time(const struct capmap *m, uint64_t blk);
+uint64_t capmap_find(const struct capmap *m, uint64_t time_ns);
+int capmap_chan(const struct capmap *m, uint64_t blk, unsigned int word, struct cap_span *s);
+
+int capmap_iter_init(struct capmap_iter *it, const struct capmap *m, unsigned int word,
+		     uint64_t t0, uint64_t t1);
+int capmap_iter_next(struct capmap_iter *it, struct cap_span *s, uint64_t *time_ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
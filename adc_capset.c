@@ -0,0 +1,627 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "adc_capset.h"
+#include "adc_common.h"
+
+#define SEG_FMT "%s/seg%08u.%s"
+
+/**
+ * capset_seg_path() - File name of a segment or its sidecar
+ * @path: destination, CAPSET_NAME_LEN bytes
+ * @dir: capture set directory
+ * @num: segment number
+ * @ext: "cap", "idx" or "pyr"
+ */
+void capset_seg_path(char *path, const char *dir, unsigned int num, const char *ext)
+{
+	snprintf(path, CAPSET_NAME_LEN, SEG_FMT, dir, num, ext);
+}
+
+static int cmp_uint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Find segment numbers in a directory, sorted. Caller frees *nums. */
+static int scan_segs(const char *dir, unsigned int **nums, unsigned int *n)
+{
+	struct dirent *de;
+	unsigned int *p = NULL, *tmp, max = 0;
+	DIR *d;
+
+	*n = 0;
+	d = opendir(dir);
+	if (!d)
+		return -errno;
+
+	while ((de = readdir(d))) {
+		unsigned int num;
+		char ext[8];
+
+		if (sscanf(de->d_name, "seg%8u.%7s", &num, ext) != 2 || strcmp(ext, "cap"))
+			continue;
+
+		if (*n == max) {
+			max = max ? max * 2 : 64;
+			tmp = realloc(p, max * sizeof(*p));
+			if (!tmp) {
+				free(p);
+				closedir(d);
+				return -ENOMEM;
+			}
+			p = tmp;
+		}
+		p[(*n)++] = num;
+	}
+	closedir(d);
+
+	qsort(p, *n, sizeof(*p), cmp_uint);
+	*nums = p;
+
+	return 0;
+}
+
+/* Read the index of a segment. Caller frees *idx. */
+static int load_index(const char *dir, unsigned int num, struct cap_index **idx, unsigned int *n)
+{
+	char path[CAPSET_NAME_LEN];
+	struct stat st;
+	ssize_t len;
+	int fd, ret = 0;
+
+	*idx = NULL;
+	*n = 0;
+	capset_seg_path(path, dir, num, "idx");
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st)) {
+		ret = -errno;
+		goto out;
+	}
+
+	*n = st.st_size / sizeof(**idx);
+	if (!*n)
+		goto out;
+
+	*idx = malloc(*n * sizeof(**idx));
+	if (!*idx) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	len = pread(fd, *idx, *n * sizeof(**idx), 0);
+	if (len != (ssize_t)(*n * sizeof(**idx)))
+		ret = -EIO;
+out:
+	if (ret) {
+		free(*idx);
+		*idx = NULL;
+		*n = 0;
+	}
+	close(fd);
+
+	return ret;
+}
+
+/* Delete oldest segments beyond keep_segs */
+static void capset_retain(struct capset_writer *s)
+{
+	char path[CAPSET_NAME_LEN];
+
+	while (s->cfg.keep_segs && s->seg - s->first_seg >= s->cfg.keep_segs) {
+		capset_seg_path(path, s->cfg.dir, s->first_seg, "cap");
+		unlink(path);
+		capset_seg_path(path, s->cfg.dir, s->first_seg, "idx");
+		unlink(path);
+		capset_seg_path(path, s->cfg.dir, s->first_seg, "pyr");
+		unlink(path);
+		s->first_seg++;
+	}
+}
+
+static int seg_open_write(struct capset_writer *s)
+{
+	char path[CAPSET_NAME_LEN];
+	int ret;
+
+	capset_seg_path(path, s->cfg.dir, s->seg, "idx");
+	s->idx = fopen(path, "w");
+	if (!s->idx)
+		return -errno;
+
+	capset_seg_path(path, s->cfg.dir, s->seg, "pyr");
+	ret = pyr_open_write(&s->pyr, path, ADC_FRAME_WORDS(&s->hdr.info) ? : 1);
+	if (ret) {
+		fclose(s->idx);
+		s->idx = NULL;
+		return ret;
+	}
+
+	capset_seg_path(path, s->cfg.dir, s->seg, "cap");
+	ret = cap_open_write(&s->cw, path, &s->hdr, s->cfg.wcfg);
+	if (ret) {
+		pyr_close_write(&s->pyr);
+		fclose(s->idx);
+		s->idx = NULL;
+		return ret;
+	}
+	s->seg_blocks = 0;
+	capset_retain(s);
+
+	return 0;
+}
+
+static void add_stats(struct awr_stats *sum, const struct awr_stats *st)
+{
+	sum->bytes += st->bytes;
+	sum->writes += st->writes;
+	sum->syncs += st->syncs;
+	sum->stalls += st->stalls;
+	if (st->max_stall_ns > sum->max_stall_ns)
+		sum->max_stall_ns = st->max_stall_ns;
+	if (st->max_write_ns > sum->max_write_ns)
+		sum->max_write_ns = st->max_write_ns;
+}
+
+static int seg_close_write(struct capset_writer *s)
+{
+	int ret = cap_close_write(&s->cw);
+
+	if (pyr_close_write(&s->pyr) && !ret)
+		ret = -EIO;
+	add_stats(&s->stats, &s->cw.aw.stats);
+
+	if (fclose(s->idx) && !ret)
+		ret = -errno;
+	s->idx = NULL;
+
+	return ret;
+}
+
+/*
+ * Time of the last block of a segment, extended from its last index entry
+ * @e. The usecs may have wrapped in the blocks after the entry. Falls back
+ * to the time of the entry if the segment can't be mapped.
+ */
+static uint64_t seg_last_ns(const char *dir, unsigned int num, const struct cap_index *e)
+{
+	char path[CAPSET_NAME_LEN];
+	uint64_t blk, t = e->time_ns;
+	struct capmap m;
+
+	capset_seg_path(path, dir, num, "cap");
+	if (capmap_open(&m, path))
+		return t;
+	blk = (e->offset - m.hdr.hdr_size) / sizeof(struct cap_block);
+	if (e->offset >= m.hdr.hdr_size && m.nblocks > blk)
+		t += (capmap_time(&m, m.nblocks - 1) - capmap_time(&m, blk));
+	capmap_close(&m);
+
+	return t;
+}
+
+/**
+ * capset_open_write() - Start recording to a capture set
+ * @s: writer
+ * @cfg: directory, segment limits and retention
+ * @hdr: header for the segments, from cap_header_init()
+ *
+ * Segments already in the directory are kept (subject to retention), and
+ * the new ones are numbered after them.
+ *
+ * Return: 0 on success, negative errno on failure
+ */
+int capset_open_write(struct capset_writer *s, const struct capset_cfg *cfg,
+		      const struct cap_header *hdr)
+{
+	unsigned int *nums, n, nidx;
+	struct cap_index *idx;
+	int ret;
+
+	memset(s, 0, sizeof(*s));
+	s->cfg = *cfg;
+	s->hdr = *hdr;
+
+	if (mkdir(cfg->dir, 0755) && errno != EEXIST)
+		return -errno;
+
+	ret = scan_segs(cfg->dir, &nums, &n);
+	if (ret)
+		return ret;
+
+	if (n) {
+		s->first_seg = nums[0];
+		s->seg = nums[n - 1] + 1;
+
+		/* Continue time after the last recording */
+		if (!load_index(cfg->dir, nums[n - 1], &idx, &nidx) && nidx)
+			s->usecs_hi = ((seg_last_ns(cfg->dir, nums[n - 1], &idx[nidx - 1]) / 1000
+					>> 32) + 1) << 32;
+		free(idx);
+	}
+	free(nums);
+
+	return seg_open_write(s);
+}
+
+/**
+ * capset_rotate() - Close the current segment and start the next one
+ * @s: writer
+ *
+ * Nothing is done if the current segment is still empty.
+ *
+ * Return: 0 on success, negative errno on failure
+ */
+int capset_rotate(struct capset_writer *s)
+{
+	int ret;
+
+	if (!s->idx)
+		return -EIO;
+
+	if (!s->seg_blocks)
+		return 0;
+
+	ret = seg_close_write(s);
+	s->seg++;
+	if (!ret)
+		ret = seg_open_write(s);
+
+	return ret;
+}
+
+/**
+ * capset_write_block() - Append a ring block to a capture set
+ * @s: writer
+ * @seq: ring block number of @a
+ * @a: block
+ *
+ * Starts a new segment first if the block would take the current one
+ * over its size or duration limit.
+ *
+ * Return: 0 on success, negative errno on failure
+ */
+int capset_write_block(struct capset_writer *s, uint64_t seq, const struct adc_data *a)
+{
+	struct cap_index e;
+	uint64_t time_ns;
+	int ret;
+
+	if (!s->idx)
+		return -EIO;
+
+	if (s->started && a->usecs < s->last_usecs)
+		s->usecs_hi += 1ULL << 32;
+	s->started = true;
+	s->last_usecs = a->usecs;
+	time_ns = (s->usecs_hi | a->usecs) * 1000;
+
+	if (s->seg_blocks &&
+	    ((s->cfg.seg_bytes && CAP_HDR_SIZE + (s->seg_blocks + 1) *
+	      sizeof(struct cap_block) > s->cfg.seg_bytes) ||
+	     (s->cfg.seg_secs && time_ns - s->seg_first_ns >=
+	      s->cfg.seg_secs * 1000000000ULL))) {
+		ret = capset_rotate(s);
+		if (ret)
+			return ret;
+	}
+
+	if (!s->seg_blocks)
+		s->seg_first_ns = time_ns;
+
+	if (!(s->seg_blocks % CAPSET_IDX_STRIDE)) {
+		e.seq = seq;
+		e.time_ns = time_ns;
+		e.offset = CAP_HDR_SIZE + s->seg_blocks * sizeof(struct cap_block);
+		/* Flushed so readers of a live set can seek in this segment */
+		if (fwrite(&e, sizeof(e), 1, s->idx) != 1 || fflush(s->idx))
+			return -EIO;
+	}
+
+	ret = cap_write_block(&s->cw, seq, a);
+	if (!ret)
+		ret = pyr_add_block(&s->pyr, time_ns, a);
+	if (!ret)
+		s->seg_blocks++;
+
+	return ret;
+}
+
+/**
+ * capset_close_write() - Finish the current segment
+ * @s: writer
+ *
+ * Return: 0 on success, negative errno on failure
+ */
+int capset_close_write(struct capset_writer *s)
+{
+	if (!s->idx)
+		return -EINVAL;
+
+	return seg_close_write(s);
+}
+
+static void capset_free_segs(struct capset_reader *r)
+{
+	unsigned int i;
+
+	for (i = 0; i < r->nsegs; i++) {
+		free(r->segs[i].idx);
+		if (r->segs[i].pyr_loaded)
+			pyr_seg_free(&r->segs[i].pyr);
+	}
+	free(r->segs);
+	r->segs = NULL;
+	r->nsegs = 0;
+}
+
+/* Complete blocks of a segment, without mapping it */
+static int seg_count_blocks(const char *dir, unsigned int num, uint64_t *nblocks)
+{
+	char path[CAPSET_NAME_LEN];
+	struct cap_header hdr;
+	struct stat st;
+	uint64_t avail;
+	int fd, ret;
+
+	capset_seg_path(path, dir, num, "cap");
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	ret = cap_read_header(fd, &hdr);
+	if (!ret && fstat(fd, &st))
+		ret = -errno;
+	if (!ret) {
+		avail = (st.st_size > hdr.hdr_size) ?
+			(st.st_size - hdr.hdr_size) / sizeof(struct cap_block) : 0;
+		*nblocks = (hdr.nblocks && hdr.nblocks < avail) ? hdr.nblocks : avail;
+	}
+	close(fd);
+
+	return ret;
+}
+
+static int seg_open_read(struct capset_reader *r, unsigned int s)
+{
+	char path[CAPSET_NAME_LEN];
+	int ret;
+
+	if (r->map.fd >= 0 && r->cur == s)
+		return 0;
+
+	capmap_close(&r->map);
+	r->cur = s;
+	capset_seg_path(path, r->dir, r->segs[s].num, "cap");
+	ret = capmap_open(&r->map, path);
+	if (!ret)
+		r->hdr = r->map.hdr;
+
+	return ret;
+}
+
+/**
+ * capset_open_read() - Open a capture set for reading
+ * @r: reader
+ * @dir: capture set directory
+ *
+ * Loads the indexes of all segments. Segments without an index or blocks
+ * are skipped. The last segment may still be being written; it is read
+ * up to the last complete block.
+ *
+ * Return: 0 on success, -ENOENT if there are no readable segments
+ */
+int capset_open_read(struct capset_reader *r, const char *dir)
+{
+	unsigned int *nums, n, i;
+	struct capset_seg *seg;
+	int ret;
+
+	memset(r, 0, sizeof(*r));
+	r->map.fd = -1;
+	snprintf(r->dir, sizeof(r->dir), "%s", dir);
+
+	ret = scan_segs(dir, &nums, &n);
+	if (ret)
+		return ret;
+
+	r->segs = calloc(n ? n : 1, sizeof(*r->segs));
+	if (!r->segs) {
+		free(nums);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < n; i++) {
+		seg = &r->segs[r->nsegs];
+		seg->num = nums[i];
+		if (load_index(dir, seg->num, &seg->idx, &seg->nidx) || !seg->nidx)
+			continue;
+
+		if (seg_count_blocks(dir, seg->num, &seg->nblocks) || !seg->nblocks) {
+			free(seg->idx);
+			continue;
+		}
+		r->nsegs++;
+	}
+	free(nums);
+
+	if (!r->nsegs) {
+		capset_close_read(r);
+		return -ENOENT;
+	}
+
+	r->blk = 0;
+	return seg_open_read(r, 0);
+}
+
+/* Read block of the current segment, and its 64-bit time */
+static int read_block(struct capset_reader *r, uint64_t blk, struct cap_block *b, uint64_t *time_ns)
+{
+	const struct capset_seg *seg = &r->segs[r->cur];
+	unsigned int k = blk / CAPSET_IDX_STRIDE;
+	const struct cap_index *e;
+
+	if (blk >= r->map.nblocks)
+		return -EIO;
+
+	if (k >= seg->nidx)
+		k = seg->nidx - 1;
+	e = &seg->idx[k];
+	*b = *capmap_block(&r->map, blk);
+
+	if (time_ns)
+		*time_ns = e->time_ns +
+			   (uint32_t)(b->usecs - (uint32_t)(e->time_ns / 1000)) * 1000ULL;
+
+	return 0;
+}
+
+/**
+ * capset_seek() - Move to the block holding a time
+ * @r: reader
+ * @time_ns: time, see capset_first_ns()
+ *
+ * The next capset_read_block() returns the last block starting at or
+ * before @time_ns, or the first block of the set if @time_ns is earlier.
+ * Binary searches the segments, then the segment index, and then the
+ * blocks between two index entries.
+ *
+ * Return: 0 on success, negative errno on failure
+ */
+int capset_seek(struct capset_reader *r, uint64_t time_ns)
+{
+	const struct capset_seg *seg;
+	struct cap_block b;
+	unsigned int lo, hi, mid, s, k;
+	uint64_t blo, bhi, bmid, t;
+	int ret;
+
+	/* Last segment starting at or before time */
+	for (lo = 0, hi = r->nsegs; hi - lo > 1;) {
+		mid = (lo + hi) / 2;
+		if (r->segs[mid].idx[0].time_ns <= time_ns)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	s = lo;
+	seg = &r->segs[s];
+
+	/* Last index entry at or before time */
+	for (lo = 0, hi = seg->nidx; hi - lo > 1;) {
+		mid = (lo + hi) / 2;
+		if (seg->idx[mid].time_ns <= time_ns)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	k = lo;
+
+	ret = seg_open_read(r, s);
+	if (ret)
+		return ret;
+
+	/* Last block at or before time, up to the next index entry */
+	blo = (uint64_t)k * CAPSET_IDX_STRIDE;
+	bhi = blo + CAPSET_IDX_STRIDE;
+	if (bhi > seg->nblocks)
+		bhi = seg->nblocks;
+	while (bhi - blo > 1) {
+		bmid = (blo + bhi) / 2;
+		ret = read_block(r, bmid, &b, &t);
+		if (ret)
+			return ret;
+		if (t <= time_ns)
+			blo = bmid;
+		else
+			bhi = bmid;
+	}
+	r->blk = blo;
+
+	return 0;
+}
+
+/**
+ * capset_read_block() - Read the next block of the set
+ * @r: reader
+ * @b: block
+ * @time_ns: 64-bit time of the block, may be NULL
+ *
+ * Return: 0 on success, -ENODATA at the end of the set, other negative
+ * errno on failure
+ */
+int capset_read_block(struct capset_reader *r, struct cap_block *b, uint64_t *time_ns)
+{
+	int ret;
+
+	while (r->cur < r->nsegs && r->blk >= r->segs[r->cur].nblocks) {
+		if (r->cur + 1 == r->nsegs)
+			return -ENODATA;
+		ret = seg_open_read(r, r->cur + 1);
+		if (ret)
+			return ret;
+		r->blk = 0;
+	}
+
+	ret = read_block(r, r->blk, b, time_ns);
+	if (!ret)
+		r->blk++;
+
+	return ret;
+}
+
+/**
+ * capset_read_at() - Read a block of a segment
+ * @r: reader
+ * @seg: segment index in the reader
+ * @blk: block in the segment
+ * @b: block
+ * @time_ns: 64-bit time of the block, may be NULL
+ *
+ * Sequential reading continues after this block.
+ *
+ * Return: 0 on success, negative errno on failure
+ */
+int capset_read_at(struct capset_reader *r, unsigned int seg, uint64_t blk,
+		   struct cap_block *b, uint64_t *time_ns)
+{
+	int ret;
+
+	if (seg >= r->nsegs || blk >= r->segs[seg].nblocks)
+		return -EINVAL;
+
+	ret = seg_open_read(r, seg);
+	if (!ret)
+		ret = read_block(r, blk, b, time_ns);
+	if (!ret)
+		r->blk = blk + 1;
+
+	return ret;
+}
+
+/**
+ * capset_first_ns() - Time of the first block in the set
+ * @r: reader
+ *
+ * Return: 64-bit time of the first block
+ */
+uint64_t capset_first_ns(const struct capset_reader *r)
+{
+	return r->segs[0].idx[0].time_ns;
+}
+
+void capset_close_read(struct capset_reader *r)
+{
+	capmap_close(&r->map);
+	capset_free_segs(r);
+}
@@ -0,0 +1,93 @@
+#ifndef MVA_ADC_CAPSET_H
+#define MVA_ADC_CAPSET_H
+
+/*
+ * Capture set: a directory of capture segments.
+ *
+ * Each segment segNNNNNNNN.cap is a complete capture file (adc_capture.h)
+ * bounded by size or duration. Next to it, segNNNNNNNN.idx holds a
+ * struct cap_index entry for every CAPSET_IDX_STRIDE'th block of the
+ * segment, starting from its first block, and segNNNNNNNN.pyr holds the
+ * min/max/mean pyramid (adc_pyramid.h). The reader maps one segment at a
+ * time with adc_capmap.h.
+ *
+ * Times are nanoseconds of the 1MHz block timestamp, extended to 64 bits
+ * over its wraps. A recording added to an existing set continues after
+ * the last time in the set, so time grows through all segments.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "adc_capmap.h"
+#include "adc_capture.h"
+#include "adc_pyramid.h"
+
+#define CAPSET_IDX_STRIDE	64
+#define CAPSET_NAME_LEN		256
+
+struct cap_index {
+	uint64_t seq;		/* ring block number */
+	uint64_t time_ns;	/* 64-bit block timestamp */
+	uint64_t offset;	/* file offset of the block record */
+};
+
+struct capset_cfg {
+	const char *dir;	/* created if missing, parent must exist */
+	uint64_t seg_bytes;	/* segment size limit, 0 for none */
+	uint32_t seg_secs;	/* segment duration limit, 0 for none */
+	unsigned int keep_segs;	/* retention: segments kept, 0 keeps all */
+	const struct awr_cfg *wcfg;	/* writer config for the segments */
+};
+
+struct capset_writer {
+	struct capset_cfg cfg;
+	struct cap_header hdr;
+	struct cap_writer cw;
+	struct pyr_writer pyr;
+	FILE *idx;
+	unsigned int first_seg;	/* oldest segment still on disk */
+	unsigned int seg;	/* segment being written */
+	uint64_t seg_blocks;
+	uint64_t seg_first_ns;
+	uint64_t usecs_hi;	/* timestamp bits above the 32-bit usecs */
+	uint32_t last_usecs;
+	bool started;		/* a block has been written */
+	struct awr_stats stats;	/* of the closed segments */
+};
+
+struct capset_seg {
+	unsigned int num;
+	uint64_t nblocks;
+	struct cap_index *idx;
+	unsigned int nidx;
+	struct pyr_seg pyr;	/* loaded on first query */
+	bool pyr_loaded;
+};
+
+struct capset_reader {
+	char dir[CAPSET_NAME_LEN];
+	struct cap_header hdr;	/* header of the current segment */
+	struct capset_seg *segs;
+	unsigned int nsegs;
+	unsigned int cur;	/* current segment */
+	uint64_t blk;		/* next block in current segment */
+	struct capmap map;	/* current segment, fd -1 if not mapped */
+};
+
+int capset_open_write(struct capset_writer *s, const struct capset_cfg *cfg,
+		      const struct cap_header *hdr);
+int capset_write_block(struct capset_writer *s, uint64_t seq, const struct adc_data *a);
+int capset_rotate(struct capset_writer *s);
+int capset_close_write(struct capset_writer *s);
+
+int capset_open_read(struct capset_reader *r, const char *dir);
+int capset_seek(struct capset_reader *r, uint64_t time_ns);
+int capset_read_block(struct capset_reader *r, struct cap_block *b, uint64_t *time_ns);
+int capset_read_at(struct capset_reader *r, unsigned int seg, uint64_t blk,
+		   struct cap_block *b, uint64_t *time_ns);
+uint64_t capset_first_ns(const struct capset_reader *r);
+void capset_close_read(struct capset_reader *r);
+void capset_seg_path(char *path, const char *dir, unsigned int num, const char *ext);
+
+#endif
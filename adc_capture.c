@@ -0,0 +1,203 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "adc_capture.h"
+
+/**
+ * cap_header_init() - Fill capture header for a stream
+ * @hdr: header
+ * @info: stream layout, rate and calibration from the ring
+ * @word_ps: time between sample words in picoseconds
+ */
+void cap_header_init(struct cap_header *hdr, const struct adc_stream_info *info, uint64_t word_ps)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, CAP_MAGIC, sizeof(hdr->magic));
+	hdr->version = CAP_VERSION;
+	hdr->hdr_size = CAP_HDR_SIZE;
+	hdr->format = CAP_FMT_U16;
+	hdr->block_samps = MAX_SAMPS;
+	hdr->block_size = sizeof(struct cap_block);
+	hdr->word_ps = word_ps;
+	hdr->info = *info;
+}
+
+/**
+ * cap_header_check() - Check that we can read a capture
+ * @hdr: header read from the file
+ *
+ * Return: 0 if the capture is readable, -EINVAL otherwise
+ */
+int cap_header_check(const struct cap_header *hdr)
+{
+	if (memcmp(hdr->magic, CAP_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != CAP_VERSION || hdr->format != CAP_FMT_U16)
+		return -EINVAL;
+
+	if (hdr->hdr_size < sizeof(*hdr) || hdr->block_samps != MAX_SAMPS ||
+	    hdr->block_size != sizeof(struct cap_block))
+		return -EINVAL;
+
+	return 0;
+}
+
+/**
+ * cap_block_from_adc() - Convert a ring block to a block record
+ * @b: block record
+ * @seq: ring block number
+ * @a: ring block
+ */
+void cap_block_from_adc(struct cap_block *b, uint64_t seq, const struct adc_data *a)
+{
+	int i;
+
+	b->seq = seq;
+	b->usecs = a->usecs;
+	b->reserved = 0;
+	for (i = 0; i < MAX_SAMPS; i++) {
+		uint16_t v = a->samples[i];
+
+		b->samples[i] = v >> 8 | v << 8;
+	}
+}
+
+/* Hand the full buffer to the writer and start a new one */
+static int cap_flush(struct cap_writer *w)
+{
+	int ret = awr_submit(&w->aw, w->buf, w->len);
+
+	w->len = 0;
+	w->buf = ret ? NULL : awr_get_buf(&w->aw);
+
+	return w->buf ? 0 : (ret ? ret : w->aw.err);
+}
+
+/**
+ * cap_open_write() - Create a capture file
+ * @w: writer
+ * @path: file to create, truncated if it exists
+ * @hdr: header from cap_header_init()
+ * @cfg: buffers, O_DIRECT and sync policy, NULL for defaults
+ *
+ * Blocks are collected to a buffer of the async writer, and the buffer is
+ * written when full, so the writes are large and aligned in the file.
+ *
+ * Return: 0 on success, negative errno on failure
+ */
+int cap_open_write(struct cap_writer *w, const char *path, const struct cap_header *hdr,
+		   const struct awr_cfg *cfg)
+{
+	int ret;
+
+	memset(w, 0, sizeof(*w));
+	w->hdr = *hdr;
+
+	ret = awr_open(&w->aw, path, cfg);
+	if (ret)
+		return ret;
+
+	/* Header page goes out with the first blocks */
+	w->buf = awr_get_buf(&w->aw);
+	memset(w->buf, 0, CAP_HDR_SIZE);
+	memcpy(w->buf, &w->hdr, sizeof(w->hdr));
+	w->len = CAP_HDR_SIZE;
+
+	return 0;
+}
+
+/**
+ * cap_write_block() - Append a ring block to a capture
+ * @w: writer
+ * @seq: ring block number of @a
+ * @a: block
+ *
+ * Only waits for the storage when all buffers of the writer are in flight.
+ *
+ * Return: 0 on success, negative errno on write failure
+ */
+int cap_write_block(struct cap_writer *w, uint64_t seq, const struct adc_data *a)
+{
+	const size_t size = w->aw.cfg.buf_size;
+	struct cap_block tmp;
+	const uint8_t *p = (const uint8_t *)&tmp;
+	size_t left = sizeof(tmp);
+	int ret;
+
+	if (!w->buf)
+		return w->aw.err ? w->aw.err : -EIO;
+
+	w->nblocks++;
+
+	/* Records are a multiple of 16 bytes, so they stay aligned in buf */
+	if (w->len + sizeof(tmp) <= size) {
+		cap_block_from_adc((struct cap_block *)(w->buf + w->len), seq, a);
+		w->len += sizeof(tmp);
+		return (w->len == size) ? cap_flush(w) : 0;
+	}
+
+	/* Record straddles the end of the buffer */
+	cap_block_from_adc(&tmp, seq, a);
+	while (left) {
+		size_t n = size - w->len;
+
+		if (n > left)
+			n = left;
+		memcpy(w->buf + w->len, p, n);
+		w->len += n;
+		p += n;
+		left -= n;
+		if (w->len == size) {
+			ret = cap_flush(w);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * cap_close_write() - Write out buffered data, finish header and close
+ * @w: writer
+ *
+ * Return: 0 on success, negative errno on failure
+ */
+int cap_close_write(struct cap_writer *w)
+{
+	uint8_t page[CAP_HDR_SIZE] = { 0 };
+	int ret = 0;
+
+	if (w->buf)
+		ret = awr_submit(&w->aw, w->buf, w->len);
+	w->buf = NULL;
+
+	w->hdr.nblocks = w->nblocks;
+	memcpy(page, &w->hdr, sizeof(w->hdr));
+	if (!ret)
+		ret = awr_rewrite(&w->aw, page, sizeof(page), 0);
+
+	if (awr_close(&w->aw) && !ret)
+		ret = -EIO;
+
+	return ret;
+}
+
+/**
+ * cap_read_header() - Read and check capture header
+ * @fd: capture file
+ * @hdr: header
+ *
+ * Return: 0 on success, -EINVAL if the file is not a readable capture
+ */
+int cap_read_header(int fd, struct cap_header *hdr)
+{
+	ssize_t n = pread(fd, hdr, sizeof(*hdr), 0);
+
+	if (n < 0)
+		return -errno;
+	if (n != sizeof(*hdr))
+		return -EINVAL;
+
+	return cap_header_check(hdr);
+}
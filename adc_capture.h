@@ -0,0 +1,70 @@
+#ifndef MVA_ADC_CAPTURE_H
+#define MVA_ADC_CAPTURE_H
+
+/*
+ * Binary capture file.
+ *
+ * The file starts with a header padded to CAP_HDR_SIZE bytes, followed by
+ * fixed size block records, one per ring block. Samples are stored as the
+ * byte swapped 16-bit SPI word (host byte order), ADC code is the value
+ * masked with ADC_CODE_MASK. Sample words are in the frame layout given
+ * by the stream info in the header.
+ *
+ * Time of sample word i of a block is usecs * 1000 + i * word_ps / 1000
+ * nanoseconds.
+ */
+
+#include <stdint.h>
+
+#include "adc_writer.h"
+#include "adc_data.h"
+#include "common.h"
+
+#define CAP_MAGIC	"MVACAP\r\n"
+#define CAP_VERSION	1
+#define CAP_HDR_SIZE	4096		/* Multiple of AWR_ALIGN */
+
+enum cap_format {
+	CAP_FMT_U16 = 1,	/* swapped 16-bit SPI word, see ADC_CODE_MASK */
+};
+
+struct cap_header {
+	char magic[8];		/* CAP_MAGIC */
+	uint32_t version;	/* CAP_VERSION */
+	uint32_t hdr_size;	/* offset of the first block record */
+	uint32_t format;	/* enum cap_format */
+	uint32_t block_samps;	/* sample words in a block record */
+	uint32_t block_size;	/* bytes in a block record */
+	uint32_t reserved;
+	uint64_t word_ps;	/* time between sample words, picoseconds */
+	uint64_t nblocks;	/* block records, 0 if the writer did not finish */
+	struct adc_stream_info info;	/* layout, rate and calibration */
+};
+
+struct cap_block {
+	uint64_t seq;		/* ring block number, counted from ring_init() */
+	uint32_t usecs;		/* block timestamp, see struct adc_data */
+	uint32_t reserved;
+	uint16_t samples[MAX_SAMPS];
+};
+
+struct cap_writer {
+	struct async_writer aw;
+	uint8_t *buf;		/* buffer being filled, from awr_get_buf() */
+	size_t len;		/* bytes in buf */
+	uint64_t nblocks;
+	struct cap_header hdr;
+};
+
+void cap_header_init(struct cap_header *hdr, const struct adc_stream_info *info, uint64_t word_ps);
+int cap_header_check(const struct cap_header *hdr);
+void cap_block_from_adc(struct cap_block *b, uint64_t seq, const struct adc_data *a);
+
+int cap_open_write(struct cap_writer *w, const char *path, const struct cap_header *hdr,
+		   const struct awr_cfg *cfg);
+int cap_write_block(struct cap_writer *w, uint64_t seq, const struct adc_data *a);
+int cap_close_write(struct cap_writer *w);
+
+int cap_read_header(int fd, struct cap_header *hdr);
+
+#endif
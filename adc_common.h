@@ -1,9 +1,23 @@
 #ifndef MVA_ADC_COMMON_H
 #define MVA_ADC_COMMON_H
 
-#include "mvaring.h"
+#include "adc_data.h"
 
 #define SHM_NAME "/RPI_ADC_BUFF"
-#define SHM_SIZE sizeof(struct mvaring)
+#define SHM_SIZE sizeof(struct mvaring)	/* with mvaring.h */
+
+/* Raw SPI sample word to ADC code (MCP3202, 2 bytes per sample, 11 data bits) */
+#define ADC_BITS	11
+#define ADC_CODE_MASK	((1 << ADC_BITS) - 1)
+#define ADC_RAW2CODE(d)	((((uint16_t)(d) << 8) | ((uint16_t)(d) >> 8)) & ADC_CODE_MASK)
+
+/* ADC code to volts, for the 3.3V reference */
+#define ADC_VREF	3.3
+#define ADC_VOLTAGE(n)	((n) * ADC_VREF / (1 << ADC_BITS))
+
+/* Sample words in a frame, and index of a sample in a block */
+#define ADC_FRAME_WORDS(_info) ((_info)->ndevs * (_info)->nchans)
+#define ADC_SAMP_IDX(_info, _frame, _dev, _chan) \
+	(((_frame) * (_info)->ndevs + (_dev)) * (_info)->nchans + (_chan))
 
 #endif
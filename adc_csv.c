@@ -0,0 +1,205 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "adc_csv.h"
+#include "adc_simd.h"
+
+static const double pow10_tab[CSV_FAST_DIGITS + 1] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+	1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+};
+
+static inline bool is_delim(char c)
+{
+	return c == ',' || c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/* Index of the first delimiter in @s, or @n if there is none */
+static size_t find_delim(const char *s, size_t n)
+{
+	const v16u8 comma = (v16u8){ 0 } + ',', space = (v16u8){ 0 } + ' ';
+	const v16u8 tab = (v16u8){ 0 } + '\t', cr = (v16u8){ 0 } + '\r';
+	const v16u8 nl = (v16u8){ 0 } + '\n';
+	size_t i;
+
+	for (i = 0; i + sizeof(v16u8) <= n; i += sizeof(v16u8)) {
+		v16u8 x = simd_load_u8((const uint8_t *)&s[i]);
+		v2u64 m = (v2u64)((x == comma) | (x == space) | (x == tab) | (x == cr) | (x == nl));
+
+		/* Lanes are in memory order, so the lowest set byte is first */
+		if (m[0])
+			return i + __builtin_ctzll(m[0]) / 8;
+		if (m[1])
+			return i + 8 + __builtin_ctzll(m[1]) / 8;
+	}
+	while (i < n && !is_delim(s[i]))
+		i++;
+
+	return i;
+}
+
+/*
+ * Convert a plain decimal: optional sign, digits and one decimal point.
+ * Return false for anything else, or too many digits to be exact.
+ */
+static bool parse_fixed(const char *s, size_t n, float *val)
+{
+	uint64_t m = 0;
+	int digits = 0, frac = -1;
+	bool neg = false;
+	double v;
+	size_t i = 0;
+
+	if (n && (s[0] == '-' || s[0] == '+'))
+		neg = s[i++] == '-';
+	for (; i < n; i++) {
+		unsigned int d = (unsigned char)s[i] - '0';
+
+		if (d < 10) {
+			if (++digits > CSV_FAST_DIGITS)
+				return false;
+			m = m * 10 + d;
+			if (frac >= 0)
+				frac++;
+		} else if (s[i] == '.' && frac < 0) {
+			frac = 0;
+		} else {
+			return false;
+		}
+	}
+	if (!digits)
+		return false;
+
+	v = frac > 0 ? m / pow10_tab[frac] : m;
+	*val = neg ? -v : v;
+
+	return true;
+}
+
+/* Convert one value, as atof() would */
+static float parse_value(const char *s, size_t n)
+{
+	char tmp[CSV_TOKEN_MAX + 1];
+	float v;
+
+	if (parse_fixed(s, n, &v))
+		return v;
+
+	if (n > CSV_TOKEN_MAX)
+		n = CSV_TOKEN_MAX;
+	memcpy(tmp, s, n);
+	tmp[n] = 0;
+
+	return strtod(tmp, 0);
+}
+
+/* Keep the start of a value that continues in the next text */
+static void tok_append(struct csv_reader *r, const char *s, size_t n)
+{
+	if (n > CSV_TOKEN_MAX - r->tok_len)
+		n = CSV_TOKEN_MAX - r->tok_len;
+	memcpy(&r->tok[r->tok_len], s, n);
+	r->tok_len += n;
+}
+
+void csv_init(struct csv_reader *r)
+{
+	r->text = r->buf;
+	r->pos = r->len = 0;
+	r->tok_len = 0;
+	r->nvals = 0;
+}
+
+/**
+ * csv_set_text() - Give the reader more text to parse
+ * @r: reader
+ * @text: text, which must stay valid until it has all been parsed
+ * @len: length of text, with no terminator needed
+ *
+ * Any text left from before is dropped, but a value or line that it
+ * started carries on into the new text.
+ */
+void csv_set_text(struct csv_reader *r, const char *text, size_t len)
+{
+	r->text = text;
+	r->pos = 0;
+	r->len = len;
+}
+
+/**
+ * csv_parse_line() - Parse the text given up to the end of a line
+ * @r: reader
+ * @vals: values of the line, the same array until a line is complete
+ * @maxvals: size of vals, any more values on the line are dropped
+ *
+ * Values are separated by any run of commas, spaces, tabs and carriage
+ * returns, and lines end with a newline.
+ *
+ * Return: number of values on the line, -EAGAIN if the text ends first
+ */
+int csv_parse_line(struct csv_reader *r, float *vals, int maxvals)
+{
+	const char *s = r->text;
+	size_t d;
+	int n;
+
+	while (r->pos < r->len) {
+		d = r->pos + find_delim(&s[r->pos], r->len - r->pos);
+		if (d == r->len) {
+			tok_append(r, &s[r->pos], d - r->pos);
+			r->pos = d;
+			break;
+		}
+
+		if (r->tok_len) {
+			tok_append(r, &s[r->pos], d - r->pos);
+			if (r->nvals < maxvals)
+				vals[r->nvals++] = parse_value(r->tok, r->tok_len);
+			r->tok_len = 0;
+		} else if (d > r->pos && r->nvals < maxvals) {
+			vals[r->nvals++] = parse_value(&s[r->pos], d - r->pos);
+		}
+		r->pos = d + 1;
+
+		if (s[d] == '\n') {
+			n = r->nvals;
+			r->nvals = 0;
+			return n;
+		}
+	}
+
+	return -EAGAIN;
+}
+
+/**
+ * csv_read_line() - Read and parse up to the end of a line
+ * @r: reader
+ * @fd: file to read, usually a non-blocking FIFO
+ * @vals: values of the line, see csv_parse_line()
+ * @maxvals: size of vals
+ *
+ * Return: number of values on the line, -EAGAIN if there is no complete
+ * line yet, -ENODATA at end of file, or negative errno from read()
+ */
+int csv_read_line(struct csv_reader *r, int fd, float *vals, int maxvals)
+{
+	ssize_t n;
+	int ret;
+
+	for (;;) {
+		ret = csv_parse_line(r, vals, maxvals);
+		if (ret != -EAGAIN)
+			return ret;
+
+		n = read(fd, r->buf, sizeof(r->buf));
+		if (n < 0)
+			return -errno;
+		if (n == 0)
+			return -ENODATA;
+		csv_set_text(r, r->buf, n);
+	}
+}
@@ -0,0 +1,38 @@
+#ifndef MVA_ADC_CSV_H
+#define MVA_ADC_CSV_H
+
+/*
+ * Incremental parser for lines of comma or space-delimited values.
+ *
+ * Text is parsed where it was read, and the next read only happens once
+ * all of it has been parsed, so nothing is shifted down or copied. A value
+ * split across two reads is carried over in a small token buffer, and a
+ * line may be any length; values past the caller's limit are dropped.
+ *
+ * Delimiters are found 16 bytes at a time with the adc_simd.h vectors.
+ * Plain decimals of up to CSV_FAST_DIGITS digits are converted in fixed
+ * point, exact in a double, with one division by a power of 10; anything
+ * else (exponents, inf, nan, long values) goes to strtod().
+ */
+
+#include <stddef.h>
+
+#define CSV_BUF_SIZE	65536
+#define CSV_TOKEN_MAX	63
+#define CSV_FAST_DIGITS	15
+
+struct csv_reader {
+	const char *text;	/* text being parsed, buf or the caller's */
+	size_t pos, len;	/* parsed up to, and end of, text */
+	char tok[CSV_TOKEN_MAX + 1];	/* start of a value split over reads */
+	size_t tok_len;
+	int nvals;		/* values of the line so far */
+	char buf[CSV_BUF_SIZE];
+};
+
+void csv_init(struct csv_reader *r);
+void csv_set_text(struct csv_reader *r, const char *text, size_t len);
+int csv_parse_line(struct csv_reader *r, float *vals, int maxvals);
+int csv_read_line(struct csv_reader *r, int fd, float *vals, int maxvals);
+
+#endif
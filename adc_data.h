@@ -0,0 +1,39 @@
+#ifndef MVA_ADC_DATA_H
+#define MVA_ADC_DATA_H
+
+/*
+ * Sample blocks and stream layout, as the ring (mvaring.h) and capture
+ * files (adc_capture.h) hold them. No atomics, so C++ can include it.
+ */
+
+#include <stdint.h>
+
+#include "common.h"
+
+struct adc_data {
+	uint32_t usecs;
+	uint32_t samples[MAX_SAMPS];
+};
+
+/*
+ * Layout of the sample stream, set by the producer after ring_init().
+ * Samples are stored in frames of ndevs * nchans words: all channels of
+ * the first ADC, then all channels of the second ADC. The frames are
+ * sampled at sample_rate. See ADC_FRAME_WORDS() and ADC_SAMP_IDX().
+ *
+ * The calibrated rate is measured against the 1MHz timer the block
+ * timestamps (usecs) use, so it gives the sample spacing in timestamp
+ * units. timer_ppb tells how much that timer runs fast against the system
+ * clock.
+ */
+struct adc_stream_info {
+	uint8_t ndevs;		/* number of ADCs sampled (SPI chip-selects) */
+	uint8_t nchans;		/* channels sampled on each ADC */
+	uint16_t reserved;
+	uint32_t sample_rate;	/* nominal frames per second */
+	uint32_t calib_rate_mhz; /* measured frame rate in millihertz, 0 if unknown */
+	int32_t timer_ppb;	/* usec timer drift, parts per billion */
+	uint32_t spi_hz;	/* measured SPI bit rate, 0 if unknown */
+};
+
+#endif
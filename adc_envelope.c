@@ -0,0 +1,29 @@
+#include "adc_envelope.h"
+#include "adc_simd.h"
+
+/**
+ * env_columns() - Min/max envelope of samples
+ * @v: samples
+ * @n: number of samples, at least 1
+ * @cols: number of columns
+ * @out: 2 * @cols values, the min and the max of each column
+ *
+ * Column c covers samples [c * n / cols, (c + 1) * n / cols). With fewer
+ * samples than columns, a column shows the sample it falls on.
+ */
+void env_columns(const uint16_t *v, size_t n, unsigned int cols, uint16_t *out)
+{
+	size_t start, end;
+	unsigned int c;
+
+	for (c = 0; c < cols; c++) {
+		start = c * n / cols;
+		end = (c + 1) * n / cols;
+		if (end <= start) {
+			if (start >= n)
+				start = n - 1;
+			end = start + 1;
+		}
+		simd_minmax_u16(&v[start], end - start, &out[2 * c], &out[2 * c + 1]);
+	}
+}
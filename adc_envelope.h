@@ -0,0 +1,17 @@
+#ifndef MVA_ADC_ENVELOPE_H
+#define MVA_ADC_ENVELOPE_H
+
+/*
+ * Min/max envelope of a run of samples over display columns.
+ *
+ * Each column gets the smallest and largest of the samples that fall into
+ * it, so drawing a vertical span per column shows every peak however many
+ * samples there are, and the drawing only depends on the column count.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+void env_columns(const uint16_t *v, size_t n, unsigned int cols, uint16_t *out);
+
+#endif
@@ -0,0 +1,315 @@
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adc_common.h"
+#include "adc_fft.h"
+#include "adc_simd.h"
+
+/* Product of complex x and w, for floats or vectors */
+#define CMUL_RE(xr, xi, wr, wi)	((xr) * (wr) - (xi) * (wi))
+#define CMUL_IM(xr, xi, wr, wi)	((xr) * (wi) + (xi) * (wr))
+
+/* Full scale sine amplitude, in codes about mid scale */
+#define FFT_FULL_SCALE	((ADC_CODE_MASK + 1) / 2)
+
+/**
+ * fft_init() - Set up a transform
+ * @p: plan
+ * @n: size, a power of 2 from FFT_MIN_SIZE to FFT_MAX_SIZE
+ *
+ * Return: 0 on success, -EINVAL for a bad size, -ENOMEM
+ */
+int fft_init(struct fft_plan *p, unsigned int n)
+{
+	unsigned int k;
+
+	memset(p, 0, sizeof(*p));
+	if (n < FFT_MIN_SIZE || n > FFT_MAX_SIZE || (n & (n - 1)))
+		return -EINVAL;
+
+	p->n = n;
+	p->tw_re = malloc(n * sizeof(float));
+	p->tw_im = malloc(n * sizeof(float));
+	p->work_re = malloc(n * sizeof(float));
+	p->work_im = malloc(n * sizeof(float));
+	if (!p->tw_re || !p->tw_im || !p->work_re || !p->work_im) {
+		fft_free(p);
+		return -ENOMEM;
+	}
+	for (k = 0; k < n; k++) {
+		p->tw_re[k] = cos(2 * M_PI * k / n);
+		p->tw_im[k] = -sin(2 * M_PI * k / n);
+	}
+
+	return 0;
+}
+
+void fft_free(struct fft_plan *p)
+{
+	free(p->tw_re);
+	free(p->tw_im);
+	free(p->work_re);
+	free(p->work_im);
+	memset(p, 0, sizeof(*p));
+}
+
+/* First radix 4 stage, stride 1, one butterfly at a time */
+static void fft_r4_first(const struct fft_plan *p, const float *xr, const float *xi,
+			 float *yr, float *yi)
+{
+	unsigned int m = p->n / 4, k;
+
+	for (k = 0; k < m; k++) {
+		float w1r = p->tw_re[k], w1i = p->tw_im[k];
+		float w2r = p->tw_re[2 * k], w2i = p->tw_im[2 * k];
+		float w3r = p->tw_re[3 * k], w3i = p->tw_im[3 * k];
+		float apcr = xr[k] + xr[k + 2 * m], apci = xi[k] + xi[k + 2 * m];
+		float amcr = xr[k] - xr[k + 2 * m], amci = xi[k] - xi[k + 2 * m];
+		float bpdr = xr[k + m] + xr[k + 3 * m], bpdi = xi[k + m] + xi[k + 3 * m];
+		/* -i * (b - d) */
+		float jr = xi[k + m] - xi[k + 3 * m], ji = xr[k + 3 * m] - xr[k + m];
+		float tr, ti;
+
+		yr[4 * k] = apcr + bpdr;
+		yi[4 * k] = apci + bpdi;
+		tr = amcr + jr;
+		ti = amci + ji;
+		yr[4 * k + 1] = CMUL_RE(tr, ti, w1r, w1i);
+		yi[4 * k + 1] = CMUL_IM(tr, ti, w1r, w1i);
+		tr = apcr - bpdr;
+		ti = apci - bpdi;
+		yr[4 * k + 2] = CMUL_RE(tr, ti, w2r, w2i);
+		yi[4 * k + 2] = CMUL_IM(tr, ti, w2r, w2i);
+		tr = amcr - jr;
+		ti = amci - ji;
+		yr[4 * k + 3] = CMUL_RE(tr, ti, w3r, w3i);
+		yi[4 * k + 3] = CMUL_IM(tr, ti, w3r, w3i);
+	}
+}
+
+/* Radix 4 stage of sequences of length @len, at stride @s, a multiple of 4 */
+static void fft_r4(const struct fft_plan *p, unsigned int len, unsigned int s,
+		   const float *xr, const float *xi, float *yr, float *yi)
+{
+	unsigned int m = len / 4, k, q;
+
+	for (k = 0; k < m; k++) {
+		v4f32 w1r = (v4f32){ 0 } + p->tw_re[k * s], w1i = (v4f32){ 0 } + p->tw_im[k * s];
+		v4f32 w2r = (v4f32){ 0 } + p->tw_re[2 * k * s], w2i = (v4f32){ 0 } + p->tw_im[2 * k * s];
+		v4f32 w3r = (v4f32){ 0 } + p->tw_re[3 * k * s], w3i = (v4f32){ 0 } + p->tw_im[3 * k * s];
+		size_t a = (size_t)s * k, y = (size_t)s * 4 * k, sm = (size_t)s * m;
+
+		for (q = 0; q < s; q += 4) {
+			v4f32 ar = simd_load_f32(&xr[a + q]), ai = simd_load_f32(&xi[a + q]);
+			v4f32 br = simd_load_f32(&xr[a + sm + q]), bi = simd_load_f32(&xi[a + sm + q]);
+			v4f32 cr = simd_load_f32(&xr[a + 2 * sm + q]), ci = simd_load_f32(&xi[a + 2 * sm + q]);
+			v4f32 dr = simd_load_f32(&xr[a + 3 * sm + q]), di = simd_load_f32(&xi[a + 3 * sm + q]);
+			v4f32 apcr = ar + cr, apci = ai + ci, amcr = ar - cr, amci = ai - ci;
+			v4f32 bpdr = br + dr, bpdi = bi + di, jr = bi - di, ji = dr - br;
+			v4f32 tr, ti;
+
+			simd_store_f32(&yr[y + q], apcr + bpdr);
+			simd_store_f32(&yi[y + q], apci + bpdi);
+			tr = amcr + jr;
+			ti = amci + ji;
+			simd_store_f32(&yr[y + s + q], CMUL_RE(tr, ti, w1r, w1i));
+			simd_store_f32(&yi[y + s + q], CMUL_IM(tr, ti, w1r, w1i));
+			tr = apcr - bpdr;
+			ti = apci - bpdi;
+			simd_store_f32(&yr[y + 2 * s + q], CMUL_RE(tr, ti, w2r, w2i));
+			simd_store_f32(&yi[y + 2 * s + q], CMUL_IM(tr, ti, w2r, w2i));
+			tr = amcr - jr;
+			ti = amci - ji;
+			simd_store_f32(&yr[y + 3 * s + q], CMUL_RE(tr, ti, w3r, w3i));
+			simd_store_f32(&yi[y + 3 * s + q], CMUL_IM(tr, ti, w3r, w3i));
+		}
+	}
+}
+
+/* Last radix 2 stage, of sequences of length 2 at stride @s */
+static void fft_r2_last(unsigned int s, const float *xr, const float *xi, float *yr, float *yi)
+{
+	unsigned int q;
+
+	for (q = 0; q < s; q += 4) {
+		v4f32 ar = simd_load_f32(&xr[q]), ai = simd_load_f32(&xi[q]);
+		v4f32 br = simd_load_f32(&xr[s + q]), bi = simd_load_f32(&xi[s + q]);
+
+		simd_store_f32(&yr[q], ar + br);
+		simd_store_f32(&yi[q], ai + bi);
+		simd_store_f32(&yr[s + q], ar - br);
+		simd_store_f32(&yi[s + q], ai - bi);
+	}
+}
+
+/**
+ * fft_run() - Forward complex FFT, in place
+ * @p: plan
+ * @re: real parts, p->n of them
+ * @im: imaginary parts
+ *
+ * X[k] = sum of x[j] exp(-2 pi i j k / n), in natural order.
+ */
+void fft_run(struct fft_plan *p, float *re, float *im)
+{
+	float *xr = re, *xi = im, *yr = p->work_re, *yi = p->work_im, *t;
+	unsigned int len = p->n, s = 1;
+
+	for (; len >= 4; len /= 4, s *= 4) {
+		if (s == 1)
+			fft_r4_first(p, xr, xi, yr, yi);
+		else
+			fft_r4(p, len, s, xr, xi, yr, yi);
+		t = xr, xr = yr, yr = t;
+		t = xi, xi = yi, yi = t;
+	}
+	if (len == 2) {
+		fft_r2_last(s, xr, xi, yr, yi);
+		xr = yr;
+		xi = yi;
+	}
+
+	if (xr != re) {
+		memcpy(re, xr, p->n * sizeof(float));
+		memcpy(im, xi, p->n * sizeof(float));
+	}
+}
+
+/**
+ * welch_init() - Set up Welch averaging
+ * @w: state
+ * @n: segment (FFT) size, see fft_init()
+ *
+ * Return: 0 on success, -EINVAL for a bad size, -ENOMEM
+ */
+int welch_init(struct welch *w, unsigned int n)
+{
+	double sum = 0;
+	unsigned int i;
+	int ret;
+
+	memset(w, 0, sizeof(*w));
+	ret = fft_init(&w->plan, n);
+	if (ret)
+		return ret;
+
+	w->win = malloc(n * sizeof(float));
+	w->seg = malloc(n * sizeof(float));
+	w->re = malloc(n * sizeof(float));
+	w->im = malloc(n * sizeof(float));
+	w->psd = calloc(n / 2, sizeof(float));
+	if (!w->win || !w->seg || !w->re || !w->im || !w->psd) {
+		welch_free(w);
+		return -ENOMEM;
+	}
+	for (i = 0; i < n; i++) {
+		w->win[i] = 0.5 - 0.5 * cos(2 * M_PI * i / n);
+		sum += w->win[i];
+	}
+	/* A sine of amplitude A peaks at A * sum / 2 */
+	w->scale = 1 / pow(FFT_FULL_SCALE * sum / 2, 2);
+
+	return 0;
+}
+
+void welch_free(struct welch *w)
+{
+	fft_free(&w->plan);
+	free(w->win);
+	free(w->seg);
+	free(w->re);
+	free(w->im);
+	free(w->psd);
+	memset(w, 0, sizeof(*w));
+}
+
+/* Transform the segments in re and im, and add the power of each */
+static void welch_fft(struct welch *w, unsigned int nseg)
+{
+	unsigned int n = w->plan.n, k, nk;
+	float *re = w->re, *im = w->im;
+
+	fft_run(&w->plan, re, im);
+	/*
+	 * With z = a + ib, A[k] = (Z[k] + conj(Z[n-k])) / 2 and
+	 * B[k] = (Z[k] - conj(Z[n-k])) / 2i
+	 */
+	for (k = 0; k < n / 2; k++) {
+		float sr, si, dr, di;
+
+		nk = (n - k) & (n - 1);
+		sr = re[k] + re[nk];
+		si = im[k] - im[nk];
+		dr = re[k] - re[nk];
+		di = im[k] + im[nk];
+		w->psd[k] += (sr * sr + si * si + dr * dr + di * di) / 4;
+	}
+	w->nseg += nseg;
+}
+
+/**
+ * welch_add() - Add samples
+ * @w: state
+ * @v: ADC codes
+ * @n: number of codes
+ *
+ * Transforms a pair of segments each time a second one is complete.
+ */
+void welch_add(struct welch *w, const int16_t *v, size_t n)
+{
+	unsigned int len = w->plan.n, i, k;
+	float *out;
+
+	while (n) {
+		k = len - w->fill < n ? len - w->fill : n;
+		for (i = 0; i < k; i++)
+			w->seg[w->fill + i] = v[i] - FFT_FULL_SCALE;
+		w->fill += k;
+		v += k;
+		n -= k;
+		if (w->fill < len)
+			break;
+
+		out = w->pending ? w->im : w->re;
+		for (i = 0; i < len; i++)
+			out[i] = w->seg[i] * w->win[i];
+		if (w->pending)
+			welch_fft(w, 2);
+		w->pending = !w->pending;
+
+		/* Segments overlap by half */
+		memmove(w->seg, &w->seg[len / 2], len / 2 * sizeof(float));
+		w->fill = len / 2;
+	}
+}
+
+/**
+ * welch_read() - Average power since the last read
+ * @w: state
+ * @db: p->n / 2 bins, 0 dB for a full scale sine, untouched if no segments
+ *
+ * Return: number of segments averaged
+ */
+unsigned int welch_read(struct welch *w, float *db)
+{
+	unsigned int k, nseg;
+
+	if (w->pending) {
+		memset(w->im, 0, w->plan.n * sizeof(float));
+		welch_fft(w, 1);
+		w->pending = 0;
+	}
+	nseg = w->nseg;
+	if (!nseg)
+		return 0;
+
+	for (k = 0; k < w->plan.n / 2; k++) {
+		db[k] = 10 * log10f(w->psd[k] * w->scale / nseg + 1e-20f);
+		w->psd[k] = 0;
+	}
+	w->nseg = 0;
+
+	return nseg;
+}
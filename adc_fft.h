@@ -0,0 +1,52 @@
+#ifndef MVA_ADC_FFT_H
+#define MVA_ADC_FFT_H
+
+/*
+ * Spectrum of ADC samples: FFT and Welch averaging.
+ *
+ * The FFT is a Stockham transform of radix 4 stages, with one radix 2
+ * stage if the size is an odd power of 2. Stockham ping-pongs between two
+ * buffers instead of reordering the data, so there is no bit reversal
+ * pass. Real and imaginary parts are separate arrays, and all stages but
+ * the first run four butterflies at a time with the adc_simd.h vectors.
+ *
+ * Welch averaging splits the samples into Hann windowed segments that
+ * overlap by half. Two segments are transformed at once, as the real and
+ * imaginary parts of one complex FFT, and separated again by symmetry.
+ * Power is in dB relative to a full scale sine at its peak.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FFT_MIN_SIZE	16
+#define FFT_MAX_SIZE	8192
+
+struct fft_plan {
+	unsigned int n;
+	float *tw_re, *tw_im;	/* exp(-2 pi i k / n), k < n */
+	float *work_re, *work_im;
+};
+
+struct welch {
+	struct fft_plan plan;
+	float *win;		/* Hann window */
+	float *seg;		/* samples of the segment being filled */
+	unsigned int fill;
+	float *re, *im;		/* windowed segments to transform */
+	int pending;		/* one segment waits in re for a second */
+	float *psd;		/* power of n / 2 bins, summed over segments */
+	unsigned int nseg;
+	float scale;		/* 1 / power of a full scale sine peak */
+};
+
+int fft_init(struct fft_plan *p, unsigned int n);
+void fft_free(struct fft_plan *p);
+void fft_run(struct fft_plan *p, float *re, float *im);
+
+int welch_init(struct welch *w, unsigned int n);
+void welch_free(struct welch *w);
+void welch_add(struct welch *w, const int16_t *v, size_t n);
+unsigned int welch_read(struct welch *w, float *db);
+
+#endif
@@ -0,0 +1,84 @@
+#include <math.h>
+
+#include "adc_phosphor.h"
+#include "adc_simd.h"
+
+/* Vertical span in column @c from the row after @prev to @r */
+static inline void phos_span(float *img, unsigned int cols, unsigned int c, int prev, int r)
+{
+	int lo = r, hi = r;
+
+	if (prev >= 0 && r > prev)
+		lo = prev + 1;
+	else if (prev >= 0 && r < prev)
+		hi = prev - 1;
+	for (; lo <= hi; lo++)
+		img[(size_t)lo * cols + c] += 1;
+}
+
+static inline int phos_row(uint16_t v, unsigned int rows, float scale, float off)
+{
+	float r = v * scale + off;
+
+	return r <= 0 ? 0 : r >= rows - 1 ? (int)rows - 1 : (int)r;
+}
+
+/**
+ * phos_sweep() - Add a sweep of samples to an intensity image
+ * @img: @cols x @rows image
+ * @cols: image width
+ * @rows: image height
+ * @v: samples, spread over the width
+ * @n: number of samples, at least 1
+ * @scale: rows per sample value
+ * @off: row of sample value 0, rows outside the image are clipped
+ *
+ * Column c gets samples [c * n / cols, (c + 1) * n / cols), as in
+ * env_columns(). Each sample adds a span joining it to the one before, so
+ * every pixel the trace crosses counts once per sweep. With fewer samples
+ * than columns, the samples are interpolated to one per column.
+ */
+void phos_sweep(float *img, unsigned int cols, unsigned int rows, const uint16_t *v,
+		size_t n, float scale, float off)
+{
+	size_t i, next;
+	unsigned int c;
+	int r, prev = -1;
+
+	if (n < cols) {
+		for (c = 0; c < cols; c++) {
+			float x = n > 1 && cols > 1 ? (float)c * (n - 1) / (cols - 1) : 0;
+			size_t k = (size_t)x;
+			float y = k + 1 < n ? v[k] + (v[k + 1] - v[k]) * (x - k) : v[k];
+
+			r = phos_row(0, rows, 0, y * scale + off);
+			phos_span(img, cols, c, prev, r);
+			prev = r;
+		}
+		return;
+	}
+
+	c = 0;
+	next = n / cols;
+	for (i = 0; i < n; i++) {
+		while (i >= next && c < cols - 1)
+			next = (size_t)(++c + 1) * n / cols;
+		r = phos_row(v[i], rows, scale, off);
+		phos_span(img, cols, c, prev, r);
+		prev = r;
+	}
+}
+
+/**
+ * phos_decay() - Fade an intensity image
+ * @img: image
+ * @n: number of pixels
+ * @secs: time since the last fade
+ * @tau: decay time constant in seconds, 0 to keep everything
+ *
+ * Return: largest pixel value after fading
+ */
+float phos_decay(float *img, size_t n, double secs, double tau)
+{
+	return simd_scale_max_f32(img, n, tau > 0 ? exp(-secs / tau) : 1);
+}
@@ -0,0 +1,24 @@
+#ifndef MVA_ADC_PHOSPHOR_H
+#define MVA_ADC_PHOSPHOR_H
+
+/*
+ * Digital phosphor: sweeps of samples counted into an intensity image.
+ *
+ * Each sweep is rasterised as a vector trace, adding one to every pixel
+ * it crosses, so a pixel holds how often the signal passed through it.
+ * Old sweeps fade as the image is scaled down over time. Shown with a
+ * colour map, a rare glitch stands out from the normal trace however
+ * many sweeps there are per frame.
+ *
+ * The image is cols x rows floats, row 0 at the bottom, as an OpenGL
+ * texture has it.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+void phos_sweep(float *img, unsigned int cols, unsigned int rows, const uint16_t *v,
+		size_t n, float scale, float off);
+float phos_decay(float *img, size_t n, double secs, double tau);
+
+#endif
@@ -0,0 +1,564 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "adc_capset.h"
+#include "adc_common.h"
+#include "adc_pyramid.h"
+
+/* Level entries read with one pread() */
+#define PYR_READ_ENTS	256
+/* Spill file bytes copied at a time when closing */
+#define PYR_COPY_BYTES	16384
+
+static void acc_reset(struct pyr_acc *a)
+{
+	memset(a, 0, sizeof(*a));
+	memset(a->min, 0xff, sizeof(a->min));
+}
+
+/* Close the sidecar and spill files, negative errno if the sidecar failed */
+static int pyr_files_close(struct pyr_writer *p)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < PYR_MAX_LEVELS; i++) {
+		if (p->spill[i])
+			fclose(p->spill[i]);
+		p->spill[i] = NULL;
+	}
+	if (p->f && fclose(p->f))
+		ret = -errno;
+	p->f = NULL;
+
+	return ret;
+}
+
+/* Append @len bytes written to a spill file to the sidecar */
+static int spill_copy(FILE *from, FILE *to, uint64_t len)
+{
+	char buf[PYR_COPY_BYTES];
+	size_t n;
+
+	if (fseek(from, 0, SEEK_SET))
+		return -errno;
+
+	while (len) {
+		n = len < sizeof(buf) ? len : sizeof(buf);
+		if (fread(buf, 1, n, from) != n || fwrite(buf, 1, n, to) != n)
+			return -EIO;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * pyr_open_write() - Create the pyramid sidecar of a segment
+ * @p: writer
+ * @path: sidecar file
+ * @nwords: words in a frame
+ *
+ * Return: 0 on success, negative errno on failure
+ */
+int pyr_open_write(struct pyr_writer *p, const char *path, unsigned int nwords)
+{
+	char tmp[CAPSET_NAME_LEN + 4];
+	int i, ret;
+
+	memset(p, 0, sizeof(*p));
+	if (!nwords || nwords > PYR_MAX_WORDS || (MAX_SAMPS / nwords) % PYR_BASE)
+		return -EINVAL;
+
+	p->nwords = nwords;
+	for (i = 0; i < PYR_MAX_LEVELS; i++)
+		acc_reset(&p->acc[i]);
+
+	p->f = fopen(path, "w");
+	if (!p->f)
+		return -errno;
+
+	/* On the same disk as the sidecar, and gone if the recorder dies */
+	for (i = 0; i < PYR_MAX_LEVELS; i++) {
+		snprintf(tmp, sizeof(tmp), "%s.%d", path, i);
+		p->spill[i] = fopen(tmp, "w+");
+		if (!p->spill[i]) {
+			ret = -errno;
+			pyr_files_close(p);
+			return ret;
+		}
+		unlink(tmp);
+	}
+
+	return 0;
+}
+
+/* Finish an entry of a level, and merge it to the level above */
+static int pyr_emit(struct pyr_writer *p, int level)
+{
+	struct pyr_acc *a = &p->acc[level];
+	struct pyr_ent e[PYR_MAX_WORDS];
+	unsigned int w;
+
+	for (w = 0; w < p->nwords; w++) {
+		e[w].min = a->min[w];
+		e[w].max = a->max[w];
+		e[w].mean = a->sum[w] / a->n;
+	}
+
+	/* Level 0 goes straight to the sidecar, the others are spilled */
+	if (fwrite(e, sizeof(e[0]), p->nwords, level ? p->spill[level] : p->f) != p->nwords)
+		return -EIO;
+	p->len[level]++;
+	acc_reset(a);
+
+	if (level + 1 == PYR_MAX_LEVELS)
+		return 0;
+
+	a = &p->acc[level + 1];
+	for (w = 0; w < p->nwords; w++) {
+		if (e[w].min < a->min[w])
+			a->min[w] = e[w].min;
+		if (e[w].max > a->max[w])
+			a->max[w] = e[w].max;
+		a->sum[w] += e[w].mean;
+	}
+
+	return (++a->n == PYR_FACTOR) ? pyr_emit(p, level + 1) : 0;
+}
+
+/**
+ * pyr_add_block() - Add a block of the segment to the pyramid
+ * @p: writer
+ * @time_ns: 64-bit block time
+ * @a: block
+ *
+ * Return: 0 on success, negative errno on failure
+ */
+int pyr_add_block(struct pyr_writer *p, uint64_t time_ns, const struct adc_data *a)
+{
+	struct pyr_acc *acc = &p->acc[0];
+	const unsigned int nw = p->nwords;
+	unsigned int i, w;
+	int ret;
+
+	if (fwrite(&time_ns, sizeof(time_ns), 1, p->spill[0]) != 1)
+		return -EIO;
+	p->nblocks++;
+
+	for (i = 0; i < MAX_SAMPS; i += nw) {
+		for (w = 0; w < nw; w++) {
+			uint16_t v = ADC_RAW2CODE(a->samples[i + w]);
+
+			if (v < acc->min[w])
+				acc->min[w] = v;
+			if (v > acc->max[w])
+				acc->max[w] = v;
+			acc->sum[w] += v;
+		}
+		if (++acc->n == PYR_BASE) {
+			ret = pyr_emit(p, 0);
+			if (ret)
+				return ret;
+		}
+	}
+
+	/* Readers of a live segment use level 0 up to the last block */
+	return fflush(p->f) ? -EIO : 0;
+}
+
+/**
+ * pyr_close_write() - Write the upper levels, block times and footer
+ * @p: writer
+ *
+ * Return: 0 on success, negative errno on failure
+ */
+int pyr_close_write(struct pyr_writer *p)
+{
+	struct pyr_footer ft;
+	const size_t esize = p->nwords * sizeof(struct pyr_ent);
+	int i, ret = 0;
+
+	if (!p->f)
+		return -EINVAL;
+
+	/* Partial entries at the end of the segment */
+	for (i = 0; i < PYR_MAX_LEVELS && !ret; i++)
+		if (p->acc[i].n)
+			ret = pyr_emit(p, i);
+
+	memset(&ft, 0, sizeof(ft));
+	memcpy(ft.magic, PYR_MAGIC, sizeof(ft.magic));
+	ft.version = PYR_VERSION;
+	ft.nwords = p->nwords;
+	ft.base = PYR_BASE;
+	ft.factor = PYR_FACTOR;
+	ft.nblocks = p->nblocks;
+
+	for (i = 0; i < PYR_MAX_LEVELS && !ret && p->len[i]; i++) {
+		ft.level_len[i] = p->len[i];
+		ft.level_off[i] = i ? ftell(p->f) : 0;	/* level 0 was streamed */
+		ft.nlevels = i + 1;
+		if (i)
+			ret = spill_copy(p->spill[i], p->f, p->len[i] * esize);
+	}
+
+	ft.times_off = ftell(p->f);
+	if (!ret)
+		ret = spill_copy(p->spill[0], p->f, p->nblocks * sizeof(uint64_t));
+	if (!ret && fwrite(&ft, sizeof(ft), 1, p->f) != 1)
+		ret = -EIO;
+
+	i = pyr_files_close(p);
+
+	return ret ? ret : i;
+}
+
+void pyr_seg_free(struct pyr_seg *ps)
+{
+	if (ps->fd >= 0)
+		close(ps->fd);
+	ps->fd = -1;
+	free(ps->times);
+	ps->times = NULL;
+	ps->live = false;
+}
+
+/*
+ * Load the pyramid of a segment, fd is left -1 if there is none. Without
+ * a footer, the segment is being recorded: its level 0 is used for the
+ * blocks the reader knows of.
+ */
+static struct pyr_seg *pyr_get_live(struct capset_reader *r, unsigned int s, off_t size)
+{
+	struct capset_seg *seg = &r->segs[s];
+	struct pyr_seg *ps = &seg->pyr;
+	unsigned int nw = ADC_FRAME_WORDS(&r->hdr.info) ? : 1;
+	uint64_t len = size / (nw * sizeof(struct pyr_ent));
+	uint64_t max = seg->nblocks * (MAX_SAMPS / nw) / PYR_BASE;
+
+	if (nw > PYR_MAX_WORDS) {
+		pyr_seg_free(ps);
+		return ps;
+	}
+
+	memset(&ps->ft, 0, sizeof(ps->ft));
+	ps->ft.nwords = nw;
+	ps->ft.base = PYR_BASE;
+	ps->ft.factor = PYR_FACTOR;
+	ps->ft.nlevels = 1;
+	ps->ft.level_len[0] = len < max ? len : max;
+	ps->live = true;
+
+	return ps;
+}
+
+static struct pyr_seg *pyr_get(struct capset_reader *r, unsigned int s)
+{
+	struct capset_seg *seg = &r->segs[s];
+	struct pyr_seg *ps = &seg->pyr;
+	struct pyr_footer *ft = &ps->ft;
+	char path[CAPSET_NAME_LEN];
+	size_t tsize;
+	struct stat st;
+
+	if (seg->pyr_loaded)
+		return ps;
+
+	seg->pyr_loaded = true;
+	capset_seg_path(path, r->dir, seg->num, "pyr");
+	ps->fd = open(path, O_RDONLY);
+	if (ps->fd < 0)
+		return ps;
+
+	if (fstat(ps->fd, &st))
+		goto err;
+	if (st.st_size < (off_t)sizeof(*ft) ||
+	    pread(ps->fd, ft, sizeof(*ft), st.st_size - sizeof(*ft)) != sizeof(*ft) ||
+	    memcmp(ft->magic, PYR_MAGIC, sizeof(ft->magic)))
+		return pyr_get_live(r, s, st.st_size);
+	if (ft->version != PYR_VERSION ||
+	    ft->base != PYR_BASE || ft->factor != PYR_FACTOR || !ft->nblocks ||
+	    !ft->nlevels || ft->nlevels > PYR_MAX_LEVELS ||
+	    !ft->nwords || ft->nwords > PYR_MAX_WORDS)
+		goto err;
+
+	tsize = ft->nblocks * sizeof(*ps->times);
+	ps->times = malloc(tsize);
+	if (!ps->times || pread(ps->fd, ps->times, tsize, ft->times_off) != (ssize_t)tsize)
+		goto err;
+
+	return ps;
+
+err:
+	pyr_seg_free(ps);
+	return ps;
+}
+
+static void point_init(struct pyr_point *pt)
+{
+	pt->min = UINT16_MAX;
+	pt->max = 0;
+	pt->mean = 0;
+	pt->count = 0;
+	pt->sum = 0;
+}
+
+static void point_add(struct pyr_point *pt, uint16_t min, uint16_t max, uint16_t mean,
+		      uint32_t count)
+{
+	if (min < pt->min)
+		pt->min = min;
+	if (max > pt->max)
+		pt->max = max;
+	pt->sum += (uint64_t)mean * count;
+	pt->count += count;
+	pt->mean = pt->sum / pt->count;
+}
+
+/* Add frames of a block in [fa, fb) (indexes in the block) to a point */
+static void block_add(struct pyr_point *pt, const struct cap_block *b, unsigned int nwords,
+		      unsigned int word, uint64_t fa, uint64_t fb)
+{
+	uint64_t i;
+
+	for (i = fa; i < fb; i++) {
+		uint16_t v = b->samples[i * nwords + word] & ADC_CODE_MASK;
+
+		point_add(pt, v, v, v, 1);
+	}
+}
+
+/*
+ * Index of the first frame of a segment at or after time t. The block is
+ * found in the block times, or with the segment index if live.
+ */
+static int frame_at(struct capset_reader *r, unsigned int s, const struct pyr_seg *ps,
+		    uint64_t t, unsigned int fpb, uint64_t frame_ps, uint64_t *frame)
+{
+	uint64_t lo = 0, hi = ps->ft.nblocks, mid, i, tb;
+	struct cap_block b;
+	int ret;
+
+	*frame = 0;
+	if (t <= r->segs[s].idx[0].time_ns)
+		return 0;
+
+	if (ps->live) {
+		ret = capset_seek(r, t);
+		if (!ret && r->cur != s) {
+			*frame = r->segs[s].nblocks * fpb;
+			return 0;
+		}
+		lo = r->blk;
+		if (!ret)
+			ret = capset_read_block(r, &b, &tb);
+		if (ret)
+			return ret;
+	} else {
+		while (hi - lo > 1) {
+			mid = (lo + hi) / 2;
+			if (ps->times[mid] <= t)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		tb = ps->times[lo];
+	}
+
+	i = ((t - tb) * 1000 + frame_ps - 1) / frame_ps;
+	if (i > fpb)
+		i = fpb;
+	*frame = lo * fpb + i;
+
+	return 0;
+}
+
+/* Envelope of a segment without pyramid, from its samples */
+static int raw_range(struct capset_reader *r, unsigned int s, unsigned int nwords,
+		     unsigned int word, uint64_t ta, uint64_t tb, struct pyr_point *pt)
+{
+	const uint64_t frame_ps = r->hdr.word_ps * nwords;
+	const unsigned int fpb = MAX_SAMPS / nwords;
+	const uint64_t start = r->segs[s].idx[0].time_ns;
+	struct cap_block b;
+	uint64_t t, fa, fb;
+	int ret;
+
+	ret = capset_seek(r, ta > start ? ta : start);
+	while (!ret) {
+		ret = capset_read_block(r, &b, &t);
+		if (ret || r->cur != s || t >= tb)
+			break;
+
+		fa = (t < ta && frame_ps) ? ((ta - t) * 1000 + frame_ps - 1) / frame_ps : 0;
+		fb = frame_ps ? ((tb - t) * 1000 + frame_ps - 1) / frame_ps : fpb;
+		block_add(pt, &b, nwords, word, fa < fpb ? fa : fpb, fb < fpb ? fb : fpb);
+	}
+
+	return (ret == -ENODATA) ? 0 : ret;
+}
+
+/* Envelope of frames [fa, fb) of a segment, from its samples */
+static int frames_add(struct capset_reader *r, unsigned int s, unsigned int nw,
+		      unsigned int word, uint64_t fa, uint64_t fb, struct pyr_point *pt)
+{
+	const unsigned int fpb = MAX_SAMPS / nw;
+	struct cap_block b;
+	uint64_t k;
+	int ret;
+
+	for (k = fa / fpb; k * fpb < fb; k++) {
+		ret = capset_read_at(r, s, k, &b, NULL);
+		if (ret)
+			return ret;
+		block_add(pt, &b, nw, word, fa > k * fpb ? fa - k * fpb : 0,
+			  fb < (k + 1) * fpb ? fb - k * fpb : fpb);
+	}
+
+	return 0;
+}
+
+/*
+ * Envelope of frames [fa, fb) of a segment, from the pyramid level that has
+ * PYR_FACTOR to PYR_FACTOR^2 entries for them, or from the samples if there
+ * are fewer frames than that. Frames of a live segment past its level 0
+ * are read from the samples.
+ */
+static int pyr_range(struct capset_reader *r, unsigned int s, struct pyr_seg *ps,
+		     unsigned int word, uint64_t fa, uint64_t fb, struct pyr_point *pt)
+{
+	struct pyr_ent e[PYR_READ_ENTS * PYR_MAX_WORDS];
+	const unsigned int nw = ps->ft.nwords;
+	const uint64_t done = ps->ft.level_len[0] * PYR_BASE;
+	uint64_t n, bsize = PYR_BASE, ea, eb, i, k;
+	unsigned int level = 0;
+	ssize_t len;
+	int ret;
+
+	if (ps->live && fb > done) {
+		ret = frames_add(r, s, nw, word, fa > done ? fa : done, fb, pt);
+		if (ret || fa >= done)
+			return ret;
+		fb = done;
+	}
+
+	n = fb - fa;
+	if (n < PYR_BASE * PYR_FACTOR)
+		return frames_add(r, s, nw, word, fa, fb, pt);
+
+	while (level + 1 < ps->ft.nlevels && bsize * PYR_FACTOR * PYR_FACTOR <= n) {
+		level++;
+		bsize *= PYR_FACTOR;
+	}
+
+	ea = fa / bsize;
+	eb = (fb + bsize - 1) / bsize;
+	if (eb > ps->ft.level_len[level])
+		eb = ps->ft.level_len[level];
+
+	for (; ea < eb; ea += k) {
+		k = (eb - ea < PYR_READ_ENTS) ? eb - ea : PYR_READ_ENTS;
+		len = k * nw * sizeof(e[0]);
+		if (pread(ps->fd, e, len, ps->ft.level_off[level] + ea * nw * sizeof(e[0])) != len)
+			return -EIO;
+		for (i = 0; i < k; i++) {
+			const struct pyr_ent *p = &e[i * nw + word];
+
+			point_add(pt, p->min, p->max, p->mean, bsize);
+		}
+	}
+
+	return 0;
+}
+
+/* Time after the last frame of a segment, or of the next segment start */
+static uint64_t seg_end(struct capset_reader *r, unsigned int s, uint64_t block_ns)
+{
+	struct pyr_seg *ps = pyr_get(r, s);
+
+	if (ps->times)
+		return ps->times[ps->ft.nblocks - 1] + block_ns;
+
+	return (s + 1 < r->nsegs) ? r->segs[s + 1].idx[0].time_ns : UINT64_MAX;
+}
+
+/**
+ * pyr_query() - Min/max/mean envelope of a time range
+ * @r: capture set
+ * @word: word in frame (channel)
+ * @t0: start of range, see capset_first_ns()
+ * @t1: end of range
+ * @out: envelope points
+ * @npoints: number of points, the range is split in this many equal slices
+ *
+ * Each slice is read from the coarsest pyramid level that still has at
+ * least PYR_FACTOR entries in it, so the work is proportional to @npoints
+ * and not to the length of the range. Slices are widened to the entry
+ * boundaries of that level. A segment being recorded only has level 0,
+ * as far as it has been written. Slices with few frames, the rest of a
+ * segment being recorded, and segments without a pyramid are read from
+ * the samples.
+ *
+ * The sequential read position of @r is moved.
+ *
+ * Return: @npoints on success, negative errno on failure
+ */
+int pyr_query(struct capset_reader *r, unsigned int word, uint64_t t0, uint64_t t1,
+	      struct pyr_point *out, unsigned int npoints)
+{
+	unsigned int nwords = ADC_FRAME_WORDS(&r->hdr.info) ? : 1;
+	const uint64_t frame_ps = r->hdr.word_ps * nwords;
+	const unsigned int fpb = MAX_SAMPS / nwords;
+	const uint64_t block_ns = fpb * frame_ps / 1000;
+	unsigned int i, j, s, lo, hi, mid;
+	uint64_t ta, tb;
+	int ret;
+
+	if (!npoints || t1 <= t0 || word >= nwords || nwords > PYR_MAX_WORDS)
+		return -EINVAL;
+
+	for (lo = 0, hi = r->nsegs; hi - lo > 1;) {
+		mid = (lo + hi) / 2;
+		if (r->segs[mid].idx[0].time_ns <= t0)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	s = lo;
+
+	for (i = 0; i < npoints; i++) {
+		ta = t0 + (t1 - t0) * i / npoints;
+		tb = t0 + (t1 - t0) * (i + 1) / npoints;
+		point_init(&out[i]);
+
+		for (j = s; j < r->nsegs && r->segs[j].idx[0].time_ns < tb; j++) {
+			struct pyr_seg *ps;
+
+			if (seg_end(r, j, block_ns) <= ta) {
+				s = j + 1;
+				continue;
+			}
+
+			ps = pyr_get(r, j);
+			if (ps->fd < 0 || ps->ft.nwords != nwords) {
+				ret = raw_range(r, j, nwords, word, ta, tb, &out[i]);
+			} else {
+				uint64_t fa, fb;
+
+				ret = frame_at(r, j, ps, ta, fpb, frame_ps, &fa);
+				if (!ret)
+					ret = frame_at(r, j, ps, tb, fpb, frame_ps, &fb);
+				if (!ret && fb > fa)
+					ret = pyr_range(r, j, ps, word, fa, fb, &out[i]);
+			}
+			if (ret)
+				return ret;
+		}
+	}
+
+	return npoints;
+}
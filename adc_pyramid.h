@@ -0,0 +1,97 @@
+#ifndef MVA_ADC_PYRAMID_H
+#define MVA_ADC_PYRAMID_H
+
+/*
+ * Min/max/mean pyramid of a capture segment.
+ *
+ * Level 0 has an entry for every PYR_BASE frames of the segment, and each
+ * level above has an entry for every PYR_FACTOR entries of the level
+ * below. An entry holds the envelope of each word of the frame (channel),
+ * in ADC codes.
+ *
+ * The sidecar segNNNNNNNN.pyr is written next to the segment: level 0 is
+ * streamed as the segment is recorded, the smaller levels and the block
+ * times follow when the segment is closed, and a footer at the end of
+ * the file tells where they are. Until then the writer spills them to
+ * unlinked files beside the sidecar, so its memory doesn't grow with
+ * the segment. A segment still being recorded has no footer; queries
+ * use its level 0 as far as it has been written, and the samples after.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "adc_data.h"
+
+#define PYR_MAGIC	"MVAPYR\r\n"
+#define PYR_VERSION	1
+#define PYR_BASE	64	/* frames in a level 0 entry */
+#define PYR_FACTOR	16	/* entries merged to an entry of the next level */
+#define PYR_MAX_LEVELS	6
+#define PYR_MAX_WORDS	4	/* frame words (channels) */
+
+struct pyr_ent {
+	uint16_t min;
+	uint16_t max;
+	uint16_t mean;
+};
+
+/* Envelope point returned by queries, min > max if there was no data */
+struct pyr_point {
+	uint16_t min;
+	uint16_t max;
+	uint16_t mean;
+	uint32_t count;		/* frames covered */
+	uint64_t sum;		/* of the frames, the mean is kept from it */
+};
+
+struct pyr_footer {
+	char magic[8];		/* PYR_MAGIC */
+	uint32_t version;
+	uint32_t nwords;	/* frame words, each level entry has nwords pyr_ent */
+	uint32_t base;		/* PYR_BASE */
+	uint32_t factor;	/* PYR_FACTOR */
+	uint32_t nlevels;
+	uint32_t reserved;
+	uint64_t nblocks;	/* block time table length */
+	uint64_t times_off;	/* file offset of block times, uint64_t ns */
+	uint64_t level_off[PYR_MAX_LEVELS];	/* file offset of each level */
+	uint64_t level_len[PYR_MAX_LEVELS];	/* entries in each level */
+};
+
+struct pyr_acc {
+	uint16_t min[PYR_MAX_WORDS];
+	uint16_t max[PYR_MAX_WORDS];
+	uint64_t sum[PYR_MAX_WORDS];
+	uint32_t n;		/* frames or entries merged */
+};
+
+struct pyr_writer {
+	FILE *f;
+	FILE *spill[PYR_MAX_LEVELS];	/* block times, then levels above 0 */
+	unsigned int nwords;
+	struct pyr_acc acc[PYR_MAX_LEVELS];
+	uint64_t len[PYR_MAX_LEVELS];
+	uint64_t nblocks;
+};
+
+/* Pyramid of a segment, loaded by the reader */
+struct pyr_seg {
+	int fd;			/* -1 if the segment has no pyramid */
+	struct pyr_footer ft;
+	uint64_t *times;	/* NULL if live */
+	bool live;		/* no footer yet, ft has the level 0 written so far */
+};
+
+struct capset_reader;
+
+int pyr_open_write(struct pyr_writer *p, const char *path, unsigned int nwords);
+int pyr_add_block(struct pyr_writer *p, uint64_t time_ns, const struct adc_data *a);
+int pyr_close_write(struct pyr_writer *p);
+
+int pyr_query(struct capset_reader *r, unsigned int word, uint64_t t0, uint64_t t1,
+	      struct pyr_point *out, unsigned int npoints);
+void pyr_seg_free(struct pyr_seg *ps);
+
+#endif
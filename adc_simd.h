@@ -0,0 +1,217 @@
+#ifndef MVA_ADC_SIMD_H
+#define MVA_ADC_SIMD_H
+
+/*
+ * Small SIMD helpers for scanning ADC sample blocks.
+ *
+ * These use the GCC vector extensions, so the same code builds to NEON on
+ * the Pi 4 (aarch64 / armv7 with -mfpu=neon) and to SSE2 on x86 hosts.
+ * Without vector support the compiler lowers the vector types to scalar
+ * code, which is still correct - just slower.
+ *
+ * The helpers work on int16_t samples, apart from the _u16 ones for
+ * unsigned display values, the _f32 ones for display intensities and the
+ * _u8 ones for text. Raw SPI words from the DMA must be converted with
+ * adc_raw_to_i16() first.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "adc_common.h"
+
+#define SIMD_LANES	8
+
+typedef int16_t v8i16 __attribute__((vector_size(16)));
+typedef uint16_t v8u16 __attribute__((vector_size(16)));
+typedef uint8_t v16u8 __attribute__((vector_size(16)));
+typedef uint64_t v2u64 __attribute__((vector_size(16)));
+typedef int32_t v4i32 __attribute__((vector_size(16)));
+typedef float v4f32 __attribute__((vector_size(16)));
+
+static inline v8i16 simd_load_i16(const int16_t *p)
+{
+	v8i16 v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return v;
+}
+
+static inline v8u16 simd_load_u16(const uint16_t *p)
+{
+	v8u16 v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return v;
+}
+
+static inline v16u8 simd_load_u8(const uint8_t *p)
+{
+	v16u8 v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return v;
+}
+
+static inline v4f32 simd_load_f32(const float *p)
+{
+	v4f32 v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return v;
+}
+
+static inline void simd_store_f32(float *p, v4f32 v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+static inline v8i16 simd_splat_i16(int16_t val)
+{
+	return (v8i16){ 0 } + val;
+}
+
+static inline int simd_any(v8i16 mask)
+{
+	v2u64 m = (v2u64)mask;
+
+	return (m[0] | m[1]) != 0;
+}
+
+/**
+ * simd_find_outside() - Find first sample at or beyond given limits
+ * @v: samples
+ * @n: number of samples
+ * @lo: match samples <= lo (use INT16_MIN to disable)
+ * @hi: match samples >= hi (use INT16_MAX to disable, ADC codes and sample
+ *	differences never reach it)
+ *
+ * Return: index of the first matching sample, or -1 if none matches
+ */
+static inline int simd_find_outside(const int16_t *v, int n, int16_t lo,
+				    int16_t hi)
+{
+	v8i16 vlo = simd_splat_i16(lo);
+	v8i16 vhi = simd_splat_i16(hi);
+	int i;
+
+	for (i = 0; i + SIMD_LANES <= n; i += SIMD_LANES) {
+		v8i16 x = simd_load_i16(&v[i]);
+
+		if (simd_any((x <= vlo) | (x >= vhi)))
+			break;
+	}
+
+	for (; i < n; i++)
+		if (v[i] <= lo || v[i] >= hi)
+			return i;
+
+	return -1;
+}
+
+/**
+ * simd_minmax_u16() - Find smallest and largest sample
+ * @v: samples
+ * @n: number of samples, at least 1
+ * @min: smallest sample
+ * @max: largest sample
+ */
+static inline void simd_minmax_u16(const uint16_t *v, int n, uint16_t *min,
+				   uint16_t *max)
+{
+	v8u16 vmin = (v8u16){ 0 } + UINT16_MAX, vmax = (v8u16){ 0 };
+	uint16_t lo, hi;
+	int i;
+
+	for (i = 0; i + SIMD_LANES <= n; i += SIMD_LANES) {
+		v8u16 x = simd_load_u16(&v[i]);
+		v8u16 m = (v8u16)(x < vmin);
+
+		vmin = (x & m) | (vmin & ~m);
+		m = (v8u16)(x > vmax);
+		vmax = (x & m) | (vmax & ~m);
+	}
+
+	lo = UINT16_MAX;
+	hi = 0;
+	for (; i < n; i++) {
+		if (v[i] < lo)
+			lo = v[i];
+		if (v[i] > hi)
+			hi = v[i];
+	}
+	for (i = 0; i < SIMD_LANES; i++) {
+		if (vmin[i] < lo)
+			lo = vmin[i];
+		if (vmax[i] > hi)
+			hi = vmax[i];
+	}
+
+	*min = lo;
+	*max = hi;
+}
+
+/**
+ * simd_scale_max_f32() - Scale values in place, and find the largest
+ * @v: values, not negative
+ * @n: number of values
+ * @k: scale factor
+ *
+ * Return: largest value after scaling, 0 if there are none
+ */
+static inline float simd_scale_max_f32(float *v, int n, float k)
+{
+	v4f32 vmax = { 0 }, vk = (v4f32){ 0 } + k;
+	float hi = 0;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		v4f32 x = simd_load_f32(&v[i]) * vk;
+		v4i32 m = x > vmax;
+
+		simd_store_f32(&v[i], x);
+		vmax = (v4f32)(((v4i32)x & m) | ((v4i32)vmax & ~m));
+	}
+
+	for (; i < n; i++) {
+		v[i] *= k;
+		if (v[i] > hi)
+			hi = v[i];
+	}
+	for (i = 0; i < 4; i++) {
+		if (vmax[i] > hi)
+			hi = vmax[i];
+	}
+
+	return hi;
+}
+
+/**
+ * adc_raw_to_i16() - Convert raw SPI words to ADC codes
+ * @out: destination, @n entries
+ * @raw: raw sample words as written by the DMA
+ * @n: number of samples to convert
+ * @stride: distance (in words) between consecutive samples of a channel
+ *
+ * With stride 1 the loop is vectorised by the compiler.
+ */
+static inline void adc_raw_to_i16(int16_t *out, const uint32_t *raw, int n,
+				  int stride)
+{
+	int i;
+
+	if (stride == 1) {
+		for (i = 0; i < n; i++)
+			out[i] = ADC_RAW2CODE(raw[i]);
+		return;
+	}
+
+	for (i = 0; i < n; i++)
+		out[i] = ADC_RAW2CODE(raw[i * stride]);
+}
+
+#endif
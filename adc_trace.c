@@ -0,0 +1,109 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "adc_trace.h"
+
+struct adc_trace *trace_init(void *buff, size_t bufsize)
+{
+	struct adc_trace *t = buff;
+
+	if (!buff || bufsize < sizeof(*t))
+		return NULL;
+
+	memset(t, 0, sizeof(*t));
+	t->version = TRACE_VERSION;
+	t->size = sizeof(*t);
+	atomic_init(&t->next_blk, 0);
+
+	return t;
+}
+
+bool trace_is_ok(const struct adc_trace *t)
+{
+	return t && t->version == TRACE_VERSION && t->size >= sizeof(*t);
+}
+
+/**
+ * trace_record() - Store producer timestamps of a published block
+ * @t: trace buffer
+ * @blk: block number (ring write index of the block)
+ * @rec: timestamps. The blk and consume_ns fields are ignored.
+ *
+ * Single writer. Readers detect a record being rewritten by the blk field,
+ * which is cleared during the update and set last.
+ */
+void trace_record(struct adc_trace *t, unsigned int blk, const struct adc_trace_rec *rec)
+{
+	struct adc_trace_rec *r = &t->rec[blk & TRACE_MASK];
+
+	atomic_store_explicit(&r->blk, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	r->dma_end_us = rec->dma_end_us;
+	r->detect_us = rec->detect_us;
+	r->overruns = rec->overruns;
+	r->detect_ns = rec->detect_ns;
+	r->copy_ns = rec->copy_ns;
+	r->publish_ns = rec->publish_ns;
+	atomic_store_explicit(&r->consume_ns, 0, memory_order_relaxed);
+
+	atomic_store_explicit(&r->blk, blk + 1, memory_order_release);
+	atomic_store_explicit(&t->next_blk, blk + 1, memory_order_release);
+}
+
+/**
+ * trace_consumed() - Mark blocks read by the consumer
+ * @t: trace buffer, NULL when tracing is not enabled
+ * @first_blk: block number of the first block read (ring read index before
+ *	       the ring_read() call)
+ * @num: number of blocks read
+ */
+void trace_consumed(struct adc_trace *t, unsigned int first_blk, unsigned int num)
+{
+	uint64_t now;
+	unsigned int i;
+
+	if (!t)
+		return;
+
+	now = trace_now_ns();
+	for (i = 0; i < num; i++) {
+		struct adc_trace_rec *r = &t->rec[(first_blk + i) & TRACE_MASK];
+
+		if (atomic_load_explicit(&r->blk, memory_order_acquire) == first_blk + i + 1)
+			atomic_store_explicit(&r->consume_ns, now, memory_order_relaxed);
+	}
+}
+
+/**
+ * trace_get() - Get a consistent copy of a trace record
+ * @t: trace buffer
+ * @blk: block number
+ * @rec: destination
+ *
+ * Return: 0 on success, -ENODATA if the block has no record (anymore)
+ */
+int trace_get(struct adc_trace *t, unsigned int blk, struct adc_trace_rec *rec)
+{
+	struct adc_trace_rec *r = &t->rec[blk & TRACE_MASK];
+
+	if (atomic_load_explicit(&r->blk, memory_order_acquire) != blk + 1)
+		return -ENODATA;
+
+	rec->dma_end_us = r->dma_end_us;
+	rec->detect_us = r->detect_us;
+	rec->overruns = r->overruns;
+	rec->detect_ns = r->detect_ns;
+	rec->copy_ns = r->copy_ns;
+	rec->publish_ns = r->publish_ns;
+	rec->consume_ns = atomic_load_explicit(&r->consume_ns, memory_order_relaxed);
+
+	atomic_thread_fence(memory_order_acquire);
+	if (atomic_load_explicit(&r->blk, memory_order_relaxed) != blk + 1)
+		return -ENODATA;
+
+	atomic_init(&rec->blk, blk + 1);
+
+	return 0;
+}
@@ -0,0 +1,65 @@
+#ifndef MVA_ADC_TRACE_H
+#define MVA_ADC_TRACE_H
+
+/*
+ * Optional per-block latency trace.
+ *
+ * The producer records when each block finished in the DMA, when the CPU
+ * noticed it, when it was copied and when ring_add() published it. The
+ * consumer adds the time it got the block from ring_read(). Records live
+ * in their own shared memory so the trace can be enabled without touching
+ * the ring layout.
+ *
+ * DMA end and CPU detect times are in the 1MHz system timer the DMA chain
+ * uses, the rest are CLOCK_MONOTONIC nanoseconds.
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "common.h"
+
+#define TRACE_SHM_NAME "/RPI_ADC_TRACE"
+#define TRACE_VERSION 1
+#define NUM_TRACE_RECS NUM_DATA_CHUNKS /* Power of 2 */
+#define TRACE_MASK (NUM_TRACE_RECS - 1)
+
+struct adc_trace_rec {
+	atomic_uint blk;	/* block number + 1, 0 while the record is written */
+	uint32_t dma_end_us;	/* 0 if DMA end time was not known */
+	uint32_t detect_us;
+	uint32_t overruns;	/* producer overrun count when block was detected */
+	uint64_t detect_ns;
+	uint64_t copy_ns;
+	uint64_t publish_ns;
+	_Atomic uint64_t consume_ns;	/* 0 until a consumer has read the block */
+};
+
+struct adc_trace {
+	uint32_t version;
+	uint32_t size;
+	atomic_uint next_blk;	/* block number after the latest record */
+	struct adc_trace_rec rec[NUM_TRACE_RECS];
+};
+
+#define TRACE_SHM_SIZE sizeof(struct adc_trace)
+
+static inline uint64_t trace_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct adc_trace *trace_init(void *buff, size_t bufsize);
+bool trace_is_ok(const struct adc_trace *t);
+void trace_record(struct adc_trace *t, unsigned int blk, const struct adc_trace_rec *rec);
+void trace_consumed(struct adc_trace *t, unsigned int first_blk, unsigned int num);
+int trace_get(struct adc_trace *t, unsigned int blk, struct adc_trace_rec *rec);
+
+#endif
@@ -0,0 +1,296 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adc_simd.h"
+#include "adc_trigger.h"
+#include "common.h"
+
+#define TRIG_DEF_LEVEL	1024	/* Mid-scale of the 11-bit ADC code */
+#define TRIG_DEF_HYST	16
+
+/* Longest window we can still find from the ring history */
+#define TRIG_MAX_WINDOW	((uint64_t)(NUM_DATA_CHUNKS - 2) * MAX_SAMPS)
+
+/**
+ * trig_parse() - Parse trigger configuration from a string
+ * @cfg: configuration to fill. Defaults are set for anything not given.
+ * @spec: comma separated list of
+ *	  off | level | edge | slope		trigger mode (default edge)
+ *	  rising | falling | both		edge (default rising)
+ *	  chan=N		channel (word offset in a frame, that is
+ *				dev * channels per ADC + chan)
+ *	  level=N		ADC code, or code delta per sample for slope.
+ *				Use negative level with falling slope.
+ *	  hyst=N		hysteresis in ADC codes
+ *	  holdoff=N		frames to skip after a trigger window
+ *	  pre=N, post=N		frames captured before / after trigger
+ *
+ * The frame stride is not part of the spec. It is set by the caller from
+ * the stream layout.
+ *
+ * Return: 0 on success, -EINVAL on invalid spec
+ */
+int trig_parse(struct trig_cfg *cfg, const char *spec)
+{
+	char *tmp, *tok, *save = NULL;
+	int ret = 0;
+
+	if (!cfg || !spec)
+		return -EINVAL;
+
+	*cfg = (struct trig_cfg) {
+		.mode = TRIG_EDGE,
+		.edge = TRIG_RISING,
+		.stride = 1,
+		.level = TRIG_DEF_LEVEL,
+		.hyst = TRIG_DEF_HYST,
+		.pre = MAX_SAMPS / 4,
+		.post = MAX_SAMPS * 3 / 4,
+	};
+
+	tmp = strdup(spec);
+	if (!tmp)
+		return -ENOMEM;
+
+	for (tok = strtok_r(tmp, ",", &save); tok && !ret;
+	     tok = strtok_r(NULL, ",", &save)) {
+		char *val = strchr(tok, '=');
+		char *end;
+		long v;
+
+		if (!val) {
+			if (!strcmp(tok, "off"))
+				cfg->mode = TRIG_OFF;
+			else if (!strcmp(tok, "level"))
+				cfg->mode = TRIG_LEVEL;
+			else if (!strcmp(tok, "edge"))
+				cfg->mode = TRIG_EDGE;
+			else if (!strcmp(tok, "slope"))
+				cfg->mode = TRIG_SLOPE;
+			else if (!strcmp(tok, "rising"))
+				cfg->edge = TRIG_RISING;
+			else if (!strcmp(tok, "falling"))
+				cfg->edge = TRIG_FALLING;
+			else if (!strcmp(tok, "both"))
+				cfg->edge = TRIG_BOTH;
+			else
+				ret = -EINVAL;
+			continue;
+		}
+
+		*val++ = 0;
+		v = strtol(val, &end, 0);
+		if (!*val || *end) {
+			ret = -EINVAL;
+			continue;
+		}
+
+		if (!strcmp(tok, "level") && v > INT16_MIN && v < INT16_MAX)
+			cfg->level = v;
+		else if (v < 0)
+			ret = -EINVAL;
+		else if (!strcmp(tok, "chan"))
+			cfg->offset = v;
+		else if (!strcmp(tok, "hyst") && v < INT16_MAX / 2)
+			cfg->hyst = v;
+		else if (!strcmp(tok, "holdoff"))
+			cfg->holdoff = v;
+		else if (!strcmp(tok, "pre") && v < TRIG_MAX_WINDOW)
+			cfg->pre = v;
+		else if (!strcmp(tok, "post") && v < TRIG_MAX_WINDOW)
+			cfg->post = v;
+		else
+			ret = -EINVAL;
+	}
+	free(tmp);
+
+	return ret;
+}
+
+/**
+ * trig_init() - Validate configuration and reset trigger state
+ * @t: trigger state
+ * @cfg: configuration
+ *
+ * The first block given to trig_scan() / trig_feed() after init is taken
+ * to be the first block of the stream (block 0 of a freshly initialised
+ * ring).
+ *
+ * Return: 0 on success, -EINVAL on invalid configuration
+ */
+int trig_init(struct trig_state *t, const struct trig_cfg *cfg)
+{
+	int lo, hi;
+
+	if (!t || !cfg)
+		return -EINVAL;
+
+	if (!cfg->stride || MAX_SAMPS % cfg->stride || cfg->offset >= cfg->stride)
+		return -EINVAL;
+
+	if (cfg->mode > TRIG_SLOPE || !(cfg->edge & TRIG_BOTH))
+		return -EINVAL;
+
+	if ((uint64_t)(cfg->pre + cfg->post) * cfg->stride > TRIG_MAX_WINDOW)
+		return -EINVAL;
+
+	lo = cfg->level - (int)cfg->hyst - 1;
+	hi = cfg->level + (int)cfg->hyst + 1;
+	if (lo <= INT16_MIN || hi >= INT16_MAX)
+		return -EINVAL;
+
+	memset(t, 0, sizeof(*t));
+	t->cfg = *cfg;
+
+	return 0;
+}
+
+/**
+ * trig_scan() - Search the next block of the stream for trigger points
+ * @t: trigger state
+ * @blk: next block
+ * @hits: frame indexes (from the start of the stream) of trigger points
+ * @max_hits: size of @hits
+ *
+ * The block is converted to ADC codes (or to sample-to-sample deltas for
+ * slope trigger) and then searched with simd_find_outside(). A scan has
+ * two phases: first find a sample beyond the hysteresis band to arm the
+ * trigger, then find the sample crossing the level. Level trigger is
+ * always armed. After a trigger point the search continues after the
+ * post-trigger frames and holdoff.
+ *
+ * Return: number of trigger points stored to @hits
+ */
+int trig_scan(struct trig_state *t, const struct adc_data *blk, uint64_t *hits, int max_hits)
+{
+	const struct trig_cfg *c = &t->cfg;
+	int16_t v[MAX_SAMPS + 1];
+	const int n = MAX_SAMPS / c->stride;
+	const int16_t level = c->level;
+	const int16_t lo = c->level - (int)c->hyst - 1;
+	const int16_t hi = c->level + (int)c->hyst + 1;
+	const uint64_t base = t->frame;
+	int16_t *x = &v[1];
+	int i, nhits = 0;
+
+	t->frame += n;
+	if (c->mode == TRIG_OFF)
+		return 0;
+
+	adc_raw_to_i16(&v[1], &blk->samples[c->offset], n, c->stride);
+
+	if (c->mode == TRIG_SLOPE) {
+		v[0] = t->have_last ? t->last : v[1];
+		t->last = v[n];
+		for (i = 0; i < n; i++)
+			v[i] = v[i + 1] - v[i];
+		x = &v[0];
+	}
+	t->have_last = true;
+
+	i = (t->next > base) ? (t->next - base < n ? t->next - base : n) : 0;
+
+	while (i < n) {
+		int16_t flo = INT16_MIN, fhi = INT16_MAX;
+		uint64_t hit;
+		int k;
+
+		if (c->mode != TRIG_LEVEL && !t->armed) {
+			if (c->edge & TRIG_RISING)
+				flo = lo;
+			if (c->edge & TRIG_FALLING)
+				fhi = hi;
+
+			k = simd_find_outside(&x[i], n - i, flo, fhi);
+			if (k < 0)
+				break;
+
+			i += k;
+			t->armed = ((c->edge & TRIG_RISING) && x[i] <= lo) ?
+				   TRIG_RISING : TRIG_FALLING;
+			i++;
+			continue;
+		}
+
+		if (c->mode == TRIG_LEVEL) {
+			if (c->edge & TRIG_RISING)
+				fhi = level;
+			if (c->edge & TRIG_FALLING)
+				flo = level;
+		} else if (t->armed == TRIG_RISING) {
+			fhi = level;
+		} else {
+			flo = level;
+		}
+
+		k = simd_find_outside(&x[i], n - i, flo, fhi);
+		if (k < 0)
+			break;
+
+		i += k;
+		hit = base + i;
+		t->armed = 0;
+		t->next = hit + (c->post ? c->post : 1) + c->holdoff;
+
+		if (nhits < max_hits)
+			hits[nhits++] = hit;
+		else
+			t->missed++;
+
+		i = (t->next - base < n) ? t->next - base : n;
+	}
+
+	return nhits;
+}
+
+/**
+ * trig_feed() - Run trigger on the next block and collect complete windows
+ * @t: trigger state
+ * @blk: next block of the stream
+ * @ev: completed trigger windows
+ * @max_ev: size of @ev
+ *
+ * Trigger points are kept pending until all post-trigger samples have been
+ * fed. The window positions in @ev are absolute sample (word) indexes.
+ *
+ * Return: number of completed windows stored to @ev
+ */
+int trig_feed(struct trig_state *t, const struct adc_data *blk, struct adc_trig_event *ev, int max_ev)
+{
+	const struct trig_cfg *c = &t->cfg;
+	uint64_t hits[TRIG_MAX_PENDING];
+	uint64_t written;
+	int i, n, nev = 0;
+
+	n = trig_scan(t, blk, hits, ARRAY_SIZE(hits));
+	for (i = 0; i < n; i++) {
+		struct adc_trig_event *e;
+		uint64_t first;
+
+		if (t->npending == TRIG_MAX_PENDING) {
+			t->missed++;
+			continue;
+		}
+
+		first = (hits[i] > c->pre) ? hits[i] - c->pre : 0;
+		e = &t->pending[t->npending++];
+		e->trig = hits[i] * c->stride + c->offset;
+		e->start = first * c->stride;
+		e->len = (hits[i] - first + c->post) * c->stride;
+		e->usecs = blk->usecs;
+	}
+
+	written = t->frame * c->stride;
+	while (nev < max_ev && t->npending &&
+	       t->pending[0].start + t->pending[0].len <= written) {
+		ev[nev++] = t->pending[0];
+		memmove(&t->pending[0], &t->pending[1],
+			--t->npending * sizeof(t->pending[0]));
+	}
+
+	return nev;
+}
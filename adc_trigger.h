@@ -0,0 +1,59 @@
+#ifndef MVA_ADC_TRIGGER_H
+#define MVA_ADC_TRIGGER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mvaring.h"
+
+#define TRIG_MAX_PENDING 16
+
+enum trig_mode {
+	TRIG_OFF,
+	TRIG_LEVEL,	/* fire while the sample is beyond the level */
+	TRIG_EDGE,	/* fire when the sample crosses the level */
+	TRIG_SLOPE,	/* fire when sample-to-sample change crosses the level */
+};
+
+enum trig_edge {
+	TRIG_RISING = 1,
+	TRIG_FALLING = 2,
+	TRIG_BOTH = TRIG_RISING | TRIG_FALLING,
+};
+
+/*
+ * Trigger configuration. The stream is a sequence of frames, each frame
+ * holding 'stride' interleaved sample words. The trigger watches the word
+ * at 'offset' in each frame. Holdoff, pre and post are counted in frames.
+ * Level and hysteresis are ADC codes (or codes per sample for TRIG_SLOPE).
+ */
+struct trig_cfg {
+	enum trig_mode mode;
+	enum trig_edge edge;
+	unsigned int offset;
+	unsigned int stride;
+	int level;
+	unsigned int hyst;
+	unsigned int holdoff;
+	unsigned int pre;
+	unsigned int post;
+};
+
+struct trig_state {
+	struct trig_cfg cfg;
+	int armed;		/* TRIG_RISING / TRIG_FALLING or 0 */
+	int16_t last;		/* last sample of the previous block */
+	bool have_last;
+	uint64_t next;		/* first frame allowed to trigger (holdoff) */
+	uint64_t frame;		/* frame index of the next block */
+	unsigned int missed;	/* triggers dropped as pending queue was full */
+	unsigned int npending;
+	struct adc_trig_event pending[TRIG_MAX_PENDING];
+};
+
+int trig_parse(struct trig_cfg *cfg, const char *spec);
+int trig_init(struct trig_state *t, const struct trig_cfg *cfg);
+int trig_scan(struct trig_state *t, const struct adc_data *blk, uint64_t *hits, int max_hits);
+int trig_feed(struct trig_state *t, const struct adc_data *blk, struct adc_trig_event *ev, int max_ev);
+
+#endif
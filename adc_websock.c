@@ -0,0 +1,234 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "adc_websock.h"
+
+/* Appended to the client's key before hashing, RFC 6455 section 1.3 */
+#define WS_GUID		"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_KEY_MAX	64
+
+#define ROL32(x, n)	((uint32_t)(x) << (n) | (uint32_t)(x) >> (32 - (n)))
+
+/* Process one 64 byte block of SHA-1 */
+static void sha1_block(uint32_t *h, const uint8_t *p)
+{
+	uint32_t w[80], a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f, k, t;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = (uint32_t)p[4 * i] << 24 | p[4 * i + 1] << 16 | p[4 * i + 2] << 8 | p[4 * i + 3];
+	for (; i < 80; i++)
+		w[i] = ROL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+	for (i = 0; i < 80; i++) {
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+		t = ROL32(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = ROL32(b, 30);
+		b = a;
+		a = t;
+	}
+	h[0] += a;
+	h[1] += b;
+	h[2] += c;
+	h[3] += d;
+	h[4] += e;
+}
+
+/* SHA-1 of a short message, as the handshake only needs */
+static void sha1(const void *data, size_t len, uint8_t *out)
+{
+	uint32_t h[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+	const uint8_t *p = data;
+	uint8_t blk[64];
+	size_t n = len;
+	int i;
+
+	for (; n >= 64; n -= 64, p += 64)
+		sha1_block(h, p);
+	memset(blk, 0, sizeof(blk));
+	memcpy(blk, p, n);
+	blk[n] = 0x80;
+	if (n >= 56) {
+		sha1_block(h, blk);
+		memset(blk, 0, sizeof(blk));
+	}
+	for (i = 0; i < 8; i++)
+		blk[63 - i] = (uint64_t)len * 8 >> (8 * i);
+	sha1_block(h, blk);
+
+	for (i = 0; i < 20; i++)
+		out[i] = h[i / 4] >> (24 - 8 * (i % 4));
+}
+
+static void base64(const uint8_t *in, size_t len, char *out)
+{
+	static const char tab[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	uint32_t v;
+	size_t i;
+
+	for (i = 0; i < len; i += 3) {
+		v = in[i] << 16 | (i + 1 < len ? in[i + 1] << 8 : 0) | (i + 2 < len ? in[i + 2] : 0);
+		*out++ = tab[v >> 18];
+		*out++ = tab[v >> 12 & 63];
+		*out++ = i + 1 < len ? tab[v >> 6 & 63] : '=';
+		*out++ = i + 2 < len ? tab[v & 63] : '=';
+	}
+	*out = 0;
+}
+
+/**
+ * ws_header() - Find a header of an HTTP request
+ * @req: request, NUL terminated
+ * @name: header name, any case, without the colon
+ * @val: value, with surrounding white space removed
+ * @size: size of val, longer values are cut short
+ *
+ * Return: length of val, or -ENOENT if the header isn't there
+ */
+int ws_header(const char *req, const char *name, char *val, size_t size)
+{
+	size_t nlen = strlen(name), n;
+	const char *s, *e;
+
+	for (s = strchr(req, '\n'); s; s = strchr(s, '\n')) {
+		s++;
+		if (strncasecmp(s, name, nlen) || s[nlen] != ':')
+			continue;
+		for (s += nlen + 1; *s == ' ' || *s == '\t'; s++)
+			;
+		for (e = s + strcspn(s, "\r\n"); e > s && (e[-1] == ' ' || e[-1] == '\t'); e--)
+			;
+		n = e - s < size - 1 ? e - s : size - 1;
+		memcpy(val, s, n);
+		val[n] = 0;
+		return n;
+	}
+
+	return -ENOENT;
+}
+
+/**
+ * ws_upgrade_response() - Accept a request to switch to a WebSocket
+ * @req: HTTP request, NUL terminated
+ * @rsp: the 101 response to send
+ * @size: size of rsp
+ *
+ * Return: length of the response, -ENOENT if req isn't a WebSocket
+ * upgrade, or -ENOSPC if rsp is too small
+ */
+int ws_upgrade_response(const char *req, char *rsp, size_t size)
+{
+	char key[WS_KEY_MAX + sizeof(WS_GUID)], val[16], accept[WS_ACCEPT_LEN + 1];
+	uint8_t hash[20];
+	int n;
+
+	if (ws_header(req, "Upgrade", val, sizeof(val)) < 0 || strcasecmp(val, "websocket"))
+		return -ENOENT;
+	n = ws_header(req, "Sec-WebSocket-Key", key, WS_KEY_MAX + 1);
+	if (n <= 0)
+		return -ENOENT;
+
+	strcpy(&key[n], WS_GUID);
+	sha1(key, n + strlen(WS_GUID), hash);
+	base64(hash, sizeof(hash), accept);
+	n = snprintf(rsp, size, "HTTP/1.1 101 Switching Protocols\r\n"
+		     "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+		     "Sec-WebSocket-Accept: %s\r\n\r\n", accept);
+
+	return n < size ? n : -ENOSPC;
+}
+
+/**
+ * ws_frame_header() - Header of an unfragmented, unmasked frame
+ * @hdr: header, up to WS_HDR_MAX bytes
+ * @opcode: WS_OP_BINARY, WS_OP_TEXT or a control frame
+ * @len: payload length
+ *
+ * Return: header length
+ */
+size_t ws_frame_header(uint8_t *hdr, int opcode, uint64_t len)
+{
+	int i;
+
+	hdr[0] = 0x80 | opcode;
+	if (len < 126) {
+		hdr[1] = len;
+		return 2;
+	}
+	if (len < 65536) {
+		hdr[1] = 126;
+		hdr[2] = len >> 8;
+		hdr[3] = len;
+		return 4;
+	}
+	hdr[1] = 127;
+	for (i = 0; i < 8; i++)
+		hdr[2 + i] = len >> (56 - 8 * i);
+
+	return 10;
+}
+
+/**
+ * ws_frame_decode() - Decode a frame from a client
+ * @buf: data received, the payload is unmasked in place
+ * @len: bytes in buf
+ * @f: frame decoded
+ *
+ * Return: bytes used by the frame, -EAGAIN if it isn't all there yet,
+ * -EPROTO if it isn't masked, or -EMSGSIZE if longer than WS_MSG_MAX
+ */
+ssize_t ws_frame_decode(uint8_t *buf, size_t len, struct ws_frame *f)
+{
+	size_t hlen = 2, plen, i;
+	const uint8_t *mask;
+	int k;
+
+	if (len < 2)
+		return -EAGAIN;
+	if (!(buf[1] & 0x80))
+		return -EPROTO;
+
+	plen = buf[1] & 0x7f;
+	if (plen == 126) {
+		if (len < 4)
+			return -EAGAIN;
+		plen = buf[2] << 8 | buf[3];
+		hlen = 4;
+	} else if (plen == 127) {
+		if (len < 10)
+			return -EAGAIN;
+		for (k = 0, plen = 0; k < 8; k++)
+			plen = plen << 8 | buf[2 + k];
+		hlen = 10;
+	}
+	if (plen > WS_MSG_MAX)
+		return -EMSGSIZE;
+	if (len < hlen + 4 + plen)
+		return -EAGAIN;
+
+	mask = &buf[hlen];
+	f->fin = buf[0] & 0x80;
+	f->opcode = buf[0] & 0x0f;
+	f->data = &buf[hlen + 4];
+	f->len = plen;
+	for (i = 0; i < plen; i++)
+		f->data[i] ^= mask[i & 3];
+
+	return hlen + 4 + plen;
+}
@@ -0,0 +1,43 @@
+#ifndef MVA_ADC_WEBSOCK_H
+#define MVA_ADC_WEBSOCK_H
+
+/*
+ * Minimal WebSocket (RFC 6455) support for streaming to browsers.
+ *
+ * Only what a server needs: the HTTP upgrade handshake, headers for the
+ * unmasked frames it sends, and decoding of the masked frames a client
+ * sends. Frames are never fragmented by the server, and client messages
+ * are short commands, so fragmented client messages are not reassembled.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define WS_HDR_MAX	10	/* server frame header, 64-bit length */
+#define WS_MSG_MAX	1024	/* largest client message accepted */
+#define WS_ACCEPT_LEN	28	/* base64 of a SHA-1 hash */
+
+enum ws_opcode {
+	WS_OP_CONT = 0,
+	WS_OP_TEXT = 1,
+	WS_OP_BINARY = 2,
+	WS_OP_CLOSE = 8,
+	WS_OP_PING = 9,
+	WS_OP_PONG = 10,
+};
+
+struct ws_frame {
+	int opcode;
+	bool fin;
+	uint8_t *data;		/* payload, unmasked in place */
+	size_t len;
+};
+
+int ws_header(const char *req, const char *name, char *val, size_t size);
+int ws_upgrade_response(const char *req, char *rsp, size_t size);
+size_t ws_frame_header(uint8_t *hdr, int opcode, uint64_t len);
+ssize_t ws_frame_decode(uint8_t *buf, size_t len, struct ws_frame *f);
+
+#endif
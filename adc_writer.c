@@ -0,0 +1,601 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define AWR_HAVE_URING
+#endif
+#endif
+
+#include "adc_writer.h"
+#include "common.h"
+
+#define AWR_TAG_SYNC	(-1)
+#define AWR_QUEUE_MASK	(2 * AWR_MAX_BUFS - 1)
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int pwrite_all(int fd, const uint8_t *p, size_t len, uint64_t off)
+{
+	ssize_t n;
+
+	while (len) {
+		n = pwrite(fd, p, len, off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -errno;
+		if (!n)
+			return -EIO;
+
+		p += n;
+		off += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Account a finished write or sync. Called with lock held in thread mode. */
+static void awr_complete(struct async_writer *w, int tag, int res)
+{
+	w->inflight--;
+
+	if (tag == AWR_TAG_SYNC) {
+		w->stats.syncs++;
+		if (res < 0 && !w->err)
+			w->err = res;
+		return;
+	}
+
+	if (res >= 0 && (size_t)res != w->len[tag])
+		res = -EIO;	/* short write, out of space */
+	if (res < 0 && !w->err)
+		w->err = res;
+
+	if (res > 0) {
+		uint64_t lat = now_ns() - w->submit_ns[tag];
+
+		w->stats.bytes += res;
+		w->stats.writes++;
+		if (lat > w->stats.max_write_ns)
+			w->stats.max_write_ns = lat;
+	}
+	w->free[w->nfree++] = tag;
+}
+
+#ifdef AWR_HAVE_URING
+static int uring_enter(int fd, unsigned int submit, unsigned int wait, unsigned int flags)
+{
+	int ret = syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+
+	return (ret < 0) ? -errno : ret;
+}
+
+/* IORING_OP_WRITE came with the probe interface, so no probe means no write */
+static bool uring_can_write(int fd)
+{
+	size_t size = sizeof(struct io_uring_probe) +
+		      IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *p = calloc(1, size);
+	bool ok;
+
+	if (!p)
+		return false;
+
+	ok = !syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, p, IORING_OP_LAST) &&
+	     p->last_op >= IORING_OP_WRITE &&
+	     (p->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+	free(p);
+
+	return ok;
+}
+
+static void uring_exit(struct awr_uring *u)
+{
+	if (u->sqes)
+		munmap(u->sqes, u->sqes_size);
+	if (u->cq_ptr && u->cq_ptr != u->sq_ptr)
+		munmap(u->cq_ptr, u->cq_size);
+	if (u->sq_ptr)
+		munmap(u->sq_ptr, u->sq_size);
+	close(u->fd);
+	memset(u, 0, sizeof(*u));
+}
+
+static int uring_init(struct awr_uring *u, unsigned int entries)
+{
+	struct io_uring_params p;
+	uint8_t *sq, *cq;
+
+	memset(u, 0, sizeof(*u));
+	memset(&p, 0, sizeof(p));
+
+	u->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (u->fd < 0)
+		return -errno;
+
+	if (!uring_can_write(u->fd)) {
+		close(u->fd);
+		return -ENOSYS;
+	}
+
+	u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_size > u->sq_size)
+			u->sq_size = u->cq_size;
+		u->cq_size = u->sq_size;
+	}
+
+	u->sq_ptr = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ptr == MAP_FAILED) {
+		u->sq_ptr = NULL;
+		goto err;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		u->cq_ptr = u->sq_ptr;
+	} else {
+		u->cq_ptr = mmap(NULL, u->cq_size, PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if (u->cq_ptr == MAP_FAILED) {
+			u->cq_ptr = NULL;
+			goto err;
+		}
+	}
+
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) {
+		u->sqes = NULL;
+		goto err;
+	}
+
+	sq = u->sq_ptr;
+	cq = u->cq_ptr;
+	u->sq_head = (unsigned int *)(sq + p.sq_off.head);
+	u->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	u->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	u->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	u->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	u->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	u->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return 0;
+
+err:
+	uring_exit(u);
+	return -ENOMEM;
+}
+
+/*
+ * Queue a write of buffer @tag, or a sync. Sync is drained, so it starts
+ * after all writes before it have completed.
+ */
+static int uring_start(struct async_writer *w, int tag)
+{
+	struct awr_uring *u = &w->ring;
+	unsigned int tail = *u->sq_tail;
+	unsigned int idx = tail & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[idx];
+	int ret;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->fd = w->fd;
+	sqe->user_data = (uint64_t)(int64_t)tag;
+	if (tag == AWR_TAG_SYNC) {
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+		sqe->flags = IOSQE_IO_DRAIN;
+	} else {
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->addr = (uint64_t)(uintptr_t)w->bufs[tag];
+		sqe->len = w->len[tag];
+		sqe->off = w->boff[tag];
+	}
+	u->sq_array[idx] = idx;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	do {
+		ret = uring_enter(u->fd, 1, 0, 0);
+	} while (ret == -EINTR);
+
+	return (ret < 0) ? ret : 0;
+}
+
+/* Handle completed requests, wait for one if @wait and none are ready */
+static int uring_reap(struct async_writer *w, bool wait)
+{
+	struct awr_uring *u = &w->ring;
+	unsigned int head = *u->cq_head;
+	int ret, n = 0;
+
+	if (wait && head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+		ret = uring_enter(u->fd, 0, 1, IORING_ENTER_GETEVENTS);
+		if (ret < 0 && ret != -EINTR)
+			return ret;
+	}
+
+	while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+
+		awr_complete(w, (int)(int64_t)cqe->user_data, cqe->res);
+		head++;
+		n++;
+	}
+	__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+	return n;
+}
+#else
+static int uring_init(struct awr_uring *u, unsigned int entries)
+{
+	return -ENOSYS;
+}
+
+static void uring_exit(struct awr_uring *u)
+{
+}
+
+static int uring_start(struct async_writer *w, int tag)
+{
+	return -ENOSYS;
+}
+
+static int uring_reap(struct async_writer *w, bool wait)
+{
+	return -ENOSYS;
+}
+#endif
+
+static void *awr_thread(void *arg)
+{
+	struct async_writer *w = arg;
+	int tag, res;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (w->qhead == w->qtail && !w->stop)
+			pthread_cond_wait(&w->cond, &w->lock);
+		if (w->qhead == w->qtail)
+			break;
+
+		tag = w->queue[w->qhead++ & AWR_QUEUE_MASK];
+		pthread_mutex_unlock(&w->lock);
+
+		if (tag == AWR_TAG_SYNC)
+			res = fdatasync(w->fd) ? -errno : 0;
+		else
+			res = pwrite_all(w->fd, w->bufs[tag], w->len[tag], w->boff[tag]) ?:
+			      (int)w->len[tag];
+
+		pthread_mutex_lock(&w->lock);
+		awr_complete(w, tag, res);
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+static int awr_start(struct async_writer *w, int tag)
+{
+	int ret;
+
+	if (w->mode == AWR_URING) {
+		w->inflight++;
+		ret = uring_start(w, tag);
+		if (ret)
+			w->inflight--;
+		return ret;
+	}
+
+	pthread_mutex_lock(&w->lock);
+	w->inflight++;
+	w->queue[w->qtail++ & AWR_QUEUE_MASK] = tag;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+
+	return 0;
+}
+
+/**
+ * awr_open() - Create a file and start the writer
+ * @w: writer
+ * @path: file to create, truncated if it exists
+ * @cfg: buffers, O_DIRECT and sync policy, NULL for AWR_CFG_DEFAULT
+ *
+ * O_DIRECT is dropped if the file system does not support it (tmpfs).
+ * The writer thread is used if io_uring is not available.
+ *
+ * Return: 0 on success, negative errno on failure
+ */
+int awr_open(struct async_writer *w, const char *path, const struct awr_cfg *cfg)
+{
+	static const struct awr_cfg def = AWR_CFG_DEFAULT;
+	int i, ret;
+
+	memset(w, 0, sizeof(*w));
+	w->cfg = cfg ? *cfg : def;
+	if (w->cfg.nbufs < 1 || w->cfg.nbufs > AWR_MAX_BUFS ||
+	    !w->cfg.buf_size || w->cfg.buf_size % AWR_ALIGN ||
+	    (w->cfg.sync == AWR_SYNC_BYTES && !w->cfg.sync_bytes))
+		return -EINVAL;
+
+	w->fd = -1;
+	if (w->cfg.direct) {
+		w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+		w->direct = w->fd >= 0;
+	}
+	if (w->fd < 0)
+		w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (w->fd < 0)
+		return -errno;
+
+	for (i = 0; i < w->cfg.nbufs; i++) {
+		ret = posix_memalign((void **)&w->bufs[i], AWR_ALIGN, w->cfg.buf_size);
+		if (ret) {
+			ret = -ret;
+			goto err;
+		}
+		w->free[w->nfree++] = i;
+	}
+
+	if (!w->cfg.thread && !uring_init(&w->ring, 2 * w->cfg.nbufs)) {
+		w->mode = AWR_URING;
+		return 0;
+	}
+
+	w->mode = AWR_THREAD;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	ret = pthread_create(&w->thread, NULL, awr_thread, w);
+	if (!ret)
+		return 0;
+
+	ret = -ret;
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+err:
+	for (i = 0; i < w->cfg.nbufs; i++)
+		free(w->bufs[i]);
+	close(w->fd);
+
+	return ret;
+}
+
+/**
+ * awr_get_buf() - Get an empty buffer of cfg.buf_size bytes
+ * @w: writer
+ *
+ * Waits for a write to complete if all buffers are in flight. The time
+ * spent waiting is counted in the stall statistics.
+ *
+ * Return: buffer, or NULL after a write error (see w->err)
+ */
+uint8_t *awr_get_buf(struct async_writer *w)
+{
+	uint64_t t0, dt;
+	int idx = -1;
+
+	if (w->mode == AWR_URING) {
+		uring_reap(w, false);
+		if (!w->nfree && !w->err) {
+			t0 = now_ns();
+			w->stats.stalls++;
+			while (!w->nfree && !w->err)
+				if (uring_reap(w, true) < 0 && !w->err)
+					w->err = -EIO;
+			dt = now_ns() - t0;
+			if (dt > w->stats.max_stall_ns)
+				w->stats.max_stall_ns = dt;
+		}
+		if (!w->err)
+			idx = w->free[--w->nfree];
+	} else {
+		pthread_mutex_lock(&w->lock);
+		if (!w->nfree && !w->err) {
+			t0 = now_ns();
+			w->stats.stalls++;
+			while (!w->nfree && !w->err)
+				pthread_cond_wait(&w->cond, &w->lock);
+			dt = now_ns() - t0;
+			if (dt > w->stats.max_stall_ns)
+				w->stats.max_stall_ns = dt;
+		}
+		if (!w->err)
+			idx = w->free[--w->nfree];
+		pthread_mutex_unlock(&w->lock);
+	}
+
+	return (idx < 0) ? NULL : w->bufs[idx];
+}
+
+static void awr_put_buf(struct async_writer *w, int idx)
+{
+	if (w->mode == AWR_THREAD)
+		pthread_mutex_lock(&w->lock);
+	w->free[w->nfree++] = idx;
+	if (w->mode == AWR_THREAD)
+		pthread_mutex_unlock(&w->lock);
+}
+
+static int awr_buf_idx(struct async_writer *w, const uint8_t *buf)
+{
+	int i;
+
+	for (i = 0; i < w->cfg.nbufs; i++)
+		if (w->bufs[i] == buf)
+			return i;
+
+	return -1;
+}
+
+/**
+ * awr_submit() - Append a buffer to the file
+ * @w: writer
+ * @buf: buffer from awr_get_buf()
+ * @len: bytes to write
+ *
+ * With O_DIRECT, only the last write of the file may have a length that
+ * is not a multiple of AWR_ALIGN. It is padded with zeros, and the file is
+ * truncated back by awr_close().
+ *
+ * Return: 0 on success, negative errno of an earlier failed write
+ */
+int awr_submit(struct async_writer *w, uint8_t *buf, size_t len)
+{
+	int idx = awr_buf_idx(w, buf);
+	size_t plen = len;
+	int ret;
+
+	if (idx < 0 || len > w->cfg.buf_size || w->end != w->off)
+		return -EINVAL;
+
+	if (w->err) {
+		awr_put_buf(w, idx);
+		return w->err;
+	}
+
+	if (w->direct && len % AWR_ALIGN) {
+		plen = (len + AWR_ALIGN - 1) & ~(size_t)(AWR_ALIGN - 1);
+		memset(buf + len, 0, plen - len);
+	}
+
+	w->len[idx] = plen;
+	w->boff[idx] = w->off;
+	w->submit_ns[idx] = now_ns();
+	w->off += plen;
+	w->end += len;
+
+	ret = awr_start(w, idx);
+	if (ret)
+		return ret;
+
+	w->unsynced += len;
+	if (w->cfg.sync == AWR_SYNC_BYTES && w->unsynced >= w->cfg.sync_bytes) {
+		w->unsynced = 0;
+		ret = awr_start(w, AWR_TAG_SYNC);
+	}
+
+	return ret;
+}
+
+/**
+ * awr_flush() - Wait until all submitted writes have completed
+ * @w: writer
+ *
+ * Return: 0 on success, negative errno of the first failed write
+ */
+int awr_flush(struct async_writer *w)
+{
+	if (w->mode == AWR_URING) {
+		while (w->inflight)
+			if (uring_reap(w, true) < 0)
+				return -EIO;
+		return w->err;
+	}
+
+	pthread_mutex_lock(&w->lock);
+	while (w->inflight)
+		pthread_cond_wait(&w->cond, &w->lock);
+	pthread_mutex_unlock(&w->lock);
+
+	return w->err;
+}
+
+/**
+ * awr_rewrite() - Overwrite data already written, synchronously
+ * @w: writer
+ * @data: new contents
+ * @len: bytes, at most cfg.buf_size and a multiple of AWR_ALIGN
+ * @off: file offset, a multiple of AWR_ALIGN
+ *
+ * Used to finish a file header. Waits for the writes in flight first.
+ *
+ * Return: 0 on success, negative errno on failure
+ */
+int awr_rewrite(struct async_writer *w, const void *data, size_t len, uint64_t off)
+{
+	uint8_t *buf;
+	int ret;
+
+	if (len > w->cfg.buf_size || len % AWR_ALIGN || off % AWR_ALIGN)
+		return -EINVAL;
+
+	ret = awr_flush(w);
+	if (ret)
+		return ret;
+
+	buf = awr_get_buf(w);
+	if (!buf)
+		return w->err;
+
+	memcpy(buf, data, len);
+	ret = pwrite_all(w->fd, buf, len, off);
+	awr_put_buf(w, awr_buf_idx(w, buf));
+
+	return ret;
+}
+
+/**
+ * awr_close() - Finish writes, sync as configured and close the file
+ * @w: writer
+ *
+ * Return: 0 on success, negative errno of the first failure
+ */
+int awr_close(struct async_writer *w)
+{
+	int i, ret;
+
+	ret = awr_flush(w);
+
+	if (w->mode == AWR_URING) {
+		uring_exit(&w->ring);
+	} else {
+		pthread_mutex_lock(&w->lock);
+		w->stop = true;
+		pthread_cond_broadcast(&w->cond);
+		pthread_mutex_unlock(&w->lock);
+		pthread_join(w->thread, NULL);
+		pthread_cond_destroy(&w->cond);
+		pthread_mutex_destroy(&w->lock);
+	}
+
+	if (!ret && w->end != w->off && ftruncate(w->fd, w->end))
+		ret = -errno;
+
+	if (!ret && w->cfg.sync != AWR_SYNC_NONE) {
+		if (fdatasync(w->fd))
+			ret = -errno;
+		else
+			w->stats.syncs++;
+	}
+
+	if (close(w->fd) && !ret)
+		ret = -errno;
+
+	for (i = 0; i < w->cfg.nbufs; i++)
+		free(w->bufs[i]);
+
+	return ret;
+}
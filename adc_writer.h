@@ -0,0 +1,109 @@
+#ifndef MVA_ADC_WRITER_H
+#define MVA_ADC_WRITER_H
+
+/*
+ * Asynchronous file writer.
+ *
+ * The caller fills buffers from awr_get_buf() and hands them back with
+ * awr_submit(), which appends them to the file and returns at once. Up to
+ * nbufs buffers are in flight, so a storage stall only blocks the caller
+ * when all of them are still being written.
+ *
+ * Writes go through io_uring when the kernel has it (5.6 or later), and
+ * through a writer thread doing pwrite() otherwise. Buffers are aligned
+ * for O_DIRECT.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define AWR_ALIGN	4096	/* O_DIRECT alignment of buffers, sizes, offsets */
+#define AWR_MAX_BUFS	64
+
+enum awr_sync {
+	AWR_SYNC_NONE,		/* leave it all to the page cache */
+	AWR_SYNC_CLOSE,		/* fdatasync() when the file is closed */
+	AWR_SYNC_BYTES,		/* and after every sync_bytes written */
+};
+
+enum awr_mode {
+	AWR_URING,
+	AWR_THREAD,
+};
+
+struct awr_cfg {
+	int nbufs;		/* buffers, at most AWR_MAX_BUFS */
+	size_t buf_size;	/* multiple of AWR_ALIGN */
+	bool direct;		/* O_DIRECT, if the file system takes it */
+	bool thread;		/* use the writer thread even with io_uring */
+	enum awr_sync sync;
+	uint64_t sync_bytes;
+};
+
+#define AWR_CFG_DEFAULT {				\
+	.nbufs = 4,					\
+	.buf_size = 1024 * 1024,			\
+	.direct = true,					\
+	.sync = AWR_SYNC_CLOSE,				\
+}
+
+struct awr_stats {
+	uint64_t bytes;		/* bytes written */
+	unsigned int writes;
+	unsigned int syncs;
+	unsigned int stalls;	/* awr_get_buf() had to wait for a write */
+	uint64_t max_stall_ns;
+	uint64_t max_write_ns;	/* longest submit to completion time */
+};
+
+struct awr_uring {
+	int fd;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_size, cq_size, sqes_size;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+};
+
+struct async_writer {
+	int fd;
+	enum awr_mode mode;
+	struct awr_cfg cfg;
+	bool direct;		/* file was opened with O_DIRECT */
+	uint64_t off;		/* file offset of the next buffer */
+	uint64_t end;		/* file size without O_DIRECT padding */
+	uint64_t unsynced;	/* bytes since the last sync */
+	int err;		/* first write error, stops further writes */
+	int inflight;		/* writes and syncs submitted, not completed */
+
+	uint8_t *bufs[AWR_MAX_BUFS];
+	uint64_t submit_ns[AWR_MAX_BUFS];
+	size_t len[AWR_MAX_BUFS];
+	uint64_t boff[AWR_MAX_BUFS];
+	int free[AWR_MAX_BUFS];	/* stack of free buffer indexes */
+	int nfree;
+
+	struct awr_uring ring;
+
+	/* Writer thread: FIFO of buffer indexes, or -1 for sync */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int queue[2 * AWR_MAX_BUFS];
+	unsigned int qhead, qtail;
+	bool stop;
+
+	struct awr_stats stats;
+};
+
+int awr_open(struct async_writer *w, const char *path, const struct awr_cfg *cfg);
+uint8_t *awr_get_buf(struct async_writer *w);
+int awr_submit(struct async_writer *w, uint8_t *buf, size_t len);
+int awr_flush(struct async_writer *w);
+int awr_rewrite(struct async_writer *w, const void *data, size_t len, uint64_t off);
+int awr_close(struct async_writer *w);
+
+#endif
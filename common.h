@@ -15,6 +15,9 @@
 #error "NUM_DATA_CHUNKS must be power of two"
 #endif
 
+#define NUM_TRIG_EVENTS 64 /* Power of 2 */
+#define TRIG_EV_MASK (NUM_TRIG_EVENTS - 1)
+
 #ifdef BE_LAZY
 
 /* SPINAWHILE: CPU pause/yield instruction during busy-wait loops
@@ -1,6 +1,8 @@
 // mvaring_ring.c
 #define _GNU_SOURCE
 #include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
 #include <sched.h>
 #include <stdatomic.h>
 #include <stdbool.h>
@@ -8,6 +10,9 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "mvaring.h"
 
@@ -30,8 +35,9 @@ struct mvaring * ring_init(void *buff, size_t bufsize)
 	/* atomic indexes init */
 	atomic_init(&r->rindex, 0);
 	atomic_init(&r->windex, 0);
+	atomic_init(&r->trig_seq, 0);
+	atomic_init(&r->dropped, 0);
 	r->writing = 0;
-	r->dropped = 0;
 
 	return r;
 }
@@ -107,6 +113,31 @@ bool ring_empty(struct mvaring *r)
 	return (ring_available(r) == 0);
 }
 
+/*
+ * The ring lives in shared memory, so these are the process-shared (non
+ * private) futex operations.
+ */
+static int ring_futex_wait(atomic_uint *addr, unsigned int val, int timeout_ms)
+{
+	struct timespec ts, *tsp = NULL;
+
+	if (timeout_ms >= 0) {
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+		tsp = &ts;
+	}
+
+	if (syscall(SYS_futex, addr, FUTEX_WAIT, val, tsp, NULL, 0) == -1)
+		return -errno;
+
+	return 0;
+}
+
+static void ring_futex_wake(atomic_uint *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
 int ring_add(struct mvaring *r, const struct adc_data *data, bool dropfull)
 {
 	/* Memory ordering notes:
@@ -161,11 +192,12 @@ int ring_add(struct mvaring *r, const struct adc_data *data, bool dropfull)
 	atomic_fetch_add_explicit(&r->writing, 1, memory_order_release);  /* Start write: make counter ODD */
 
 	if (next_w == rd + NUM_DATA_CHUNKS) {
-		/* buffer full -> drop oldest */
-		r->dropped++;
+		/* buffer full -> drop newest, or oldest */
 		ret = -ENOSPC;
-		if (dropfull)
+		if (dropfull) {
+			atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
 			goto end;
+		}
 		atomic_store_explicit(&r->rindex, rd + 1, memory_order_release);
 		rd = rd + 1;
 	}
@@ -178,6 +210,14 @@ int ring_add(struct mvaring *r, const struct adc_data *data, bool dropfull)
 end:
 	atomic_fetch_add_explicit(&r->writing, 1, memory_order_release);  /* End write: make counter EVEN (allows reader to detect intervening writes) */
 
+	/*
+	 * Pairs with the fence in ring_wait(): either the reader sees the new
+	 * windex, or we see it sleeping. Only a sleeping reader costs a syscall.
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&r->rsleep, memory_order_relaxed))
+		ring_futex_wake(&r->windex);
+
 	return ret;
 }
 
@@ -283,3 +323,182 @@ retry:
 	return (int)num_chunks;
 }
 
+/**
+ * ring_add_dropped() - Count blocks the producer lost before ring_add()
+ * @r: Pointer to ring buffer
+ * @num: number of blocks
+ *
+ * Readers can't see these as a gap in the ring, so they read r->dropped.
+ */
+void ring_add_dropped(struct mvaring *r, unsigned int num)
+{
+	atomic_fetch_add_explicit(&r->dropped, num, memory_order_relaxed);
+}
+
+/**
+ * ring_wait() - Sleep until the ring has data (single reader)
+ * @r: Pointer to ring buffer
+ * @timeout_ms: max time to sleep, negative to wait forever
+ *
+ * Lets the ring_read() reader sleep in the kernel instead of polling an
+ * empty ring. The writer wakes it from ring_add().
+ *
+ * Return: 0 when data is available, -ETIMEDOUT or -EINTR otherwise
+ */
+int ring_wait(struct mvaring *r, int timeout_ms)
+{
+	unsigned int w;
+	int ret = 0;
+
+	if (!r)
+		return -EINVAL;
+
+	atomic_store_explicit(&r->rsleep, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	w = atomic_load_explicit(&r->windex, memory_order_acquire);
+	while (w == atomic_load_explicit(&r->rindex, memory_order_relaxed)) {
+		ret = ring_futex_wait(&r->windex, w, timeout_ms);
+		if (ret && ret != -EAGAIN)
+			break;
+		ret = 0;
+		w = atomic_load_explicit(&r->windex, memory_order_acquire);
+	}
+
+	atomic_store_explicit(&r->rsleep, 0, memory_order_relaxed);
+
+	return ret;
+}
+
+/**
+ * ring_copy_samples() - Copy samples from the ring history
+ * @r: Pointer to ring buffer
+ * @start: absolute sample index of the first sample to copy
+ * @out: destination for @num samples
+ * @num: number of samples to copy
+ *
+ * Copies raw samples by their absolute position in the stream without
+ * consuming anything, so it may be used by any number of (read-only)
+ * consumers alongside the ring_read() reader. Blocks stay in the history
+ * until the writer wraps around, so data older than NUM_DATA_CHUNKS blocks
+ * is gone.
+ *
+ * Return: 0 on success, -EAGAIN if the samples have not been written yet,
+ * -ENODATA if they were already overwritten, -EINVAL on invalid parameters
+ */
+int ring_copy_samples(struct mvaring *r, uint64_t start, uint32_t *out, unsigned int num)
+{
+	uint64_t pos, end = start + num;
+	unsigned int first, last, w;
+
+	if (!r || !out)
+		return -EINVAL;
+
+	if (!num)
+		return 0;
+
+	first = (unsigned int)(start / MAX_SAMPS);
+	last = (unsigned int)((end - 1) / MAX_SAMPS);
+	if (last - first >= NUM_DATA_CHUNKS - 1)
+		return -EINVAL;
+
+	w = atomic_load_explicit(&r->windex, memory_order_acquire);
+	if ((int)(last - w) >= 0)
+		return -EAGAIN;
+
+	/*
+	 * The writer fills the slot of block 'first' again while windex
+	 * equals first + NUM_DATA_CHUNKS.
+	 */
+	if (w - first > NUM_DATA_CHUNKS - 1)
+		return -ENODATA;
+
+	for (pos = start; pos < end;) {
+		unsigned int blk = (unsigned int)(pos / MAX_SAMPS);
+		unsigned int off = pos % MAX_SAMPS;
+		unsigned int n = MAX_SAMPS - off;
+
+		if (n > end - pos)
+			n = end - pos;
+
+		memcpy(out, &r->buf[blk & BUFF_MASK].samples[off], n * sizeof(*out));
+		out += n;
+		pos += n;
+	}
+
+	/* Order the data reads before re-checking the writer position */
+	atomic_thread_fence(memory_order_acquire);
+	w = atomic_load_explicit(&r->windex, memory_order_relaxed);
+	if (w - first > NUM_DATA_CHUNKS - 1)
+		return -ENODATA;
+
+	return 0;
+}
+
+/**
+ * ring_trig_publish() - Publish a trigger event (single writer)
+ * @r: Pointer to ring buffer
+ * @ev: event to publish
+ *
+ * Stores the event into the event ring and wakes up consumers sleeping in
+ * ring_trig_wait(). Old events are overwritten when consumers fall behind.
+ */
+void ring_trig_publish(struct mvaring *r, const struct adc_trig_event *ev)
+{
+	unsigned int seq = atomic_load_explicit(&r->trig_seq, memory_order_relaxed);
+
+	r->trig_ev[seq & TRIG_EV_MASK] = *ev;
+	atomic_store_explicit(&r->trig_seq, seq + 1, memory_order_release);
+	ring_futex_wake(&r->trig_seq);
+}
+
+/**
+ * ring_trig_wait() - Wait for the next trigger event
+ * @r: Pointer to ring buffer
+ * @seq: sequence number of the event to get. Start with the current
+ *	 r->trig_seq to only get new events. Advanced on success.
+ * @ev: destination for the event
+ * @timeout_ms: max time to sleep, negative to wait forever
+ *
+ * Any number of consumers may wait for events. Each keeps its own @seq.
+ *
+ * Return: 0 on success, -ETIMEDOUT or -EINTR when no event arrived,
+ * -EOVERFLOW if the consumer fell more than NUM_TRIG_EVENTS events behind.
+ * In that case @seq is moved to the oldest event still available.
+ */
+int ring_trig_wait(struct mvaring *r, unsigned int *seq, struct adc_trig_event *ev, int timeout_ms)
+{
+	unsigned int s;
+	int ret;
+
+	if (!r || !seq || !ev)
+		return -EINVAL;
+
+	s = atomic_load_explicit(&r->trig_seq, memory_order_acquire);
+	while (s == *seq) {
+		ret = ring_futex_wait(&r->trig_seq, s, timeout_ms);
+		if (ret && ret != -EAGAIN)
+			return ret;
+		s = atomic_load_explicit(&r->trig_seq, memory_order_acquire);
+	}
+
+	if (s - *seq > NUM_TRIG_EVENTS - 1)
+		goto overflow;
+
+	*ev = r->trig_ev[*seq & TRIG_EV_MASK];
+
+	/* The writer stores the event 'seq + NUM_TRIG_EVENTS' into our slot */
+	atomic_thread_fence(memory_order_acquire);
+	s = atomic_load_explicit(&r->trig_seq, memory_order_relaxed);
+	if (s - *seq > NUM_TRIG_EVENTS - 1)
+		goto overflow;
+
+	(*seq)++;
+
+	return 0;
+
+overflow:
+	*seq = s - (NUM_TRIG_EVENTS - 1);
+
+	return -EOVERFLOW;
+}
@@ -10,23 +10,37 @@ extern "C" {
 #include <stddef.h>
 #include <stdint.h>
 
+#include "adc_data.h"
 #include "common.h"
 
-#define MVARING_VERSION 2
+#define MVARING_VERSION 7
 #define MAX_RETRY_ATTEMPTS 1000
 
-struct adc_data {
-	uint32_t usecs;
-	uint32_t samples[MAX_SAMPS];
+/*
+ * Trigger window published by the producer. Sample positions are absolute
+ * sample (word) indexes counted from the start of the stream, so block
+ * (index / MAX_SAMPS) of the ring holds them. Use ring_copy_samples() to
+ * fetch the window from the ring history.
+ */
+struct adc_trig_event {
+	uint64_t trig;	/* sample index of the trigger point */
+	uint64_t start;	/* sample index of the first pre-trigger sample */
+	uint32_t len;	/* window length in samples */
+	uint32_t usecs;	/* timestamp of the block holding the trigger point */
 };
 
 struct mvaring {
 	uint8_t version;  /* ring buffer version */
 	_Atomic uint8_t writing;  /* seqlock for write protection (NOTE: sub-optimal for frequent writes, may need optimization) */
-	uint16_t dropped; /* counter for overwritten entries (too slow reader) */
+	uint16_t reserved;
 	uint32_t size;    /* Size of the ring (should equal sizeof(struct mvaring)) */
+	struct adc_stream_info info;
 	atomic_uint rindex;
 	atomic_uint windex;
+	atomic_uint trig_seq; /* number of published trigger events */
+	atomic_uint rsleep;   /* reader sleeps in ring_wait(), writer wakes it */
+	atomic_uint dropped;  /* blocks the producer discarded: ring full, or lost before ring_add() */
+	struct adc_trig_event trig_ev[NUM_TRIG_EVENTS];
 	struct adc_data buf[NUM_DATA_CHUNKS];
 };
 
@@ -43,10 +57,17 @@ unsigned int ring_space(struct mvaring *r);
  *
  * The @dropfull controls whether the data is dropped when ring is full, or if
  * the old data is overwritten. Setting dropfull to true will cause new data
- * to be dropped, setting it false makes old to be overwritten.
+ * to be dropped, setting it false makes old to be overwritten. Dropped
+ * blocks are counted in r->dropped; readers see overwritten ones as a jump
+ * in rindex.
  */
 int ring_add(struct mvaring *r, const struct adc_data *data, bool dropfull);
 int ring_read(struct mvaring *r, struct adc_data *buf, unsigned int num_chunks);
+int ring_wait(struct mvaring *r, int timeout_ms);
+void ring_add_dropped(struct mvaring *r, unsigned int num);
+int ring_copy_samples(struct mvaring *r, uint64_t start, uint32_t *out, unsigned int num);
+void ring_trig_publish(struct mvaring *r, const struct adc_trig_event *ev);
+int ring_trig_wait(struct mvaring *r, unsigned int *seq, struct adc_trig_event *ev, int timeout_ms);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,486 @@
+// Convert a binary capture or capture set from rpi_adc_bufextract to text
+// Each line is the sample time in nanoseconds and the sample value, formatted
+// by a pool of threads (-J) and written in order
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "adc_capset.h"
+#include "common.h"
+
+#define CONV_BLOCKS 64
+/* Longest line: 20 digit time, tab, 5 digit sample, newline */
+#define LINE_MAX_LEN 27
+#define MAX_THREADS 64
+
+enum slot_state {
+	SLOT_FREE,
+	SLOT_READ,		/* blocks read, waiting for a worker */
+	SLOT_BUSY,		/* being formatted */
+	SLOT_DONE,		/* text ready for the writer */
+};
+
+/* Blocks converted together, and their text */
+struct conv_slot {
+	struct cap_block blocks[CONV_BLOCKS];	/* copies, for a capture set */
+	const struct cap_block *bp[CONV_BLOCKS];	/* into the mapping or blocks */
+	uint64_t times[CONV_BLOCKS];
+	uint64_t word_ps[CONV_BLOCKS];	/* sample spacing of each block's segment */
+	unsigned int n;
+	uint64_t seq;
+	enum slot_state state;
+	char *text;
+	size_t len;
+};
+
+/* Capture file, or a time range of a capture set */
+struct conv_src {
+	struct capmap *m;
+	struct capmap_iter it;
+	struct capset_reader *r;
+	uint64_t end;		/* end time in the set */
+};
+
+/*
+ * A reader thread reads blocks into a pool of slots, worker threads turn
+ * them to text, and the caller writes the text out in slot order.
+ */
+struct conv_pipe {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct conv_slot *slots;
+	unsigned int nslots;
+	uint64_t nread;		/* slots read so far */
+	uint64_t next_fmt;	/* next slot to format */
+	bool eof;
+	int err;
+	struct conv_src *src;
+};
+
+static const char g_digits[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/* Decimal text of v at p, returns the end, like printf("%llu") */
+static char *fmt_u64(char *p, uint64_t v)
+{
+	char tmp[20], *t = tmp + sizeof(tmp);
+	size_t n;
+
+	while (v >= 100) {
+		unsigned int d = (v % 100) * 2;
+
+		v /= 100;
+		*--t = g_digits[d + 1];
+		*--t = g_digits[d];
+	}
+	if (v >= 10) {
+		*--t = g_digits[v * 2 + 1];
+		*--t = g_digits[v * 2];
+	} else {
+		*--t = '0' + v;
+	}
+
+	n = tmp + sizeof(tmp) - t;
+	memcpy(p, t, n);
+
+	return p + n;
+}
+
+/* Same text as fprintf(out, "%llu\t%u\n") for each sample */
+static char *format_block(char *p, const struct cap_block *b, uint64_t time, uint64_t word_ps)
+{
+	int i;
+
+	for (i = 0; i < MAX_SAMPS; i++) {
+		p = fmt_u64(p, time + i * word_ps / 1000);
+		*p++ = '\t';
+		p = fmt_u64(p, b->samples[i]);
+		*p++ = '\n';
+	}
+
+	return p;
+}
+
+/* Read the next blocks of the source into a slot, 0 at the end */
+static int src_fill(struct conv_src *src, struct conv_slot *sl)
+{
+	struct cap_span sp;
+	int ret;
+
+	sl->n = 0;
+	while (sl->n < CONV_BLOCKS) {
+		if (src->r)
+			ret = capset_read_block(src->r, &sl->blocks[sl->n], &sl->times[sl->n]);
+		else
+			ret = capmap_iter_next(&src->it, &sp, &sl->times[sl->n]);
+		if (ret == -ENODATA || (!ret && src->r && sl->times[sl->n] >= src->end))
+			break;
+		if (ret)
+			return ret;
+
+		if (src->r) {
+			sl->bp[sl->n] = &sl->blocks[sl->n];
+			sl->word_ps[sl->n] = src->r->hdr.word_ps;
+		} else {
+			sl->bp[sl->n] = capmap_block(src->m, src->it.blk - 1);
+			sl->word_ps[sl->n] = src->m->hdr.word_ps;
+		}
+		sl->n++;
+	}
+
+	return sl->n;
+}
+
+static void *reader_thread(void *arg)
+{
+	struct conv_pipe *cp = arg;
+	struct conv_slot *sl;
+	uint64_t seq;
+	int ret;
+
+	for (seq = 0;; seq++) {
+		sl = &cp->slots[seq % cp->nslots];
+
+		pthread_mutex_lock(&cp->lock);
+		while (sl->state != SLOT_FREE && !cp->err)
+			pthread_cond_wait(&cp->cond, &cp->lock);
+		pthread_mutex_unlock(&cp->lock);
+
+		ret = cp->err ? 0 : src_fill(cp->src, sl);
+
+		pthread_mutex_lock(&cp->lock);
+		if (ret <= 0) {
+			if (ret < 0 && !cp->err)
+				cp->err = ret;
+			cp->eof = true;
+			pthread_cond_broadcast(&cp->cond);
+			pthread_mutex_unlock(&cp->lock);
+			break;
+		}
+		sl->seq = seq;
+		sl->state = SLOT_READ;
+		cp->nread = seq + 1;
+		pthread_cond_broadcast(&cp->cond);
+		pthread_mutex_unlock(&cp->lock);
+	}
+
+	return NULL;
+}
+
+static void *format_thread(void *arg)
+{
+	struct conv_pipe *cp = arg;
+	struct conv_slot *sl;
+	unsigned int i;
+	char *p;
+
+	for (;;) {
+		pthread_mutex_lock(&cp->lock);
+		while (cp->next_fmt == cp->nread && !cp->eof)
+			pthread_cond_wait(&cp->cond, &cp->lock);
+		if (cp->next_fmt == cp->nread) {
+			pthread_mutex_unlock(&cp->lock);
+			break;
+		}
+		sl = &cp->slots[cp->next_fmt++ % cp->nslots];
+		sl->state = SLOT_BUSY;
+		pthread_mutex_unlock(&cp->lock);
+
+		p = sl->text;
+		for (i = 0; i < sl->n; i++)
+			p = format_block(p, sl->bp[i], sl->times[i], sl->word_ps[i]);
+		sl->len = p - sl->text;
+
+		pthread_mutex_lock(&cp->lock);
+		sl->state = SLOT_DONE;
+		pthread_cond_broadcast(&cp->cond);
+		pthread_mutex_unlock(&cp->lock);
+	}
+
+	return NULL;
+}
+
+/* Convert the source with nthreads formatting threads, writing in order */
+static int convert_pipe(struct conv_src *src, FILE *out, unsigned int nthreads)
+{
+	struct conv_pipe cp = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.src = src,
+	};
+	pthread_t reader, workers[MAX_THREADS];
+	struct conv_slot *sl;
+	unsigned int i, nw = 0;
+	uint64_t seq;
+	int ret = 0;
+
+	/* Enough slots to keep every worker busy while the writer waits */
+	cp.nslots = 2 * nthreads + 2;
+	cp.slots = calloc(cp.nslots, sizeof(*cp.slots));
+	if (!cp.slots)
+		return -ENOMEM;
+	for (i = 0; i < cp.nslots; i++) {
+		cp.slots[i].text = malloc(CONV_BLOCKS * MAX_SAMPS * LINE_MAX_LEN);
+		if (!cp.slots[i].text) {
+			ret = -ENOMEM;
+			goto out_free;
+		}
+	}
+
+	if (pthread_create(&reader, NULL, reader_thread, &cp)) {
+		ret = -EAGAIN;
+		goto out_free;
+	}
+	for (nw = 0; nw < nthreads; nw++)
+		if (pthread_create(&workers[nw], NULL, format_thread, &cp))
+			break;
+	if (!nw) {
+		/* Nothing would format the slots: stop the reader */
+		pthread_mutex_lock(&cp.lock);
+		cp.err = -EAGAIN;
+		pthread_cond_broadcast(&cp.cond);
+		pthread_mutex_unlock(&cp.lock);
+		pthread_join(reader, NULL);
+		ret = -EAGAIN;
+		goto out_free;
+	}
+
+	for (seq = 0;; seq++) {
+		sl = &cp.slots[seq % cp.nslots];
+
+		pthread_mutex_lock(&cp.lock);
+		while (!(sl->state == SLOT_DONE && sl->seq == seq) &&
+		       !(cp.eof && seq == cp.nread))
+			pthread_cond_wait(&cp.cond, &cp.lock);
+		pthread_mutex_unlock(&cp.lock);
+		if (sl->state != SLOT_DONE || sl->seq != seq)
+			break;
+
+		if (!ret && fwrite(sl->text, 1, sl->len, out) != sl->len)
+			ret = -errno;
+
+		pthread_mutex_lock(&cp.lock);
+		sl->state = SLOT_FREE;
+		/* Stop the reader on a write error, the workers finish what they have */
+		if (ret && !cp.err)
+			cp.err = ret;
+		pthread_cond_broadcast(&cp.cond);
+		pthread_mutex_unlock(&cp.lock);
+	}
+
+	pthread_join(reader, NULL);
+	for (i = 0; i < nw; i++)
+		pthread_join(workers[i], NULL);
+	if (!ret)
+		ret = cp.err;
+
+out_free:
+	for (i = 0; i < cp.nslots; i++)
+		free(cp.slots[i].text);
+	free(cp.slots);
+
+	return ret;
+}
+
+static int convert(const char *path, FILE *out, unsigned int nthreads)
+{
+	struct capmap m;
+	struct conv_src src = { .m = &m };
+	int ret;
+
+	ret = capmap_open(&m, path);
+	if (ret)
+		return ret;
+
+	ret = capmap_iter_init(&src.it, &m, 0, 0, UINT64_MAX);
+	if (!ret)
+		ret = convert_pipe(&src, out, nthreads);
+	/* Unfinished capture: all complete blocks were converted */
+	if (!ret && m.hdr.nblocks > m.nblocks)
+		ret = -ENODATA;
+	capmap_close(&m);
+
+	return ret;
+}
+
+/* Convert blocks of a capture set from start_s for dur_s seconds */
+static int convert_set(const char *dir, FILE *out, double start_s, double dur_s,
+		       unsigned int nthreads)
+{
+	struct capset_reader r;
+	struct conv_src src = { .r = &r, .end = UINT64_MAX };
+	uint64_t first;
+	int ret;
+
+	ret = capset_open_read(&r, dir);
+	if (ret)
+		return ret;
+
+	first = capset_first_ns(&r) + (uint64_t)(start_s * 1e9);
+	if (dur_s > 0)
+		src.end = first + (uint64_t)(dur_s * 1e9);
+
+	ret = capset_seek(&r, first);
+	if (!ret)
+		ret = convert_pipe(&src, out, nthreads);
+	capset_close_read(&r);
+
+	return (ret == -ENODATA) ? 0 : ret;
+}
+
+/* Print npoints min/max/mean points of a channel, from start_s for dur_s */
+static int envelope_set(const char *dir, FILE *out, double start_s, double dur_s,
+			unsigned int word, unsigned int npoints)
+{
+	struct capset_reader r;
+	struct pyr_point *pts;
+	uint64_t t0, t1;
+	unsigned int i;
+	int ret;
+
+	pts = calloc(npoints, sizeof(*pts));
+	if (!pts)
+		return -ENOMEM;
+
+	ret = capset_open_read(&r, dir);
+	if (ret) {
+		free(pts);
+		return ret;
+	}
+
+	t0 = capset_first_ns(&r) + (uint64_t)(start_s * 1e9);
+	if (dur_s > 0) {
+		t1 = t0 + (uint64_t)(dur_s * 1e9);
+	} else {
+		/* Up to the end of the last block */
+		struct cap_block b;
+		struct capset_seg *last = &r.segs[r.nsegs - 1];
+
+		ret = capset_read_at(&r, r.nsegs - 1, last->nblocks - 1, &b, &t1);
+		t1 += MAX_SAMPS * r.hdr.word_ps / 1000;
+	}
+
+	if (!ret)
+		ret = pyr_query(&r, word, t0, t1, pts, npoints);
+	for (i = 0; ret > 0 && i < npoints; i++)
+		if (pts[i].count)
+			fprintf(out, "%llu\t%u\t%u\t%u\n",
+				(unsigned long long)(t0 + (t1 - t0) * i / npoints),
+				pts[i].min, pts[i].max, pts[i].mean);
+	capset_close_read(&r);
+	free(pts);
+
+	return (ret < 0) ? ret : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *in = NULL, *outname = NULL;
+	double start_s = 0, dur_s = 0;
+	int word = 0, npoints = 0, nthreads;
+	FILE *out = stdout;
+	struct stat st;
+	int args = 0, ret;
+
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1)
+		nthreads = 1;
+	else if (nthreads > MAX_THREADS)
+		nthreads = MAX_THREADS;
+
+	while (argc > ++args)
+	{
+		if (argv[args][0] == '-')
+		{
+			switch (toupper(argv[args][1]))
+			{
+			case 'T':		// -T secs: start time in a capture set
+				if (args >= argc-1 || (start_s = atof(argv[++args])) < 0)
+				{
+					printf("Error: no start time\n");
+					exit(1);
+				}
+				break;
+			case 'C':		// -C word: channel (word in frame) for -E
+				if (args >= argc-1 || (word = atoi(argv[++args])) < 0)
+				{
+					printf("Error: no channel\n");
+					exit(1);
+				}
+				break;
+			case 'E':		// -E points: min/max/mean envelope of a capture set
+				if (args >= argc-1 || (npoints = atoi(argv[++args])) <= 0)
+				{
+					printf("Error: no number of envelope points\n");
+					exit(1);
+				}
+				break;
+			case 'J':		// -J num: formatting threads, default one per CPU
+				if (args >= argc-1 || (nthreads = atoi(argv[++args])) < 1 ||
+				    nthreads > MAX_THREADS)
+				{
+					printf("Error: 1 to %d threads\n", MAX_THREADS);
+					exit(1);
+				}
+				break;
+			case 'D':		// -D secs: duration to convert from a capture set
+				if (args >= argc-1 || (dur_s = atof(argv[++args])) <= 0)
+				{
+					printf("Error: no duration\n");
+					exit(1);
+				}
+				break;
+			default:
+				printf("Error: unrecognised option '%s'\n", argv[args]);
+				exit(1);
+			}
+		}
+		else if (!in)
+			in = argv[args];
+		else if (!outname)
+			outname = argv[args];
+	}
+
+	if (!in || stat(in, &st))
+	{
+		printf("Usage: %s [-T start_secs] [-D secs] [-J threads] [-E points [-C chan]] capture|capture_dir [text_out]\n",
+		       argv[0]);
+		return 1;
+	}
+
+	if (outname && !(out = fopen(outname, "w")))
+	{
+		perror(outname);
+		return 1;
+	}
+
+	if (S_ISDIR(st.st_mode) && npoints)
+	{
+		ret = envelope_set(in, out, start_s, dur_s, word, npoints);
+	}
+	else if (S_ISDIR(st.st_mode))
+	{
+		ret = convert_set(in, out, start_s, dur_s, nthreads);
+	}
+	else
+	{
+		ret = convert(in, out, nthreads);
+	}
+
+	if (ret)
+		fprintf(stderr, "%s: %s\n", in, ret == -EINVAL ?
+			"not a capture" : strerror(-ret));
+
+	if (fclose(out) && !ret)
+		ret = -errno;
+
+	return ret ? 1 : 0;
+}
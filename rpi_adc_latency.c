@@ -0,0 +1,243 @@
+// Print block latency percentiles from the producer latency trace (-L)
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "adc_trace.h"
+#include "common.h"
+#include "rpi_shmem.h"
+
+/* Overruns this many blocks after a spike are counted as caused by it */
+#define SPIKE_WINDOW	4
+#define NUM_WORST	10
+
+enum {
+	STAGE_DMA,	/* DMA end -> CPU detect */
+	STAGE_COPY,	/* detect -> copy done */
+	STAGE_PUBLISH,	/* copy done -> ring_add() done */
+	STAGE_CONSUME,	/* ring_add() -> consumer ring_read() */
+	STAGE_TOTAL,	/* DMA end (or detect) -> consumer (or publish) */
+	NUM_STAGES,
+};
+
+static const char *g_stage_names[NUM_STAGES] = {
+	"dma->detect", "detect->copy", "copy->publish", "publish->consume", "total",
+};
+
+struct blk_lat {
+	unsigned int blk;
+	uint32_t overruns;
+	int64_t ns[NUM_STAGES];	/* -1 if not known */
+};
+
+static struct blk_lat g_lat[NUM_TRACE_RECS];
+static int64_t g_sorted[NUM_TRACE_RECS];
+
+static int cmp_i64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int cmp_total(const void *a, const void *b)
+{
+	const struct blk_lat *x = a, *y = b;
+
+	return cmp_i64(&y->ns[STAGE_TOTAL], &x->ns[STAGE_TOTAL]);
+}
+
+static int collect(struct adc_trace *t)
+{
+	unsigned int next = atomic_load_explicit(&t->next_blk, memory_order_acquire);
+	unsigned int blk = next > NUM_TRACE_RECS ? next - NUM_TRACE_RECS : 0;
+	int n = 0;
+
+	for (; blk != next; blk++) {
+		struct adc_trace_rec r;
+		struct blk_lat *l = &g_lat[n];
+		uint64_t last;
+
+		if (trace_get(t, blk, &r))
+			continue;
+
+		l->blk = blk;
+		l->overruns = r.overruns;
+		l->ns[STAGE_DMA] = r.dma_end_us ?
+			(int64_t)(int32_t)(r.detect_us - r.dma_end_us) * 1000 : -1;
+		l->ns[STAGE_COPY] = r.copy_ns - r.detect_ns;
+		l->ns[STAGE_PUBLISH] = r.publish_ns - r.copy_ns;
+		l->ns[STAGE_CONSUME] = r.consume_ns ? (int64_t)(r.consume_ns - r.publish_ns) : -1;
+		last = r.consume_ns ? r.consume_ns : r.publish_ns;
+		l->ns[STAGE_TOTAL] = (last - r.detect_ns) +
+			(l->ns[STAGE_DMA] > 0 ? l->ns[STAGE_DMA] : 0);
+		n++;
+	}
+
+	return n;
+}
+
+/* Sort known values of a stage, return their count */
+static int sort_stage(int num, int stage)
+{
+	int i, n = 0;
+
+	for (i = 0; i < num; i++)
+		if (g_lat[i].ns[stage] >= 0)
+			g_sorted[n++] = g_lat[i].ns[stage];
+	qsort(g_sorted, n, sizeof(g_sorted[0]), cmp_i64);
+
+	return n;
+}
+
+static double pct_usec(int n, double pct)
+{
+	int i = (int)(n * pct / 100.0);
+
+	return g_sorted[i < n ? i : n - 1] / 1000.0;
+}
+
+static void print_percentiles(int num)
+{
+	int s, n;
+
+	printf("%-17s %5s %9s %9s %9s %9s %9s  [usec]\n", "stage", "n",
+	       "p50", "p90", "p99", "p99.9", "max");
+	for (s = 0; s < NUM_STAGES; s++) {
+		n = sort_stage(num, s);
+		if (!n) {
+			printf("%-17s %5d\n", g_stage_names[s], 0);
+			continue;
+		}
+		printf("%-17s %5d %9.1f %9.1f %9.1f %9.1f %9.1f\n", g_stage_names[s],
+		       n, pct_usec(n, 50), pct_usec(n, 90), pct_usec(n, 99),
+		       pct_usec(n, 99.9), g_sorted[n - 1] / 1000.0);
+	}
+}
+
+/* Count overruns, and those following a latency spike within SPIKE_WINDOW */
+static void print_overruns(int num, int64_t spike_ns)
+{
+	unsigned int overruns = 0, after_spike = 0;
+	int i, j;
+
+	for (i = 1; i < num; i++) {
+		uint32_t d = g_lat[i].overruns - g_lat[i - 1].overruns;
+
+		if (!d)
+			continue;
+
+		overruns += d;
+		for (j = i; j >= 0 && g_lat[i].blk - g_lat[j].blk <= SPIKE_WINDOW; j--) {
+			if (g_lat[j].ns[STAGE_TOTAL] > spike_ns) {
+				after_spike += d;
+				break;
+			}
+		}
+	}
+	printf("Overruns %u in traced blocks (%u total), %u within %d blocks of a spike > %.1f usec\n",
+	       overruns, num ? g_lat[num - 1].overruns : 0, after_spike,
+	       SPIKE_WINDOW, spike_ns / 1000.0);
+}
+
+static void print_worst(int num)
+{
+	int i, s;
+
+	qsort(g_lat, num, sizeof(g_lat[0]), cmp_total);
+	printf("%10s", "block");
+	for (s = 0; s < NUM_STAGES; s++)
+		printf(" %16s", g_stage_names[s]);
+	printf(" %8s\n", "overruns");
+	for (i = 0; i < num && i < NUM_WORST; i++) {
+		printf("%10u", g_lat[i].blk);
+		for (s = 0; s < NUM_STAGES; s++)
+			printf(" %16.1f", g_lat[i].ns[s] / 1000.0);
+		printf(" %8u\n", g_lat[i].overruns);
+	}
+}
+
+static void report(struct adc_trace *t, double spike_usec)
+{
+	int64_t spike_ns;
+	int num;
+
+	num = collect(t);
+	if (!num) {
+		printf("No trace records\n");
+		return;
+	}
+	printf("%d blocks %u..%u\n", num, g_lat[0].blk, g_lat[num - 1].blk);
+	print_percentiles(num);
+
+	if (spike_usec > 0) {
+		spike_ns = spike_usec * 1000;
+	} else {
+		sort_stage(num, STAGE_TOTAL);
+		spike_ns = pct_usec(num, 99) * 1000;
+	}
+	print_overruns(num, spike_ns);
+	print_worst(num);
+}
+
+int main(int argc, char *argv[])
+{
+	struct shmem_info ti;
+	struct adc_trace *t;
+	double spike_usec = 0;
+	int args = 0, interval = 0;
+
+	while (argc > ++args)
+	{
+		if (argv[args][0] == '-')
+		{
+			switch (toupper(argv[args][1]))
+			{
+			case 'S':		// -S usec: spike threshold, default p99 of total
+				if (args >= argc-1 || (spike_usec = atof(argv[++args])) <= 0)
+				{
+					printf("Error: no spike threshold\n");
+					exit(1);
+				}
+				break;
+			case 'W':		// -W secs: repeat report every secs
+				if (args >= argc-1 || (interval = atoi(argv[++args])) <= 0)
+				{
+					printf("Error: no watch interval\n");
+					exit(1);
+				}
+				break;
+			default:
+				printf("Error: unrecognised option '%s'\n", argv[args]);
+				exit(1);
+			}
+		}
+	}
+
+	if (shmem_open_ro(TRACE_SHM_NAME, TRACE_SHM_SIZE, &ti)) {
+		printf("No latency trace, start rpi_adc_stream with -L\n");
+		return -ENOENT;
+	}
+
+	t = ti.buff;
+	if (!trace_is_ok(t)) {
+		printf("Bad trace buffer\n");
+		shmem_close(&ti);
+		return -EINVAL;
+	}
+
+	do {
+		report(t, spike_usec);
+		if (interval) {
+			sleep(interval);
+			printf("\n");
+		}
+	} while (interval);
+
+	shmem_close(&ti);
+
+	return 0;
+}
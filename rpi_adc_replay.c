@@ -0,0 +1,277 @@
+// Replay a capture or capture set from rpi_adc_bufextract into the shm ring
+// Runs on any Linux box, in place of rpi_adc_stream, to test and load consumers
+#include <ctype.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "adc_capmap.h"
+#include "adc_capset.h"
+#include "adc_common.h"
+#include "common.h"
+#include "mvaring.h"
+#include "rpi_shmem.h"
+
+#define REPORT_SECS 1
+
+/* Capture file or capture set being replayed */
+struct replay_src {
+	bool set;
+	struct capset_reader r;
+	struct capmap map;
+	struct capmap_iter it;
+	struct cap_header hdr;
+};
+
+static struct shmem_info g_shm_info;
+static volatile sig_atomic_t g_stop;
+
+static void on_signal(int sig)
+{
+	g_stop = 1;
+}
+
+static int src_open(struct replay_src *s, const char *path)
+{
+	struct stat st;
+	int ret;
+
+	memset(s, 0, sizeof(*s));
+	if (stat(path, &st))
+		return -errno;
+
+	if (S_ISDIR(st.st_mode)) {
+		s->set = true;
+		ret = capset_open_read(&s->r, path);
+		if (!ret)
+			s->hdr = s->r.hdr;
+		return ret;
+	}
+
+	ret = capmap_open(&s->map, path);
+	if (ret)
+		return ret;
+	s->hdr = s->map.hdr;
+
+	return capmap_iter_init(&s->it, &s->map, 0, 0, UINT64_MAX);
+}
+
+/* Back to the first block, for another loop */
+static int src_rewind(struct replay_src *s)
+{
+	if (s->set)
+		return capset_seek(&s->r, capset_first_ns(&s->r));
+
+	return capmap_iter_init(&s->it, &s->map, 0, 0, UINT64_MAX);
+}
+
+/*
+ * Next block and its 64-bit time, -ENODATA at the end. Blocks of a capture
+ * file are used in place, @buf is only filled from a capture set.
+ */
+static int src_read(struct replay_src *s, struct cap_block *buf, const struct cap_block **b,
+		    uint64_t *time_ns)
+{
+	struct cap_span sp;
+	int ret;
+
+	if (s->set) {
+		*b = buf;
+		return capset_read_block(&s->r, buf, time_ns);
+	}
+
+	ret = capmap_iter_next(&s->it, &sp, time_ns);
+	if (!ret)
+		*b = capmap_block(&s->map, s->it.blk - 1);
+
+	return ret;
+}
+
+static void src_close(struct replay_src *s)
+{
+	if (s->set)
+		capset_close_read(&s->r);
+	else
+		capmap_close(&s->map);
+}
+
+/* Captures hold the byte swapped SPI word, the ring has it as the DMA stored it */
+static void block_to_ring(const struct cap_block *b, struct adc_data *a, uint32_t usecs)
+{
+	int i;
+
+	a->usecs = usecs;
+	for (i = 0; i < MAX_SAMPS; i++)
+		a->samples[i] = (uint16_t)(b->samples[i] >> 8 | b->samples[i] << 8);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / 1000000000ULL,
+		.tv_nsec = ns % 1000000000ULL,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !g_stop)
+		;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sigaction sa = { .sa_handler = on_signal };
+	uint64_t t, t0 = 0, start_ns, report_ns, loop_ns = 0, span_ns = 0;
+	uint64_t blocks = 0, last_blocks = 0, overflows = 0;
+	unsigned int loops = 1, loop;
+	double speed = 1;
+	bool wait_space = false;
+	static struct cap_block buf;
+	const struct cap_block *b;
+	static struct adc_data a;
+	struct replay_src src;
+	const char *in = NULL;
+	struct mvaring *mr;
+	int args = 0, ret;
+
+	while (argc > ++args)
+	{
+		if (argv[args][0] == '-')
+		{
+			switch (toupper(argv[args][1]))
+			{
+			case 'L':		// -L num: play num times, 0 for ever
+				if (args >= argc-1 || atoi(argv[++args]) < 0)
+				{
+					printf("Error: no number of loops\n");
+					exit(1);
+				}
+				loops = atoi(argv[args]);
+				break;
+			case 'S':		// -S factor: speed, 1 is real time, 0 as fast as possible
+				if (args >= argc-1 || (speed = atof(argv[++args])) < 0)
+				{
+					printf("Error: no speed factor\n");
+					exit(1);
+				}
+				break;
+			case 'W':		// -W: wait for the consumer instead of dropping blocks
+				wait_space = true;
+				break;
+			default:
+				printf("Error: unrecognised option '%s'\n", argv[args]);
+				exit(1);
+			}
+		}
+		else if (!in)
+			in = argv[args];
+	}
+
+	if (!in)
+	{
+		printf("Usage: %s [-S speed] [-L loops] [-W] capture|capture_dir\n", argv[0]);
+		return 1;
+	}
+
+	ret = src_open(&src, in);
+	if (ret)
+	{
+		fprintf(stderr, "%s: %s\n", in, ret == -EINVAL ? "not a capture" : strerror(-ret));
+		return 1;
+	}
+
+	ret = shmem_create(SHM_NAME, SHM_SIZE, &g_shm_info);
+	if (ret)
+	{
+		printf("shmem_create failed. Name %s, size %lu\n", SHM_NAME, (unsigned long)SHM_SIZE);
+		src_close(&src);
+		return 1;
+	}
+	mr = ring_init(g_shm_info.buff, SHM_SIZE);
+	if (!mr)
+	{
+		printf("Ringbuffer init failed\n");
+		shmem_destroy(&g_shm_info);
+		src_close(&src);
+		return 1;
+	}
+	mr->info = src.hdr.info;
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	printf("Replaying %s: %u ADC x %u channels, %u frames/s\n", in,
+	       mr->info.ndevs, mr->info.nchans, mr->info.sample_rate);
+	if (speed > 0)
+		printf("Speed %gx real time\n", speed);
+	else
+		printf("Speed as fast as possible\n");
+
+	start_ns = report_ns = now_ns();
+	for (loop = 0; !g_stop && (!loops || loop < loops); loop++) {
+		if (loop) {
+			ret = src_rewind(&src);
+			if (ret)
+				break;
+			/* Time keeps growing over loops, as a consumer expects */
+			loop_ns += span_ns;
+		}
+
+		while (!g_stop && !(ret = src_read(&src, &buf, &b, &t))) {
+			if (!blocks)
+				t0 = t;
+			if (!loop)
+				span_ns = t - t0 + MAX_SAMPS * src.hdr.word_ps / 1000;
+			t += loop_ns;
+
+			if (speed > 0)
+				sleep_until(start_ns + (uint64_t)((t - t0) / speed));
+
+			block_to_ring(b, &a, (uint32_t)(t / 1000));
+			/* ring_add() keeps a slot free, it drops when one is left */
+			while (wait_space && ring_space(mr) <= 1 && !g_stop)
+				sched_yield();
+			if (ring_add(mr, &a, true))
+				overflows++;
+			blocks++;
+
+			if (now_ns() - report_ns >= REPORT_SECS * 1000000000ULL) {
+				double secs = (now_ns() - report_ns) / 1e9;
+
+				printf("%.2f MSPS, %llu dropped by the ring\n",
+				       (blocks - last_blocks) * MAX_SAMPS / secs / 1e6,
+				       (unsigned long long)overflows);
+				report_ns = now_ns();
+				last_blocks = blocks;
+			}
+		}
+		if (ret != -ENODATA)
+			break;
+		ret = 0;
+	}
+
+	t = now_ns() - start_ns;
+	printf("Replayed %llu blocks in %.3f s, %.2f MSPS, %llu dropped by the ring\n",
+	       (unsigned long long)blocks, t / 1e9,
+	       t ? blocks * MAX_SAMPS * 1e3 / t : 0.0, (unsigned long long)overflows);
+	if (ret)
+		printf("FAIL! %d\n", ret);
+
+	src_close(&src);
+	shmem_destroy(&g_shm_info);
+
+	return ret ? 1 : 0;
+}
@@ -29,8 +29,12 @@
 #include <ctype.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <time.h>
 
+#include "adc_calib.h"
 #include "adc_common.h"
+#include "adc_trace.h"
+#include "adc_trigger.h"
 #include "common.h"
 #include "mvaring.h"
 #include "rpi_dma_utils.h"
@@ -58,6 +62,10 @@
 
 #define MAX_SAMPLE_RATE MEGA(1)
 
+// SPI bit times used by one conversion, including the gap between transfers.
+// ADCs on both chip-selects share the bus, so this limits their total rate.
+#define SPI_BITS_PER_SAMP	20
+
 // SPI clock frequency
 #define MIN_SPI_FREQ	10000
 #define MAX_SPI_FREQ	MEGA(20)
@@ -69,15 +77,17 @@
 // ADC sample size (2 bytes, with 11 data bits)
 #define ADC_RAW_LEN	 2
 
-// ADC and DAC chip-enables
+// ADC and DAC chip-enables. With 2 ADCs the second one uses the DAC CE
 #define ADC_CE_NUM	  0
 #define DAC_CE_NUM	  1
+#define ADC2_CE_NUM	 DAC_CE_NUM
+#define MAX_ADC_DEVS	2
+#define MAX_ADC_CHANS	2
+#define MAX_ADC_SLOTS	(MAX_ADC_DEVS * MAX_ADC_CHANS)
 
 // Definitions for 2 bytes per ADC sample (11-bit)
 #define ADC_REQUEST(c)  {0xc0 | (c)<<5, 0x00}
-#define ADC_VOLTAGE(n)  (((n) * 3.3) / 2048.0)
-#define ADC_MILLIVOLTS(n) ((int)((((n) * 3300) + 1024) / 2048))
-#define ADC_RAW_VAL(d)  (((uint16_t)(d)<<8 | (uint16_t)(d)>>8) & 0x7ff)
+#define ADC_TXD(c)      (0xd0 | (c)<<5)
 
 // Non-cached memory size
 #define SAMP_SIZE	4
@@ -86,7 +96,9 @@
 #define VC_MEM_SIZE	(PAGE_SIZE + (BUFF_LEN * MAX_BUFFS))
 
 // DMA control block macros
-#define NUM_CBS		10
+// 7 Rx/Tx blocks, then 3 PWM trigger blocks per ADC conversion in a frame
+#define ADC_PWM_CB	7
+#define NUM_CBS		(ADC_PWM_CB + 3 * MAX_ADC_SLOTS)
 #define REG(r, a)	REG_BUS_ADDR(r, a)
 #define MEM(m, a)	MEM_BUS_ADDR(m, a)
 #define CBS(n)		MEM_BUS_ADDR(mp, &dp->cbs[(n)])
@@ -152,18 +164,31 @@ MEM_MAP vc_mem, spi_regs, usec_regs;
 
 // Command-line variables
 static int g_in_chans = 1;
+static int g_adc_devs = 1;
+static const uint32_t g_adc_ce[MAX_ADC_DEVS] = {ADC_CE_NUM, ADC2_CE_NUM};
 static int g_sample_count = 0;
 static int g_sample_rate = SAMPLE_RATE;
 
 static int g_data_format = FMT_USEC;
 static int g_testmode;
+static int g_recalibrate;
 
 static uint32_t g_samp_total;
 static uint32_t g_overrun_total;
 
+// Trigger engine, enabled by -G option
+static struct trig_cfg g_trig_cfg = { .mode = TRIG_OFF, .edge = TRIG_RISING };
+static struct trig_state g_trig;
+static uint32_t g_trig_total;
+
 
 static struct shmem_info g_shm_info;
 
+// Latency trace, enabled by -L option
+static int g_tracemode;
+static struct shmem_info g_trace_info;
+static struct adc_trace *g_trace;
+
 // Disable SPI
 void spi_disable(void)
 {
@@ -188,10 +213,14 @@ void terminate(int sig)
 	unmap_periph_mem(&gpio_regs);
 	if (g_samp_total)
 		printf("Total samples %u, overruns %u\n", g_samp_total, g_overrun_total);
+	if (g_trig_cfg.mode != TRIG_OFF)
+		printf("Trigger windows %u, missed %u\n", g_trig_total, g_trig.missed);
 
 #ifndef KEEP_SHM_BUF
 	if (g_shm_info.buff)
 		shmem_destroy(&g_shm_info);
+	if (g_trace_info.buff)
+		shmem_destroy(&g_trace_info);
 #endif
 	exit(0);
 }
@@ -227,8 +256,16 @@ void get_uncached_mem(MEM_MAP *mp, int size)
 
 // Definitions for SPI frequency test
 #define SPI_TEST_TI  (DMA_DEST_DREQ | (DMA_SPI_TX_DREQ << 16) | DMA_WAIT_RESP  | DMA_CB_SRCE_INC)
+#define SPI_CAL_TI   (DMA_DEST_DREQ | (DMA_SPI_TX_DREQ << 16) | DMA_WAIT_RESP)
 #define TEST_NSAMPS  10
 
+// Clock calibration: measure for about CAL_MSEC (SPI DLEN limits words,
+// and DMA channels 7 - 9 are DMA Lite, with a 16-bit transfer length)
+#define CAL_MSEC        25
+#define CAL_MAX_SPI_WORDS 16000
+#define CAL_MAX_PWM_CYCLES (65535 / 4)
+#define CAL_TIMER_MSEC  250
+
 typedef struct {
 	DMA_CB cbs[NUM_CBS];
 	uint32_t txd[TEST_NSAMPS], val;
@@ -247,17 +284,17 @@ void dma_wait(int chan)
 		printf("DMA transfer timeout\n");
 }
 
-// Test SPI frequency
-float test_spi_frequency(MEM_MAP *mp)
+// Test SPI frequency over nwords timed transfers, return MHz
+double test_spi_frequency(MEM_MAP *mp, int nwords)
 {
 	TEST_DMA_DATA *dp=mp->virt;
 	TEST_DMA_DATA dma_data = {
 		.txd = {0,0,0,0,0,0,0,0,0,0}, .usecs = {0, 0},
 		.cbs = {
-		// Tx output: 2 initial transfers, then 10 timed transfers
+		// Tx output: 2 initial transfers, then nwords timed transfers
 			{SPI_TEST_TI, MEM(mp, dp->txd), REG(spi_regs, SPI_FIFO),		   2*4, 0, CBS(1), 0}, // 0
 			{SPI_TEST_TI, REG(usec_regs, USEC_TIME), MEM(mp, &dp->usecs[0]),	 4, 0, CBS(2), 0}, // 1
-			{SPI_TEST_TI, MEM(mp, dp->txd), REG(spi_regs, SPI_FIFO), TEST_NSAMPS*4, 0, CBS(3), 0}, // 2
+			{SPI_CAL_TI,  MEM(mp, dp->txd), REG(spi_regs, SPI_FIFO),	  nwords*4, 0, CBS(3), 0}, // 2
 			{SPI_TEST_TI, REG(usec_regs, USEC_TIME), MEM(mp, &dp->usecs[1]),	 4, 0, 0,	  0}, // 3
 		}
 	};
@@ -265,23 +302,23 @@ float test_spi_frequency(MEM_MAP *mp)
 	*REG32(spi_regs, SPI_DC) = SPI_DMA_PRIORITY;			// Set DMA priorities
 	*REG32(spi_regs, SPI_CS) = SPI_FIFO_CLR;				// Clear SPI FIFOs
 	start_dma(mp, DMA_CHAN_A, &dp->cbs[0], 0);			  // Start SPI Tx DMA
-	*REG32(spi_regs, SPI_DLEN) = (TEST_NSAMPS + 2) * 4;	 // Set data length, and SPI flags
+	*REG32(spi_regs, SPI_DLEN) = (nwords + 2) * 4;		  // Set data length, and SPI flags
 	*REG32(spi_regs, SPI_CS) = SPI_TFR_ACT | SPI_DMA_EN | SPI_CPHA | SPI_CPOL;
 	dma_wait(DMA_CHAN_A);								   // Wait until complete
 	*REG32(spi_regs, SPI_CS) = SPI_FIFO_CLR;				// Clear accumulated Rx data
 	return(dp->usecs[1] > dp->usecs[0] ?
-		   32.0 * TEST_NSAMPS / (dp->usecs[1] - dp->usecs[0]) : 0);
+		   32.0 * nwords / (dp->usecs[1] - dp->usecs[0]) : 0);
 }
 
-// Test PWM frequency
-float test_pwm_frequency(MEM_MAP *mp, const uint32_t pwm_range)
+// Test PWM frequency over ncycles timed cycles, return Hz
+double test_pwm_frequency(MEM_MAP *mp, const uint32_t pwm_range, int ncycles)
 {
 	TEST_DMA_DATA *dp=mp->virt;
 	TEST_DMA_DATA dma_data = {
 		.val = pwm_range,
 		.usecs = {0, 0},
 		.cbs = {
-		// Tx output: 2 initial transfers, then timed transfer
+		// Tx output: 2 initial transfers, then ncycles timed transfers
 			{
 				.ti = PWM_TI,
 				.srce_ad = MEM(mp, &dp->val),
@@ -313,7 +350,7 @@ float test_pwm_frequency(MEM_MAP *mp, const uint32_t pwm_range)
 				.ti = PWM_TI,
 				.srce_ad = MEM(mp, &dp->val),
 				.dest_ad = REG(pwm_regs, PWM_FIF1),
-				.tfr_len = 4,
+				.tfr_len = ncycles * 4,
 				.stride = 0,
 				.next_cb = CBS(4),
 				.debug = 0
@@ -337,15 +374,82 @@ float test_pwm_frequency(MEM_MAP *mp, const uint32_t pwm_range)
 	start_pwm();											// Start PWM
 	dma_wait(DMA_CHAN_A);								   // Wait until complete
 	stop_pwm();											 // Stop PWM
-	return(dp->usecs[1] > dp->usecs[0] ? 1e6 / (dp->usecs[1] - dp->usecs[0]) : 0);
+	return(dp->usecs[1] > dp->usecs[0] ? 1e6 * ncycles / (dp->usecs[1] - dp->usecs[0]) : 0);
+}
+
+// Test usec timer drift against CLOCK_MONOTONIC, return parts per billion
+int32_t test_timer_drift(int msec)
+{
+	struct timespec t0, t1;
+	uint32_t u0, u1;
+	int64_t ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	u0 = *REG32(usec_regs, USEC_TIME);
+	usleep(msec * 1000);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	u1 = *REG32(usec_regs, USEC_TIME);
+	ns = (t1.tv_sec - t0.tv_sec) * 1000000000LL + t1.tv_nsec - t0.tv_nsec;
+	return(ns > 0 ? ((int64_t)(u1 - u0) * 1000 - ns) * 1000000000LL / ns : 0);
+}
+
+// Number of SPI words for calibration at given bit rate
+int cal_spi_words(int spi_hz)
+{
+	int n = spi_hz / 32 / (1000 / CAL_MSEC);
+
+	return(n < TEST_NSAMPS ? TEST_NSAMPS : n > CAL_MAX_SPI_WORDS ? CAL_MAX_SPI_WORDS : n);
+}
+
+// Number of PWM cycles for calibration at given conversion rate
+int cal_pwm_cycles(int pwm_hz)
+{
+	int n = pwm_hz * CAL_MSEC / 1000;
+
+	return(n < 1 ? 1 : n > CAL_MAX_PWM_CYCLES ? CAL_MAX_PWM_CYCLES : n);
+}
+
+// Calibrate SPI and PWM clocks and usec timer, or use cached values for
+// this board and clock setup. Publish the results in the ring header.
+void adc_calibrate(MEM_MAP *mp, int spi_hz, const uint32_t pwm_range, struct mvaring *mr)
+{
+	struct adc_calib_key key = {
+		.spi_hz = spi_hz, .pwm_freq = PWM_FREQ, .pwm_range = pwm_range
+	};
+	struct adc_calib cal;
+	int pwm_hz = g_sample_rate * g_adc_devs;
+
+	calib_board_id(key.board, sizeof(key.board));
+	if (g_recalibrate || calib_load(CALIB_CACHE_FILE, &key, &cal))
+	{
+		printf("Calibrating clocks\n");
+		cal.spi_hz = test_spi_frequency(mp, cal_spi_words(spi_hz)) * 1e6;
+		cal.pwm_hz = test_pwm_frequency(mp, pwm_range, cal_pwm_cycles(pwm_hz));
+		cal.timer_ppb = test_timer_drift(CAL_TIMER_MSEC);
+		if (cal.spi_hz <= 0 || cal.pwm_hz <= 0)
+		{
+			printf("Calibration failed, using nominal rate\n");
+			return;
+		}
+		if (calib_store(CALIB_CACHE_FILE, &key, &cal))
+			printf("Can't write calibration cache %s\n", CALIB_CACHE_FILE);
+	}
+	else
+		printf("Using cached calibration from %s\n", CALIB_CACHE_FILE);
+
+	printf("SPI %7.3f MHz, PWM %10.3f Hz, usec timer %+d ppb\n",
+		   cal.spi_hz / 1e6, cal.pwm_hz, cal.timer_ppb);
+	mr->info.spi_hz = cal.spi_hz;
+	mr->info.timer_ppb = cal.timer_ppb;
+	mr->info.calib_rate_mhz = cal.pwm_hz * 1000 / (g_adc_devs * g_in_chans);
 }
 
 typedef struct {
 	DMA_CB cbs[NUM_CBS];
 	uint32_t samp_size;
 	uint32_t pwm_val;
-	uint32_t adc_csd;
-	uint32_t txd[2];
+	uint32_t adc_csd[MAX_ADC_SLOTS];
+	uint32_t txd[MAX_ADC_SLOTS];
 	volatile uint32_t usecs[2];
 	volatile uint32_t states[2];
 	volatile uint32_t rxd1[MAX_SAMPS];
@@ -353,15 +457,16 @@ typedef struct {
 } ADC_DMA_DATA;
 
 // Initialise PWM-paced DMA for ADC sampling
+// Each PWM cycle triggers one conversion. A frame of conversions walks
+// through the channels of the first ADC, then those of the second one, so
+// sample words in a block are: dev0 ch0, [dev0 ch1], [dev1 ch0, dev1 ch1] ...
 void adc_dma_init(MEM_MAP *mp, int nsamp, int single, const uint32_t pwm_range)
 {
 	ADC_DMA_DATA *dp = mp->virt;
+	int i, nslots = g_adc_devs * g_in_chans;
 	ADC_DMA_DATA dma_data = {
 		.samp_size = 2,
 		.pwm_val = pwm_range,
-		.txd={0xd0, g_in_chans>1 ? 0xf0 : 0xd0},
-		.adc_csd = SPI_TFR_ACT | SPI_AUTO_CS | SPI_DMA_EN |
-			   SPI_FIFO_CLR | ADC_CE_NUM | SPI_CPHA | SPI_CPOL,
 		.usecs = {0, 0},
 		.states = {0, 0},
 		.rxd1 = {0},
@@ -422,47 +527,55 @@ void adc_dma_init(MEM_MAP *mp, int nsamp, int single, const uint32_t pwm_range)
 				.next_cb = CBS(0),
 				.debug = 0
 			}, // 5
-		// Tx output: 2 data writes to SPI for chan 0 & 1, or both chan 0
+		// Tx output: one data write to SPI per conversion in a frame
+		// (a single chan 0 request is sent twice, as before)
 			{
 				.ti = SPI_TX_TI,
 				.srce_ad = MEM(mp, dp->txd),
 				.dest_ad = REG(spi_regs, SPI_FIFO),
-				.tfr_len = 8,
+				.tfr_len = (nslots > 1 ? nslots : 2) * 4,
 				.stride = 0,
 				.next_cb = CBS(6),
 				.debug = 0
 			}, // 6
-		// PWM ADC trigger: wait for PWM, set sample length, trigger SPI
-			{
-				.ti = PWM_TI,
-				.srce_ad = MEM(mp, &dp->pwm_val),
-				.dest_ad = REG(pwm_regs, PWM_FIF1),
-				.tfr_len = 4,
-				.stride = 0,
-				.next_cb = CBS(8),
-				.debug = 0
-			}, // 7
-			{
-				.ti = PWM_TI,
-				.srce_ad = MEM(mp, &dp->samp_size),
-				.dest_ad = REG(spi_regs, SPI_DLEN),
-				.tfr_len = 4,
-				.stride = 0,
-				.next_cb = CBS(9),
-				.debug = 0
-			}, // 8
-			{
-				.ti = PWM_TI,
-				.srce_ad = MEM(mp, &dp->adc_csd),
-				.dest_ad = REG(spi_regs, SPI_CS),
-				.tfr_len = 4,
-				.stride = 0,
-				.next_cb = CBS(7),
-				.debug = 0
-			}, // 9
 		}
 	};
 
+	// PWM ADC trigger, per conversion: wait for PWM, set sample length,
+	// trigger SPI with chip-select of the ADC
+	for (i = 0; i < nslots; i++)
+	{
+		int cb = ADC_PWM_CB + i * 3;
+		int next = i < nslots - 1 ? cb + 3 : ADC_PWM_CB;
+
+		dma_data.txd[i] = ADC_TXD(i % g_in_chans);
+		dma_data.adc_csd[i] = SPI_TFR_ACT | SPI_AUTO_CS | SPI_DMA_EN | SPI_FIFO_CLR |
+			g_adc_ce[i / g_in_chans] | SPI_CPHA | SPI_CPOL;
+		dma_data.cbs[cb] = (DMA_CB) {
+			.ti = PWM_TI,
+			.srce_ad = MEM(mp, &dp->pwm_val),
+			.dest_ad = REG(pwm_regs, PWM_FIF1),
+			.tfr_len = 4,
+			.next_cb = CBS(cb + 1),
+		};
+		dma_data.cbs[cb + 1] = (DMA_CB) {
+			.ti = PWM_TI,
+			.srce_ad = MEM(mp, &dp->samp_size),
+			.dest_ad = REG(spi_regs, SPI_DLEN),
+			.tfr_len = 4,
+			.next_cb = CBS(cb + 2),
+		};
+		dma_data.cbs[cb + 2] = (DMA_CB) {
+			.ti = PWM_TI,
+			.srce_ad = MEM(mp, &dp->adc_csd[i]),
+			.dest_ad = REG(spi_regs, SPI_CS),
+			.tfr_len = 4,
+			.next_cb = CBS(next),
+		};
+	}
+	if (nslots == 1)
+		dma_data.txd[1] = dma_data.txd[0];
+
 	if (single)								 // If single-shot, stop after first Rx block
 		dma_data.cbs[2].next_cb = 0;
 	memcpy(dp, &dma_data, sizeof(dma_data));	// Copy DMA data into uncached memory
@@ -472,7 +585,7 @@ void adc_dma_init(MEM_MAP *mp, int nsamp, int single, const uint32_t pwm_range)
 	*REG32(spi_regs, SPI_CS) = SPI_FIFO_CLR;					// Clear SPI FIFOs
 	start_dma(mp, DMA_CHAN_C, &dp->cbs[6], 0);  // Start SPI Tx DMA
 	start_dma(mp, DMA_CHAN_B, &dp->cbs[0], 0);  // Start SPI Rx DMA
-	start_dma(mp, DMA_CHAN_A, &dp->cbs[7], 0);  // Start PWM DMA, for SPI trigger
+	start_dma(mp, DMA_CHAN_A, &dp->cbs[ADC_PWM_CB], 0);  // Start PWM DMA, for SPI trigger
 }
 
 // Start ADC data acquisition
@@ -496,6 +609,30 @@ void adc_stream_stop(void)
 	stop_pwm();
 }
 
+// Run trigger on a new block, publish the completed trigger windows
+void adc_trigger(struct mvaring *mr, const struct adc_data *d)
+{
+	struct adc_trig_event ev[TRIG_MAX_PENDING];
+	int i, n;
+
+	n = trig_feed(&g_trig, d, ev, ARRAY_SIZE(ev));
+	for (i = 0; i < n; i++)
+		ring_trig_publish(mr, &ev[i]);
+	g_trig_total += n;
+}
+
+// Record latency trace of the block just published
+void adc_trace_block(struct mvaring *mr, struct adc_trace_rec *tr, uint32_t usec)
+{
+	tr->publish_ns = trace_now_ns();
+	// The CB chain stamps the end of this block after flagging its state,
+	// so the stamp may still be the one from the previous round
+	if ((int32_t)(tr->dma_end_us - usec) <= 0 ||
+		(int32_t)(tr->detect_us - tr->dma_end_us) < 0)
+		tr->dma_end_us = 0;
+	trace_record(g_trace, atomic_load_explicit(&mr->windex, memory_order_relaxed) - 1, tr);
+}
+
 int adc_stream_csv(MEM_MAP *mp, char *vals, int maxlen, int nsamp, struct mvaring *mr)
 {
 	ADC_DMA_DATA *dp=mp->virt;
@@ -505,14 +642,26 @@ int adc_stream_csv(MEM_MAP *mp, char *vals, int maxlen, int nsamp, struct mvarin
 	{
 		if (dp->states[n])
 		{
+			struct adc_trace_rec tr;
+
+			if (g_trace)
+			{
+				tr.detect_ns = trace_now_ns();
+				tr.detect_us = *REG32(usec_regs, USEC_TIME);
+				tr.dma_end_us = dp->usecs[n^1];
+				tr.overruns = g_overrun_total;
+			}
 			g_samp_total += nsamp;
 			/* Copy data to adc_data struct */
 			memcpy(g_rx_buff, n ? (void *)dp->rxd2 : (void *)dp->rxd1, nsamp*4);
+			if (g_trace)
+				tr.copy_ns = trace_now_ns();
 			usec = dp->usecs[n];
 			if (dp->states[n^1])
 			{
 				dp->states[0] = dp->states[1] = 0;
 				g_overrun_total++;
+				ring_add_dropped(mr, 2);	// Both halves of the DMA buffer
 				break;
 			}
 			dp->states[n] = 0;
@@ -537,6 +686,11 @@ int adc_stream_csv(MEM_MAP *mp, char *vals, int maxlen, int nsamp, struct mvarin
 					}
 					printf("Type 'quit' or 'q' and press Enter to exit: ");
 				}
+			} else {
+				if (g_trace)
+					adc_trace_block(mr, &tr, usec);
+				if (g_trig_cfg.mode != TRIG_OFF)
+					adc_trigger(mr, &g_tmp_data);
 			}
 		}
 	}
@@ -617,11 +771,11 @@ void disp_spi(void)
 // Main program
 int main(int argc, char *argv[])
 {
-	const uint32_t pwm_range = (PWM_FREQ * 2) / g_sample_rate;
+	uint32_t pwm_range, max_rate;
 	struct mvaring *mr;
 	int args=0;
 	int f, ret;
-	float freq;
+	double freq;
 
 	g_sample_count = MAX_SAMPS;
 
@@ -632,6 +786,35 @@ int main(int argc, char *argv[])
 		{
 			switch (toupper(argv[args][1]))
 			{
+			case 'C':				   // -C: recalibrate clocks, ignore cache
+				g_recalibrate = 1;
+				break;
+			case 'D':				   // -D: number of ADCs (CE0, CE1)
+				if (args >= argc-1 || (g_adc_devs = atoi(argv[++args])) < 1 ||
+					g_adc_devs > MAX_ADC_DEVS)
+				{
+					printf("Error: 1 to %d ADC devices supported\n", MAX_ADC_DEVS);
+					exit(1);
+				}
+				break;
+			case 'G':				   // -G: trigger spec, see trig_parse()
+				if (args >= argc-1 || trig_parse(&g_trig_cfg, argv[++args]))
+				{
+					printf("Error: invalid trigger spec\n");
+					exit(1);
+				}
+				break;
+			case 'I':				   // -I: number of input channels per ADC
+				if (args >= argc-1 || (g_in_chans = atoi(argv[++args])) < 1 ||
+					g_in_chans > MAX_ADC_CHANS)
+				{
+					printf("Error: 1 to %d input channels supported\n", MAX_ADC_CHANS);
+					exit(1);
+				}
+				break;
+			case 'L':				   // -L: latency trace to shared memory
+				g_tracemode = 1;
+				break;
 			case 'T':				   // -T: test mode
 				g_testmode = 1;
 				break;
@@ -642,6 +825,25 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	// The ADCs share the SPI bus, so split the max rate between them
+	max_rate = SPI_FREQ / SPI_BITS_PER_SAMP;
+	if (max_rate > MAX_SAMPLE_RATE)
+		max_rate = MAX_SAMPLE_RATE;
+	if ((uint32_t)g_sample_rate * g_adc_devs > max_rate)
+	{
+		g_sample_rate = max_rate / g_adc_devs;
+		printf("Sample rate limited to %u S/s per ADC\n", g_sample_rate);
+	}
+	pwm_range = (PWM_FREQ * 2) / (g_sample_rate * g_adc_devs);
+
+	g_trig_cfg.stride = g_adc_devs * g_in_chans;
+	if (trig_init(&g_trig, &g_trig_cfg))
+	{
+		printf("Error: trigger channel %u not in %u channels, or window too long\n",
+			   g_trig_cfg.offset, g_trig_cfg.stride);
+		exit(1);
+	}
+
 	/*
 	 * TODO: The reader could create the shm and the ring-buffer.
 	 * Here we would just call the shmem_open() and perform check: ring_is_ok()
@@ -661,6 +863,18 @@ int main(int argc, char *argv[])
 		printf("Ringbuffer init failed\n");
 		return -EINVAL;
 	}
+	mr->info.ndevs = g_adc_devs;
+	mr->info.nchans = g_in_chans;
+	mr->info.sample_rate = g_sample_rate / g_in_chans;
+
+	if (g_tracemode)
+	{
+		ret = shmem_create(TRACE_SHM_NAME, TRACE_SHM_SIZE, &g_trace_info);
+		if (ret || !(g_trace = trace_init(g_trace_info.buff, TRACE_SHM_SIZE)))
+			printf("Latency trace disabled, can't create %s\n", TRACE_SHM_NAME);
+		else
+			printf("Latency trace in %s\n", TRACE_SHM_NAME);
+	}
 
 	map_devices();
 	map_uncached_mem(&vc_mem, VC_MEM_SIZE);
@@ -669,17 +883,18 @@ int main(int argc, char *argv[])
 	if (g_testmode)
 	{
 		printf("Testing %1.3f MHz SPI frequency: ", f/1e6);
-		freq = test_spi_frequency(&vc_mem);
+		freq = test_spi_frequency(&vc_mem, cal_spi_words(f));
 		printf("%7.3f MHz\n", freq);
-		printf("Testing %5u Hz  PWM frequency: ", g_sample_rate);
-		freq = test_pwm_frequency(&vc_mem, pwm_range);
+		printf("Testing %5u Hz  PWM frequency: ", g_sample_rate * g_adc_devs);
+		freq = test_pwm_frequency(&vc_mem, pwm_range, cal_pwm_cycles(g_sample_rate * g_adc_devs));
 		printf("%7.3f Hz\n", freq);
 
 		goto end;
 	}
+	adc_calibrate(&vc_mem, f, pwm_range, mr);
 
-	printf("Streaming %u samples per block at %u S/s\n",
-		   g_sample_count, g_sample_rate);
+	printf("Streaming %u samples per block at %u S/s, %d ADC(s) with %d channel(s)\n",
+		   g_sample_count, g_sample_rate * g_adc_devs, g_adc_devs, g_in_chans);
 	adc_dma_init(&vc_mem, g_sample_count, 0, pwm_range);
 	adc_stream_start();
 	while (1)
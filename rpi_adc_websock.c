@@ -0,0 +1,819 @@
+// Stream the shm ring or a capture set to web browsers over a WebSocket, and
+// serve the pages. Pages that send their view get min/max envelopes of it.
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "adc_capset.h"
+#include "adc_common.h"
+#include "adc_envelope.h"
+#include "adc_pyramid.h"
+#include "adc_simd.h"
+#include "adc_websock.h"
+#include "common.h"
+#include "mvaring.h"
+#include "rpi_shmem.h"
+
+#define DEFAULT_PORT	8080
+#define DEFAULT_FPS	20
+#define DEFAULT_NVALS	5000
+#define MAX_NVALS	65536
+#define MAX_CLIENTS	8
+#define MAX_CHANS	16
+#define MAX_COLS	8192
+#define REQ_MAX		4096
+#define ATTACH_SECS	1
+#define OUT_OFF		16	/* payload offset in out, aligned for msg_hdr */
+
+/*
+ * Binary message of samples, little-endian: this header, then nvals
+ * ADC codes (int16) of each channel in turn. These are the newest frames
+ * in the ring when the message is sent.
+ */
+#define MSG_SAMPLES	1
+
+/*
+ * Binary message of a view, sent once a page has set one: the same
+ * header with nvals the number of columns, then the min and max code of
+ * each column for each channel in turn. The channels are the lowest
+ * nchans of those the page asked for. Columns with no data are -1.
+ * The columns cover the header's frames, fewer than the view's span if
+ * the ring (half of it, at most) or the capture doesn't hold that many.
+ */
+#define MSG_ENVELOPE	2
+
+struct msg_hdr {
+	uint8_t type;
+	uint8_t nchans;
+	uint8_t bits;		/* ADC resolution, codes are 0 to 2^bits - 1 */
+	uint8_t reserved;
+	uint32_t nvals;		/* values of each channel */
+	uint32_t rate;		/* frames per second */
+	float lsb;		/* volts per code */
+	uint32_t frames;	/* frames the values cover */
+};
+
+/* Web pages served, by path */
+static const char *const g_pages[][2] = {
+	{ "/", "webgl_graph.html" },
+	{ "/logic", "webgl_logic.html" },
+};
+
+struct client {
+	int fd;
+	bool ws;		/* switched to a WebSocket */
+	bool running;		/* send every tick, else only if single */
+	bool single;
+	bool close_sent;	/* close once the output has gone */
+	unsigned int cols;	/* columns of the page's view, 0 for samples */
+	double span;		/* seconds across the view */
+	double at;		/* start of the view in a capture, seconds */
+	uint32_t chans;		/* channels of the view, a bit for each */
+	bool view_new;		/* view changed, a capture is sent again */
+	uint8_t in[REQ_MAX];	/* HTTP request, then WebSocket frames */
+	size_t in_len;
+	uint8_t *out;		/* message being sent */
+	size_t out_size, out_len, out_pos;
+	unsigned long sent, dropped;
+};
+
+static struct client g_clients[MAX_CLIENTS];
+static struct shmem_info g_shm_info;
+static struct mvaring *g_ring;
+static unsigned int g_words;
+static uint32_t g_blk[MAX_SAMPS];
+static uint16_t g_vals[NUM_DATA_CHUNKS / 2 * MAX_SAMPS];
+static unsigned int g_vals_frames;	/* newest frames of each channel in g_vals */
+static struct capset_reader g_cap;
+static bool g_capture;
+static uint64_t g_cap_first, g_cap_end;
+static struct pyr_point g_pts[MAX_COLS];
+static const char *g_dir = ".";
+static unsigned int g_nvals = DEFAULT_NVALS;
+static volatile sig_atomic_t g_stop;
+
+static void on_signal(int sig)
+{
+	g_stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void ring_detach(void)
+{
+	shmem_close(&g_shm_info);
+	free((void *)g_shm_info.name);
+	memset(&g_shm_info, 0, sizeof(g_shm_info));
+	g_ring = NULL;
+}
+
+/* Map the ring read-only, if the producer has created it */
+static int ring_attach(void)
+{
+	int fd, ret;
+
+	/* Probe first, shmem_open_ro() complains about a missing ring */
+	fd = shm_open(SHM_NAME, O_RDONLY, 0);
+	if (fd < 0)
+		return -errno;
+	close(fd);
+	ret = shmem_open_ro(SHM_NAME, SHM_SIZE, &g_shm_info);
+	if (ret)
+		return ret;
+
+	g_ring = g_shm_info.buff;
+	/* The producer sets the stream info just after creating the ring */
+	g_words = ring_is_ok(g_ring) ? ADC_FRAME_WORDS(&g_ring->info) : 0;
+	if (!g_words) {
+		ring_detach();
+		return -EAGAIN;
+	}
+
+	return 0;
+}
+
+/* True if the ring mapped is no longer the one the producer has */
+static bool ring_gone(void)
+{
+	struct stat st, cur;
+	bool gone;
+	int fd;
+
+	fd = shm_open(SHM_NAME, O_RDONLY, 0);
+	if (fd < 0)
+		return true;
+	gone = fstat(fd, &st) || fstat(g_shm_info.fd, &cur) || st.st_ino != cur.st_ino;
+	close(fd);
+
+	return gone || !ring_is_ok(g_ring);
+}
+
+/*
+ * The newest @nvals frames in the ring, channel after channel, after a
+ * message header. Return the message length, or 0 if there is no data or
+ * the writer overtook the copy.
+ */
+static size_t build_samples(uint8_t *p, unsigned int nvals)
+{
+	struct msg_hdr *h = (struct msg_hdr *)p;
+	int16_t *v = (int16_t *)(h + 1);
+	unsigned int w, fpb, nblks, b, f0, n = 0, nchans, c;
+
+	w = atomic_load_explicit(&g_ring->windex, memory_order_acquire);
+	fpb = MAX_SAMPS / g_words;
+	nblks = (nvals + fpb - 1) / fpb;
+	if (nblks > NUM_DATA_CHUNKS / 2)
+		nblks = NUM_DATA_CHUNKS / 2;
+	if (nblks > w)
+		nblks = w;
+	if (nvals > nblks * fpb)
+		nvals = nblks * fpb;
+	if (!nvals)
+		return 0;
+
+	nchans = g_words < MAX_CHANS ? g_words : MAX_CHANS;
+	for (b = w - nblks; b != w; b++) {
+		if (ring_copy_samples(g_ring, (uint64_t)b * MAX_SAMPS, g_blk, fpb * g_words))
+			return 0;
+		/* Skip the oldest frames of the first block */
+		f0 = b == w - nblks ? nblks * fpb - nvals : 0;
+		for (c = 0; c < nchans; c++)
+			adc_raw_to_i16(&v[c * nvals + n], &g_blk[f0 * g_words + c], fpb - f0, g_words);
+		n += fpb - f0;
+	}
+
+	h->type = MSG_SAMPLES;
+	h->nchans = nchans;
+	h->bits = ADC_BITS;
+	h->reserved = 0;
+	h->nvals = nvals;
+	h->rate = g_ring->info.sample_rate;
+	h->lsb = ADC_VOLTAGE(1.0);
+	h->frames = nvals;
+
+	return sizeof(*h) + (size_t)nchans * nvals * sizeof(int16_t);
+}
+
+/* Fill in a message header, return the channels of the view, up to @nwords */
+static unsigned int view_chans(const struct client *cl, unsigned int nwords, uint8_t type,
+			       uint32_t rate, uint32_t frames, uint8_t *p, unsigned int *chans)
+{
+	struct msg_hdr *h = (struct msg_hdr *)p;
+	unsigned int c, n = 0;
+
+	for (c = 0; c < nwords && c < MAX_CHANS; c++) {
+		if (cl->chans & 1U << c)
+			chans[n++] = c;
+	}
+	h->type = type;
+	h->nchans = n;
+	h->bits = ADC_BITS;
+	h->reserved = 0;
+	h->nvals = cl->cols;
+	h->rate = rate;
+	h->lsb = ADC_VOLTAGE(1.0);
+	h->frames = frames;
+
+	return n;
+}
+
+/* Frames of the newest span of the ring a page's view wants */
+static unsigned int view_frames(const struct client *cl)
+{
+	uint32_t rate = g_ring->info.sample_rate;
+	double want = cl->span * (rate ? rate : 1);
+
+	return want < 1 ? 1 : want < UINT32_MAX ? want : UINT32_MAX;
+}
+
+/*
+ * Codes of the newest @frames of the ring for the channels in @chans,
+ * channel c at g_vals[c * g_vals_frames], for all the pages of a tick.
+ * Up to half the ring, which the writer won't overwrite during the copy.
+ * Return 0, or -EAGAIN if there is no data or the writer overtook the copy.
+ */
+static int ring_codes(unsigned int frames, uint32_t chans)
+{
+	unsigned int w, fpb, nblks, b, f0, n = 0, c;
+
+	g_vals_frames = 0;
+	w = atomic_load_explicit(&g_ring->windex, memory_order_acquire);
+	fpb = MAX_SAMPS / g_words;
+	nblks = w < NUM_DATA_CHUNKS / 2 ? w : NUM_DATA_CHUNKS / 2;
+	if (frames > fpb * nblks)
+		frames = fpb * nblks;
+	if (!frames)
+		return -EAGAIN;
+	nblks = (frames + fpb - 1) / fpb;
+
+	for (b = w - nblks; b != w; b++) {
+		if (ring_copy_samples(g_ring, (uint64_t)b * MAX_SAMPS, g_blk, fpb * g_words))
+			return -EAGAIN;
+		f0 = b == w - nblks ? nblks * fpb - frames : 0;
+		for (c = 0; c < g_words && c < MAX_CHANS; c++) {
+			if (chans & 1U << c)
+				adc_raw_to_i16((int16_t *)&g_vals[(size_t)c * frames + n],
+					       &g_blk[f0 * g_words + c], fpb - f0, g_words);
+		}
+		n += fpb - f0;
+	}
+	g_vals_frames = frames;
+
+	return 0;
+}
+
+/*
+ * Min/max envelope of the newest span of the ring, over the columns of the
+ * page's view, from the codes of this tick. Return the message length, or
+ * 0 if there is no data.
+ */
+static size_t build_envelope(uint8_t *p, const struct client *cl)
+{
+	uint16_t *out = (uint16_t *)(p + sizeof(struct msg_hdr));
+	unsigned int frames, nchans, k;
+	unsigned int chans[MAX_CHANS];
+
+	frames = view_frames(cl);
+	if (frames > g_vals_frames)
+		frames = g_vals_frames;
+	if (!frames)
+		return 0;
+	nchans = view_chans(cl, g_words, MSG_ENVELOPE, g_ring->info.sample_rate, frames,
+			    p, chans);
+
+	/* The newest frames are at the end of each channel's codes */
+	for (k = 0; k < nchans; k++)
+		env_columns(&g_vals[(size_t)(chans[k] + 1) * g_vals_frames - frames], frames,
+			    cl->cols, &out[(size_t)k * 2 * cl->cols]);
+
+	return sizeof(struct msg_hdr) + (size_t)nchans * 2 * cl->cols * sizeof(uint16_t);
+}
+
+/* The same from the pyramid of a capture set, for the span from cl->at */
+static size_t build_capture(uint8_t *p, const struct client *cl)
+{
+	int16_t *out = (int16_t *)(p + sizeof(struct msg_hdr));
+	unsigned int chans[MAX_CHANS], nchans, k, i;
+	uint64_t t0, t1;
+	uint32_t rate;
+	double frames;
+
+	t0 = g_cap_first + (uint64_t)(cl->at * 1e9);
+	t1 = t0 + (uint64_t)(cl->span * 1e9);
+	if (t1 > g_cap_end)
+		t1 = g_cap_end;
+	if (t0 >= t1)
+		return 0;
+	rate = g_cap.hdr.info.sample_rate;
+	frames = (t1 - t0) * 1e-9 * rate;
+	nchans = view_chans(cl, ADC_FRAME_WORDS(&g_cap.hdr.info), MSG_ENVELOPE, rate,
+			    frames < UINT32_MAX ? frames : UINT32_MAX, p, chans);
+
+	for (k = 0; k < nchans; k++, out += 2 * cl->cols) {
+		if (pyr_query(&g_cap, chans[k], t0, t1, g_pts, cl->cols) < 0)
+			return 0;
+		for (i = 0; i < cl->cols; i++) {
+			out[2 * i] = g_pts[i].count ? g_pts[i].min : -1;
+			out[2 * i + 1] = g_pts[i].count ? g_pts[i].max : -1;
+		}
+	}
+
+	return sizeof(struct msg_hdr) + (size_t)nchans * 2 * cl->cols * sizeof(int16_t);
+}
+
+static void client_close(struct client *cl)
+{
+	if (cl->ws)
+		printf("Client %d closed, %lu messages sent, %lu dropped\n", cl->fd,
+		       cl->sent, cl->dropped);
+	close(cl->fd);
+	free(cl->out);
+	memset(cl, 0, sizeof(*cl));
+	cl->fd = -1;
+}
+
+/* Make room for @len bytes of output */
+static int client_reserve(struct client *cl, size_t len)
+{
+	uint8_t *p;
+
+	if (len <= cl->out_size)
+		return 0;
+	p = realloc(cl->out, len);
+	if (!p)
+		return -ENOMEM;
+	cl->out = p;
+	cl->out_size = len;
+
+	return 0;
+}
+
+/* Send what the socket will take of the output, -errno if it failed */
+static int client_send(struct client *cl)
+{
+	ssize_t n;
+
+	while (cl->out_pos < cl->out_len) {
+		n = send(cl->fd, &cl->out[cl->out_pos], cl->out_len - cl->out_pos,
+			 MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -errno;
+		cl->out_pos += n;
+	}
+	cl->out_len = cl->out_pos = 0;
+
+	return cl->close_sent ? -ECONNRESET : 0;
+}
+
+/* Queue a whole frame, with the payload already at out + OUT_OFF */
+static void client_frame(struct client *cl, int opcode, size_t len)
+{
+	uint8_t hdr[WS_HDR_MAX];
+	size_t hlen = ws_frame_header(hdr, opcode, len);
+
+	cl->out_pos = OUT_OFF - hlen;
+	memcpy(&cl->out[cl->out_pos], hdr, hlen);
+	cl->out_len = OUT_OFF + len;
+}
+
+/* Queue a short frame, if nothing else is being sent */
+static void client_reply(struct client *cl, int opcode, const void *data, size_t len)
+{
+	if (cl->out_len || client_reserve(cl, OUT_OFF + len))
+		return;
+	memcpy(&cl->out[OUT_OFF], data, len);
+	client_frame(cl, opcode, len);
+}
+
+static void http_reply(struct client *cl, const char *status, const char *body, size_t len)
+{
+	int n;
+
+	if (client_reserve(cl, REQ_MAX + len))
+		return;
+	n = snprintf((char *)cl->out, REQ_MAX, "HTTP/1.1 %s\r\nContent-Type: text/html\r\n"
+		     "Content-Length: %zu\r\nConnection: close\r\n\r\n", status, len);
+	memcpy(&cl->out[n], body, len);
+	cl->out_len = n + len;
+	cl->out_pos = 0;
+	cl->close_sent = true;
+}
+
+/* Serve a page, or switch to a WebSocket */
+static void http_request(struct client *cl)
+{
+	char *req = (char *)cl->in, path[256], fname[512], *body;
+	size_t i, len;
+	FILE *f;
+	int n;
+
+	if (sscanf(req, "GET %255s", path) != 1) {
+		http_reply(cl, "400 Bad Request", "", 0);
+		return;
+	}
+	if (!strcmp(path, "/ws")) {
+		if (client_reserve(cl, REQ_MAX))
+			return;
+		n = ws_upgrade_response(req, (char *)cl->out, REQ_MAX);
+		if (n < 0) {
+			http_reply(cl, "400 Bad Request", "", 0);
+			return;
+		}
+		cl->out_len = n;
+		cl->out_pos = 0;
+		cl->ws = true;
+		cl->in_len = 0;
+		printf("Client %d WebSocket\n", cl->fd);
+		return;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(g_pages) && strcmp(path, g_pages[i][0]); i++)
+		;
+	if (i == ARRAY_SIZE(g_pages)) {
+		http_reply(cl, "404 Not Found", "", 0);
+		return;
+	}
+	snprintf(fname, sizeof(fname), "%s/%s", g_dir, g_pages[i][1]);
+	f = fopen(fname, "rb");
+	if (!f || fseek(f, 0, SEEK_END) || (long)(len = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET) || !(body = malloc(len + 1)) ||
+	    fread(body, 1, len, f) != len) {
+		if (f)
+			fclose(f);
+		http_reply(cl, "404 Not Found", "", 0);
+		return;
+	}
+	fclose(f);
+	http_reply(cl, "200 OK", body, len);
+	free(body);
+}
+
+/*
+ * Act on a command from the page: run, stop, single, or
+ * "view cols=N span=SECS chans=MASK at=SECS" to get envelopes of N columns
+ * instead of samples. at is only used for a capture set.
+ */
+static void ws_command(struct client *cl, char *cmd)
+{
+	char *tok, *save;
+
+	if (!strcmp(cmd, "run")) {
+		cl->running = true;
+	} else if (!strcmp(cmd, "stop")) {
+		cl->running = false;
+	} else if (!strcmp(cmd, "single")) {
+		cl->single = true;
+	} else if (!strncmp(cmd, "view ", 5)) {
+		cl->cols = 0;
+		cl->span = cl->at = 0;
+		cl->chans = ~0U;
+		for (tok = strtok_r(cmd + 5, " ", &save); tok; tok = strtok_r(NULL, " ", &save)) {
+			if (!strncmp(tok, "cols=", 5))
+				cl->cols = strtoul(tok + 5, NULL, 0);
+			else if (!strncmp(tok, "span=", 5))
+				cl->span = atof(tok + 5);
+			else if (!strncmp(tok, "chans=", 6))
+				cl->chans = strtoul(tok + 6, NULL, 0);
+			else if (!strncmp(tok, "at=", 3))
+				cl->at = atof(tok + 3);
+		}
+		if (cl->cols > MAX_COLS || cl->span <= 0 || cl->at < 0)
+			cl->cols = 0;
+		cl->view_new = true;
+	}
+}
+
+/* Read from a client, -errno if it should be closed */
+static int client_read(struct client *cl)
+{
+	struct ws_frame f;
+	char cmd[WS_MSG_MAX + 1];
+	ssize_t n;
+
+	n = recv(cl->fd, &cl->in[cl->in_len], sizeof(cl->in) - cl->in_len - 1, MSG_DONTWAIT);
+	if (n < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -errno;
+	if (n == 0)
+		return -ECONNRESET;
+	/* Nothing more is wanted once the connection is closing */
+	if (cl->close_sent)
+		return 0;
+	cl->in_len += n;
+
+	if (!cl->ws) {
+		cl->in[cl->in_len] = 0;
+		if (strstr((char *)cl->in, "\r\n\r\n"))
+			http_request(cl);
+		else if (cl->in_len >= sizeof(cl->in) - 1)
+			return -EMSGSIZE;
+		return 0;
+	}
+
+	while ((n = ws_frame_decode(cl->in, cl->in_len, &f)) > 0) {
+		switch (f.opcode) {
+		case WS_OP_TEXT:
+			memcpy(cmd, f.data, f.len);
+			cmd[f.len] = 0;
+			ws_command(cl, cmd);
+			break;
+		case WS_OP_PING:
+			client_reply(cl, WS_OP_PONG, f.data, f.len);
+			break;
+		case WS_OP_CLOSE:
+			client_reply(cl, WS_OP_CLOSE, f.data, f.len < 2 ? f.len : 2);
+			cl->close_sent = true;
+			break;
+		}
+		memmove(cl->in, &cl->in[n], cl->in_len - n);
+		cl->in_len -= n;
+	}
+
+	return n == -EAGAIN ? 0 : n;
+}
+
+/* True if a page wants a message this tick */
+static bool client_due(const struct client *cl)
+{
+	if (cl->fd < 0 || !cl->ws || cl->close_sent || !(cl->running || cl->single))
+		return false;
+
+	return !g_capture || (cl->cols && (cl->view_new || cl->single));
+}
+
+/*
+ * Send new data to each page that wants it, unless still sending. The
+ * ring is read and converted once for all the pages with a view. A
+ * capture doesn't change, so it is only sent again for a new view.
+ */
+static void clients_tick(void)
+{
+	struct client *cl;
+	unsigned int frames = 0;
+	uint32_t chans = 0;
+	size_t len;
+
+	if (!g_capture) {
+		for (cl = g_clients; cl < &g_clients[MAX_CLIENTS]; cl++) {
+			if (client_due(cl) && !cl->out_len && cl->cols) {
+				if (view_frames(cl) > frames)
+					frames = view_frames(cl);
+				chans |= cl->chans;
+			}
+		}
+		if (frames)
+			ring_codes(frames, chans);
+	}
+
+	for (cl = g_clients; cl < &g_clients[MAX_CLIENTS]; cl++) {
+		if (!client_due(cl))
+			continue;
+		if (cl->out_len) {
+			cl->dropped++;
+			continue;
+		}
+		len = cl->cols ? 2 * cl->cols : g_nvals;
+		if (client_reserve(cl, OUT_OFF + sizeof(struct msg_hdr) +
+				   MAX_CHANS * len * sizeof(int16_t)))
+			continue;
+		if (g_capture)
+			len = build_capture(&cl->out[OUT_OFF], cl);
+		else if (cl->cols)
+			len = build_envelope(&cl->out[OUT_OFF], cl);
+		else
+			len = build_samples(&cl->out[OUT_OFF], g_nvals);
+		if (!len)
+			continue;
+		client_frame(cl, WS_OP_BINARY, len);
+		cl->single = cl->view_new = false;
+		cl->sent++;
+	}
+}
+
+/* Serve a capture set instead of the ring, from its start to its end */
+static int capture_open(const char *dir)
+{
+	struct capset_seg *last;
+	struct cap_block b;
+	int ret;
+
+	ret = capset_open_read(&g_cap, dir);
+	if (ret)
+		return ret;
+	last = &g_cap.segs[g_cap.nsegs - 1];
+	ret = capset_read_at(&g_cap, g_cap.nsegs - 1, last->nblocks - 1, &b, &g_cap_end);
+	if (ret) {
+		capset_close_read(&g_cap);
+		return ret;
+	}
+	g_cap_end += MAX_SAMPS * g_cap.hdr.word_ps / 1000;
+	g_cap_first = capset_first_ns(&g_cap);
+	g_capture = true;
+
+	return 0;
+}
+
+static int listen_on(int port)
+{
+	struct sockaddr_in sa = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+	};
+	int fd, on = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -errno;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) || listen(fd, MAX_CLIENTS)) {
+		close(fd);
+		return -errno;
+	}
+
+	return fd;
+}
+
+static void accept_client(int lfd)
+{
+	struct client *cl;
+	int fd;
+
+	fd = accept(lfd, NULL, NULL);
+	if (fd < 0)
+		return;
+	for (cl = g_clients; cl < &g_clients[MAX_CLIENTS] && cl->fd >= 0; cl++)
+		;
+	if (cl == &g_clients[MAX_CLIENTS]) {
+		close(fd);
+		return;
+	}
+	cl->fd = fd;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sigaction sa = { .sa_handler = on_signal };
+	struct pollfd pfd[MAX_CLIENTS + 1];
+	struct client *cl[MAX_CLIENTS + 1];
+	uint64_t t, tick_ns, next_ns, attach_ns = 0;
+	unsigned int fps = DEFAULT_FPS;
+	const char *cap_dir = NULL;
+	int args = 0, port = DEFAULT_PORT, lfd, i, n, timeout, ret;
+
+	while (argc > ++args)
+	{
+		if (argv[args][0] == '-')
+		{
+			switch (toupper(argv[args][1]))
+			{
+			case 'C':		// -C dir: capture set to serve, instead of the ring
+				if (args >= argc-1)
+				{
+					printf("Error: no capture set\n");
+					exit(1);
+				}
+				cap_dir = argv[++args];
+				break;
+			case 'D':		// -D dir: directory of the web pages
+				if (args >= argc-1)
+				{
+					printf("Error: no directory\n");
+					exit(1);
+				}
+				g_dir = argv[++args];
+				break;
+			case 'F':		// -F fps: messages per second to each page
+				if (args >= argc-1 || (fps = atoi(argv[++args])) < 1 || fps > 1000)
+				{
+					printf("Error: 1 to 1000 messages per second\n");
+					exit(1);
+				}
+				break;
+			case 'N':		// -N num: values of each channel per message
+				if (args >= argc-1 || (g_nvals = atoi(argv[++args])) < 1 ||
+				    g_nvals > MAX_NVALS)
+				{
+					printf("Error: 1 to %u values\n", MAX_NVALS);
+					exit(1);
+				}
+				break;
+			case 'P':		// -P port: TCP port to listen on
+				if (args >= argc-1 || (port = atoi(argv[++args])) < 1 || port > 65535)
+				{
+					printf("Error: no port number\n");
+					exit(1);
+				}
+				break;
+			default:
+				printf("Error: unrecognised option '%s'\n", argv[args]);
+				printf("Usage: %s [-P port] [-D dir] [-F fps] [-N values] [-C capture_dir]\n",
+				       argv[0]);
+				exit(1);
+			}
+		}
+	}
+
+	if (cap_dir)
+	{
+		ret = capture_open(cap_dir);
+		if (ret)
+		{
+			fprintf(stderr, "%s: %s\n", cap_dir, strerror(-ret));
+			return 1;
+		}
+		printf("Serving capture set %s: %u ADC x %u channels, %.3f s\n", cap_dir,
+		       g_cap.hdr.info.ndevs, g_cap.hdr.info.nchans,
+		       (g_cap_end - g_cap_first) / 1e9);
+	}
+
+	lfd = listen_on(port);
+	if (lfd < 0)
+	{
+		fprintf(stderr, "Can't listen on port %d: %s\n", port, strerror(-lfd));
+		return 1;
+	}
+	for (i = 0; i < MAX_CLIENTS; i++)
+		g_clients[i].fd = -1;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	printf("Serving %s on port %d, %u messages/s of %u values\n", g_dir, port, fps, g_nvals);
+
+	tick_ns = 1000000000ULL / fps;
+	next_ns = now_ns();
+	while (!g_stop) {
+		t = now_ns();
+		if (!g_capture && t - attach_ns >= ATTACH_SECS * 1000000000ULL) {
+			attach_ns = t;
+			if (g_ring && ring_gone()) {
+				printf("Ring %s gone\n", SHM_NAME);
+				ring_detach();
+			}
+			if (!g_ring && !ring_attach())
+				printf("Reading ring %s: %u ADC x %u channels\n", SHM_NAME,
+				       g_ring->info.ndevs, g_ring->info.nchans);
+		}
+		if ((int64_t)(t - next_ns) >= 0) {
+			next_ns += tick_ns;
+			if ((int64_t)(t - next_ns) >= 0)
+				next_ns = t + tick_ns;
+			if (g_ring || g_capture)
+				clients_tick();
+		}
+
+		pfd[0].fd = lfd;
+		pfd[0].events = POLLIN;
+		for (i = 0, n = 1; i < MAX_CLIENTS; i++) {
+			if (g_clients[i].fd < 0)
+				continue;
+			/* Send first, the page may be waiting for it */
+			if (g_clients[i].out_len && client_send(&g_clients[i])) {
+				client_close(&g_clients[i]);
+				continue;
+			}
+			cl[n] = &g_clients[i];
+			pfd[n].fd = g_clients[i].fd;
+			pfd[n].events = POLLIN | (g_clients[i].out_len ? POLLOUT : 0);
+			n++;
+		}
+		timeout = (int64_t)(next_ns - now_ns()) / 1000000 + 1;
+		if (poll(pfd, n, timeout > 0 ? timeout : 0) <= 0)
+			continue;
+
+		if (pfd[0].revents & POLLIN)
+			accept_client(lfd);
+		for (i = 1; i < n; i++) {
+			if (pfd[i].revents & (POLLIN | POLLHUP | POLLERR) && client_read(cl[i]))
+				client_close(cl[i]);
+		}
+	}
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		if (g_clients[i].fd >= 0)
+			client_close(&g_clients[i]);
+	}
+	close(lfd);
+	if (g_ring)
+		ring_detach();
+	if (g_capture)
+		capset_close_read(&g_cap);
+
+	return 0;
+}
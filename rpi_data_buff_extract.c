@@ -1,99 +1,464 @@
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "adc_capset.h"
 #include "adc_common.h"
+#include "adc_trace.h"
 #include "common.h"
 #include "rpi_shmem.h"
 #include "mvaring.h"
 
-/* TODO: Use real bitmask (12 bits?) */
-#define ADC_BITMASK 0xffff
+/* Binary capture set, convert to text with rpi_adc_cap2txt */
+#define CAPTURE_DIR "out/capture"
+#define DEF_SEG_MB 256
+/* Daemon mode counters, in the capture directory */
+#define STATS_FILE "stats"
+#define STATS_MSEC 1000
+/* Longest sleep on an empty ring before checking the producer */
+#define RING_WAIT_MSEC 100
+#define ATTACH_WAIT_USEC 200000
+
+struct rec_stats {
+	uint64_t blocks;	/* blocks recorded */
+	uint64_t dropped;	/* blocks the producer discarded (mvaring.dropped) */
+	uint64_t overwritten;	/* blocks overwritten in the ring before they were read */
+	uint64_t bytes;		/* bytes written by finished recordings */
+	unsigned int attaches;	/* producer starts recorded */
+	unsigned int rotations;	/* SIGHUP segment rotations */
+};
+
+static struct rec_stats g_stats;
+static unsigned int g_ring_dropped;	/* mvaring.dropped last seen */
+static volatile sig_atomic_t g_stop, g_rotate;
 
 static struct adc_data data[10];
 /* first 2 chuncks of data to guesstimate clk */
 static struct adc_data start_data[2];
 
-#define RAW2SAMP(raw) (((uint16_t)(raw) >> 8 | (uint16_t)raw << 8) & ADC_BITMASK)
+int store_adc(struct capset_writer *w, struct adc_data *a, int num_a, uint64_t seq)
+{
+	int i, ret;
+
+	for (i = 0; i < num_a; i++) {
+		ret = capset_write_block(w, seq + i, &a[i]);
+		if (ret)
+			return ret;
+	}
 
-void store_one(FILE *wf, struct adc_data *a, uint32_t nsec_delta)
+	return 0;
+}
+
+/* -F none | close | MB: fsync policy */
+static int parse_sync(struct awr_cfg *cfg, const char *arg)
 {
-	uint64_t time = a->usecs * 1000;
-	int i;
+	if (!strcmp(arg, "none")) {
+		cfg->sync = AWR_SYNC_NONE;
+	} else if (!strcmp(arg, "close")) {
+		cfg->sync = AWR_SYNC_CLOSE;
+	} else if (atoi(arg) > 0) {
+		cfg->sync = AWR_SYNC_BYTES;
+		cfg->sync_bytes = (uint64_t)atoi(arg) * 1024 * 1024;
+	} else {
+		return -EINVAL;
+	}
 
-	for (i = 0; i < MAX_SAMPS; i++)
-		fprintf(wf, "%llu\t%u\n",time + i * nsec_delta, RAW2SAMP(a->samples[i]));
+	return 0;
 }
 
-void store_adc(FILE *wf, struct adc_data *a, int num_a, uint32_t nsec_delta)
+static void print_stats(const struct capset_writer *w)
 {
-	int i;
+	const struct awr_stats *st = &w->stats;
 
-	for (i = 0; i < num_a; i++)
-		store_one(wf, &a[i], nsec_delta);
+	printf("Wrote %llu MB in %u writes (%s%s), %u syncs, segments %u..%u\n",
+	       (unsigned long long)(st->bytes >> 20), st->writes,
+	       w->cw.aw.mode == AWR_URING ? "io_uring" : "thread",
+	       w->cw.aw.direct ? ", O_DIRECT" : "", st->syncs, w->first_seg, w->seg);
+	printf("Longest write %.1f ms, %u stalls, longest stall %.1f ms\n",
+	       st->max_write_ns / 1e6, st->stalls, st->max_stall_ns / 1e6);
+	printf("Recorded %llu blocks, %llu dropped by the producer, %llu overwritten\n",
+	       (unsigned long long)g_stats.blocks, (unsigned long long)g_stats.dropped,
+	       (unsigned long long)g_stats.overwritten);
 }
 
-int main(int argc, const char *argv[])
+/*
+ * Counters for monitoring, replaced atomically so readers see whole files.
+ * @w is the recording in progress, NULL between recordings.
+ */
+static void write_stats(const char *path, const struct capset_writer *w)
 {
-	struct shmem_info in;
-	struct mvaring *mr;
-	uint32_t nsec_delta;
-	int ret;
-
-	FILE *wf;
-	
-	wf = fopen("out/data_out", "w");
-	if (!wf) {
-		ret = errno;
-		perror("fopen");
+	char tmp[CAPSET_NAME_LEN + 8];
+	uint64_t bytes = g_stats.bytes;
+	FILE *f;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	f = fopen(tmp, "w");
+	if (!f)
+		return;
+
+	/* Closed segments are in w->stats, the current one in its writer */
+	if (w)
+		bytes += w->stats.bytes + w->cw.aw.stats.bytes;
+
+	fprintf(f, "bytes_written %llu\n", (unsigned long long)bytes);
+	fprintf(f, "blocks_recorded %llu\n", (unsigned long long)g_stats.blocks);
+	fprintf(f, "blocks_dropped %llu\n", (unsigned long long)g_stats.dropped);
+	fprintf(f, "blocks_overwritten %llu\n", (unsigned long long)g_stats.overwritten);
+	fprintf(f, "writer_queue %d\n", w ? w->cw.aw.inflight : 0);
+	fprintf(f, "producer_attaches %u\n", g_stats.attaches);
+	fprintf(f, "rotations %u\n", g_stats.rotations);
+	fprintf(f, "recording %d\n", w != NULL);
+
+	if (fclose(f) || rename(tmp, path))
+		unlink(tmp);
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void on_signal(int sig)
+{
+	if (sig == SIGHUP)
+		g_rotate = 1;
+	else
+		g_stop = 1;
+}
+
+/* Latency trace is used if the producer was started with -L */
+static struct adc_trace *trace_open(struct shmem_info *ti)
+{
+	if (shmem_open(TRACE_SHM_NAME, TRACE_SHM_SIZE, ti))
+		return NULL;
+
+	if (!trace_is_ok(ti->buff)) {
+		shmem_close(ti);
+		ti->buff = NULL;
+		return NULL;
+	}
+
+	return ti->buff;
+}
+
+/*
+ * The producer unlinks the ring when it exits, and creates a new one when
+ * it starts again. The mapping of an unlinked ring stays valid, so this
+ * only tells that no more data is coming to it.
+ */
+static bool producer_gone(const struct shmem_info *in)
+{
+	struct stat st, cur;
+	int fd;
+
+	fd = shm_open(SHM_NAME, O_RDONLY, 0);
+	if (fd < 0)
+		return true;
+
+	if (fstat(fd, &st) || fstat(in->fd, &cur) || st.st_ino != cur.st_ino) {
+		close(fd);
+		return true;
+	}
+	close(fd);
+
+	return !ring_is_ok(in->buff);
+}
+
+/* Map the ring, waiting for the producer to create it if @wait */
+static int attach(struct shmem_info *in, bool wait)
+{
+	int fd, ret;
+
+	while (!g_stop) {
+		/* Probe first, shmem_open() complains about a missing ring */
+		fd = shm_open(SHM_NAME, O_RDONLY, 0);
+		if (fd >= 0) {
+			close(fd);
+			ret = shmem_open(SHM_NAME, SHM_SIZE, in);
+			if (ret)
+				return ret;
+			while (!g_stop && !ring_is_ok(in->buff))
+				usleep(1000);
+			return 0;
+		}
+		if (!wait)
+			return -ENOENT;
+		usleep(ATTACH_WAIT_USEC);
+	}
+
+	return -EINTR;
+}
+
+/*
+ * Read the first blocks of a producer run and start recording them.
+ * Returns 0 when recording, 1 if the producer went away first.
+ */
+static int record_open(struct mvaring *mr, const struct shmem_info *in, struct capset_writer *w,
+		       const struct capset_cfg *scfg, unsigned int *next)
+{
+	struct cap_header hdr;
+	unsigned int first;
+	uint64_t word_ps;
+	int n, ret;
+
+	first = atomic_load_explicit(&mr->rindex, memory_order_relaxed);
+	g_ring_dropped = atomic_load_explicit(&mr->dropped, memory_order_relaxed);
+	for (n = 0; n < 2;) {
+		ret = ring_read(mr, &start_data[n], 2 - n);
+		if (ret == -EAGAIN) {
+			if (g_stop)
+				return -EINTR;
+			if (ring_wait(mr, RING_WAIT_MSEC) == -ETIMEDOUT && producer_gone(in))
+				return 1;
+			continue;
+		}
+		if (ret < 0)
+			return ret;
+		n += ret;
+	}
+
+	/* Prefer the sample rate the producer calibrated at startup */
+	if (mr->info.calib_rate_mhz && ADC_FRAME_WORDS(&mr->info) > 0) {
+		word_ps = 1000000000000000ULL /
+			((uint64_t)mr->info.calib_rate_mhz * ADC_FRAME_WORDS(&mr->info));
+	} else {
+		word_ps = (uint64_t)(start_data[1].usecs - start_data[0].usecs) * 1000000;
+		word_ps /= MAX_SAMPS;
+	}
+
+	cap_header_init(&hdr, &mr->info, word_ps);
+	ret = capset_open_write(w, scfg, &hdr);
+	if (ret) {
+		printf("Can't record to %s: %d\n", scfg->dir, ret);
 		return ret;
 	}
 
-	ret = shmem_open(SHM_NAME, SHM_SIZE, &in);
+	ret = store_adc(w, &start_data[0], 2, first);
 	if (ret) {
-		printf("Nooo\n");
+		capset_close_write(w);
 		return ret;
 	}
 
-	mr = in.buff;
+	g_stats.attaches++;
+	g_stats.blocks += 2;
+	*next = first + 2;
 
-	while (!ring_is_ok(mr))
-		sleep(0);
+	return 0;
+}
 
-	for (ret = 0; ret >= 0 && ret < 2;) {
-		ret = ring_read(mr, &start_data[ret], 2 - ret);
-		if (ret == -EAGAIN)
-			ret = 0;
-	}
+/*
+ * Record until stopped, or until the producer goes away or starts over.
+ * Returns 0 when stopped, 1 when the producer is gone.
+ */
+static int record(struct mvaring *mr, const struct shmem_info *in, struct capset_writer *w,
+		  struct adc_trace *trace, unsigned int next, const char *stats_path)
+{
+	uint64_t stats_ms = 0;
+	unsigned int first, dropped, drain = 0;
+	int n, ret;
 
-	if (ret < 0)
-		goto err_out;
+	for (;;) {
+		if (stats_path && now_ms() - stats_ms >= STATS_MSEC) {
+			write_stats(stats_path, w);
+			stats_ms = now_ms();
+		}
 
-	nsec_delta = (start_data[1].usecs - start_data[0].usecs) * 1000;
-	nsec_delta /= MAX_SAMPS;
+		if (g_rotate) {
+			g_rotate = 0;
+			ret = capset_rotate(w);
+			if (ret)
+				return ret;
+			g_stats.rotations++;
+		}
 
-	store_adc(wf, &start_data[0], 2, nsec_delta);
+		/* On SIGTERM, record at most what the ring holds and stop */
+		if (g_stop && !drain)
+			drain = NUM_DATA_CHUNKS;
+
+		first = atomic_load_explicit(&mr->rindex, memory_order_relaxed);
+		if ((int)(first - next) < 0)
+			return 1;	/* ring_init() by a new producer */
 
-	for (;;) {
 		ret = ring_read(mr, &data[0], ARRAY_SIZE(data));
-		if (!ret || ret == -EAGAIN)
+		if (ret == -EAGAIN) {
+			if (drain)
+				return 0;
+			ret = ring_wait(mr, RING_WAIT_MSEC);
+			if (ret == -ETIMEDOUT && producer_gone(in))
+				return 1;
 			continue;
+		}
 
 		if (ret < 0)
-			goto err_out;
+			return ret;
 
-		store_adc(wf, &data[0], ret, nsec_delta);
+		g_stats.overwritten += first - next;
+		dropped = atomic_load_explicit(&mr->dropped, memory_order_relaxed);
+		if ((int)(dropped - g_ring_dropped) > 0)
+			g_stats.dropped += dropped - g_ring_dropped;
+		g_ring_dropped = dropped;
+		next = first + ret;
+		trace_consumed(trace, first, ret);
 
-		if (ring_empty(mr))
-			break;
+		g_stats.blocks += ret;
+		n = ret;
+		ret = store_adc(w, &data[0], n, first);
+		if (ret)
+			return ret;
+
+		if (drain) {
+			if (drain <= (unsigned int)n)
+				return 0;
+			drain -= n;
+		}
 	}
+}
 
-	if (0) {
-err_out:
-		printf("FAIL! %d\n", ret);
+int main(int argc, const char *argv[])
+{
+	struct awr_cfg wcfg = AWR_CFG_DEFAULT;
+	struct capset_cfg scfg = {
+		.dir = CAPTURE_DIR,
+		.seg_bytes = DEF_SEG_MB * 1024ULL * 1024,
+		.wcfg = &wcfg,
+	};
+	struct shmem_info in = { 0 }, ti = { 0 };
+	struct sigaction sa = { .sa_handler = on_signal };
+	char stats_path[CAPSET_NAME_LEN], *stats = NULL;
+	struct adc_trace *trace;
+	struct capset_writer w;
+	struct mvaring *mr;
+	unsigned int next;
+	bool daemon_mode = false;
+	int args = 0, ret;
+
+	while (argc > ++args)
+	{
+		if (argv[args][0] == '-')
+		{
+			switch (toupper(argv[args][1]))
+			{
+			case 'D':		// -D: daemon, record across producer restarts
+				daemon_mode = true;
+				break;
+			case 'F':		// -F none|close|MB: fsync policy
+				if (args >= argc-1 || parse_sync(&wcfg, argv[++args]))
+				{
+					printf("Error: fsync policy is none, close or MB\n");
+					exit(1);
+				}
+				break;
+			case 'K':		// -K num: keep only num newest segments
+				if (args >= argc-1 || (scfg.keep_segs = atoi(argv[++args])) < 1)
+				{
+					printf("Error: no number of segments to keep\n");
+					exit(1);
+				}
+				break;
+			case 'M':		// -M MB: segment size limit, 0 for none
+				if (args >= argc-1 || atoi(argv[++args]) < 0)
+				{
+					printf("Error: no segment size\n");
+					exit(1);
+				}
+				scfg.seg_bytes = atoi(argv[args]) * 1024ULL * 1024;
+				break;
+			case 'N':		// -N: no O_DIRECT
+				wcfg.direct = false;
+				break;
+			case 'O':		// -O dir: capture set directory
+				if (args >= argc-1)
+				{
+					printf("Error: no capture directory\n");
+					exit(1);
+				}
+				scfg.dir = argv[++args];
+				break;
+			case 'Q':		// -Q num: write buffers in flight
+				if (args >= argc-1 || (wcfg.nbufs = atoi(argv[++args])) < 1 ||
+				    wcfg.nbufs > AWR_MAX_BUFS)
+				{
+					printf("Error: 1 to %d write buffers\n", AWR_MAX_BUFS);
+					exit(1);
+				}
+				break;
+			case 'S':		// -S secs: segment duration limit
+				if (args >= argc-1 || atoi(argv[++args]) < 0)
+				{
+					printf("Error: no segment duration\n");
+					exit(1);
+				}
+				scfg.seg_secs = atoi(argv[args]);
+				break;
+			case 'T':		// -T: writer thread instead of io_uring
+				wcfg.thread = true;
+				break;
+			default:
+				printf("Error: unrecognised option '%s'\n", argv[args]);
+				exit(1);
+			}
+		}
 	}
-	fclose(wf);
-	shmem_close(&in);
 
-	return ret;
+	/* No SA_RESTART: signals wake up ring_wait() */
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+
+	if (daemon_mode) {
+		snprintf(stats_path, sizeof(stats_path), "%s/" STATS_FILE, scfg.dir);
+		stats = stats_path;
+	}
+
+	do {
+		ret = attach(&in, daemon_mode);
+		if (ret == -EINTR) {
+			ret = 0;
+			break;
+		} else if (ret) {
+			printf("No ring from the producer: %d\n", ret);
+			break;
+		}
+
+		mr = in.buff;
+		trace = trace_open(&ti);
+
+		ret = record_open(mr, &in, &w, &scfg, &next);
+		if (!ret) {
+			ret = record(mr, &in, &w, trace, next, stats);
+			if (capset_close_write(&w) && ret <= 0)
+				ret = -EIO;
+			g_stats.bytes += w.stats.bytes;
+			print_stats(&w);
+			if (stats)
+				write_stats(stats, NULL);
+		}
+
+		shmem_close(&ti);
+		ti.buff = NULL;
+		shmem_close(&in);
+		in.buff = NULL;
+
+		if (ret > 0)
+			printf("Producer %s\n", daemon_mode ? "gone, waiting for it" : "gone");
+		else if (ret == -EINTR)
+			ret = 0;
+	} while (daemon_mode && ret > 0 && !g_stop);
+
+	if (ret < 0)
+		printf("FAIL! %d\n", ret);
+
+	return (ret < 0) ? ret : 0;
 }
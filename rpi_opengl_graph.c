@@ -17,25 +17,57 @@
 // Compile using: gcc rpi_opengl_graph.cpp -Wall -lm -lglut -lGLEW -lGL -o rpi_opengl_graph
 //
 // v0.32 JPB 15/12/20  Added -y command to set max y-value
-
+// v0.33     Read the newest blocks from the shared memory ring, FIFO with -S
+// v0.34     Traces are 16-bit y values, x is from the vertex index
+// v0.35     Min/max envelope per pixel column, -B benchmark
+// v0.36     Ingest thread, triple-buffered hand-over, double-buffered display
+// v0.37     Streaming vertex buffer regions, only changed traces written
+// v0.38     Digital phosphor mode, every sweep counted into an intensity image
+// v0.39     Spectrum and waterfall view
+// v0.40     Roll mode, a strip chart of min/max columns in a ring buffer
+// v0.41     Trace values in a texture, channels drawn as instances
+// v0.42     Offscreen drawing with EGL for benchmarks, -O and -W
+// v0.43     Incremental FIFO parser, no line length limit
+
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include <ctype.h>
 
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 
-#define VERSION         "0.32"
+#include "common.h"
+#include "adc_common.h"
+#include "adc_csv.h"
+#include "adc_envelope.h"
+#include "adc_fft.h"
+#include "adc_phosphor.h"
+#include "adc_simd.h"
+#include "mvaring.h"
+#include "rpi_shmem.h"
+
+#define VERSION         "0.43"
 #define USE_ES          1
+#define USE_EGL         1       // Offscreen drawing, with no window
+
+#if USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
-#define FIFO            "/tmp/adc.fifo"
 //#define WIN_SIZE        640, 480
+#define OFF_SIZE        640, 480    // Size of offscreen image
+#define OFF_WAIT_SECS   5           // Max wait for data when offscreen
 #define MAX_CHANS       16      // Max number of I/P chans
 #define NUM_CHANS       1       // Default number of I/P chans
 #define GRID_CHAN       0       // Channel num used by grid
@@ -51,11 +83,33 @@
 #define TRACE_YMAX      3.5     // Max analog value for each trace
 #define GRID_DIVS       10,8    // Number of divisions in grid
 #define CLEAR_COLOUR    0.8, 0.82, 0.8, 0.0 // Normalised background colour
-#define MAX_VALS        10000   // Maximum number of I/P values
+#define MAX_VALS        10000   // Maximum number of FIFO values
+#define MAX_RING_VALS   (NUM_DATA_CHUNKS / 2 * MAX_SAMPS) // Max values from ring
 #define NUM_VALS        1000    // Default number of I/P values
+#define BENCH_MIN_VALS  1000    // Benchmark values per frame, up by 10x
+#define BENCH_SECS      2       // Benchmark time for each count
+#define BENCH_SHIFT     10000   // Benchmark data moves by up to this
 #define ZEN(z)          ((z)+0.1)   // Z-value to enable drawing
 #define TIMER_MSEC      1000        // Time for FPS calculation
-#define GLUT_MODE       GLUT_SINGLE // Single or double-buffering
+#define GLUT_MODE       GLUT_DOUBLE // Single or double-buffering
+#define NUM_STAGES      3           // Vertex staging buffers, ingest to render
+#define STAGE_NEW       0x100       // Flag in stage_mid: not taken by render yet
+#define INGEST_USEC     1000        // Ingest poll time, a ring block at 1 MSPS
+#define VBO_REGIONS     3           // Vertex buffer regions, written in turn
+#define FENCE_NSEC      1000000000  // Max wait for the GPU to free a region
+#define PHOS_MSEC       300         // Default phosphor decay time constant
+#define PHOS_MIN        0.05        // Phosphor intensity shown, in hits
+#define SPEC_SIZE       2048        // Default FFT size
+#define SPEC_DB_MIN     -120.0      // Spectrum range, dB of full scale
+#define SPEC_DB_MAX     0.0
+#define SPEC_LINE_MSEC  20          // Time for each waterfall line
+#define WF_LINES        256         // Waterfall lines for each channel
+#define ROLL_SECS       60          // Default roll time across the plot
+#define VIEW_TRACES     0           // Views: traces, phosphor, spectrum, or roll
+#define VIEW_PHOS       1
+#define VIEW_SPEC       2
+#define VIEW_ROLL       3
+#define FIFO_LSB        (trace_ymax / 65535)    // Volts per value from FIFO
 
 // Macro to convert hex colour RGB value to normalised RGBA value
 #define COLR(x) {(x>>16&255)/255.0, (x>>8&255)/255.0, (x&255)/255.0, 1}
@@ -68,20 +122,125 @@ GLfloat trace_colours[MAX_TRACES][4] = {{0.6, 0.7, 0.6, 1},
     COLR(0xff0000), COLR(0xff9900), COLR(0xffff00), COLR(0x00ff00)};
 
 // Scale & offset values for each trace. First is grid,
-// the rest depend on number of traces.
+// the rest depend on number of traces, and scale the 16-bit values
 GLfloat trace_scoffs[MAX_TRACES][2] = {{1,0}};
+// Scale & offset values for the spectra, in the top half
+GLfloat spec_scoffs[MAX_TRACES][2];
+
+#if USE_EGL
+// Offscreen display and context, and a surface if pbuffers are needed
+EGLDisplay egl_dpy=EGL_NO_DISPLAY;
+EGLContext egl_ctx=EGL_NO_CONTEXT;
+EGLSurface egl_surf=EGL_NO_SURFACE;
+#endif
 
-// Variables to hold IDs for program & vertex buffer
-GLuint program, vbo;
+// Variables to hold IDs for programs, buffers & textures
+GLuint program, trace_program, phos_program, wf_program, vbo, grid_vbo, phos_tex, wf_tex;
+GLuint val_tex;
+// Trace upload buffer regions: the one last written, its mapping if
+// persistent, fences for the GPU copying them to the value texture
+int vbo_region, vbo_persistent;
+GLushort *vbo_map;
+GLsync vbo_fences[VBO_REGIONS];
+// Value texture: width, rows for each trace, trace versions in it
+int val_tex_w, val_tex_rows, max_tex_size;
+unsigned int val_tex_vers[MAX_CHANS];
 // IDs for 3D coords, colour array, scale & offset array
 GLint a_coord3d, u_colours, u_scoffs;
-
-int nvertices, frame_count, win_width, win_height, num_vals=NUM_VALS;
-int use_fifo, fifo_fd, fifo_in, discard, chan_vals;
-int args, verbose, vert_buff_alloc, paused;
-float trace_ymax=TRACE_YMAX;
+// IDs for trace value start & ring size, rows per trace, values per
+// x-value, x-values across & first x-value, colours, scale & offset
+GLint u_tstart, u_tring, u_trows, u_tvpp, u_txn, u_txoff, u_tcolours, u_tscoffs;
+// IDs for phosphor y-range & intensity scale; texture size & scale
+GLint u_pyrange, u_pgain;
+int phos_tex_cols, phos_tex_rows;
+float phos_gain;
+// IDs for waterfall y-range, channels, lines & newest line; its size
+GLint u_wyrange, u_wchans, u_wlines, u_wrow;
+int wf_bins, wf_row;
+// Roll texture, a ring of columns; its size, and columns written
+GLuint roll_tex;
+int roll_tex_cols, roll_tex_w, roll_tex_rows;
+unsigned int roll_tex_head;
+// View of the staging buffer shown
+int shown;
+
+int frame_count, win_width, win_height, num_vals=NUM_VALS;
+int use_fifo, fifo_fd, chan_vals;
+int args, verbose, vert_buff_alloc, vert_vpp=1, vert_chans, glut_mode=GLUT_MODE;
+int bench, bench_vals, bench_chans, bench_warm;
+uint64_t bench_start;
+// Offscreen frames to draw (0 for a whole benchmark), synthetic data if
+// there is no other, file for the last image, bytes copied to the GPU
+int offscreen, off_frames, synth;
+char *img_name;
+uint64_t upload_bytes;
+// Shared by the render (GLUT) and ingest threads
+atomic_int paused, env_cols, env_off, ingest_stop, bench_done, plot_rows, view;
+atomic_uint bench_frames, spec_rate;
+float trace_ymax=TRACE_YMAX, val_lsb, phos_tau=PHOS_MSEC/1000.0, roll_secs=ROLL_SECS;
 char *fifo_name;
 
+// Shared memory ring, mapped read-only. The newest blocks are copied
+// from its history, so the recording consumer still gets every block.
+struct shmem_info shm_info;
+struct mvaring *ring;
+unsigned int ring_windex, ring_words, ring_stalled;
+uint32_t ring_block[MAX_SAMPS];
+// Codes of a block, one channel after the other
+int16_t blk_codes[MAX_SAMPS];
+
+// Synthetic data, for benchmarks and offscreen drawing
+GLushort *bench_data;
+unsigned int synth_frames;
+
+// Digital phosphor image, one hit count per pixel of the plot area,
+// and the values filled in so far of the sweep being received
+float *phos_img, phos_max;
+int phos_cols, phos_rows, phos_new, phos_pos;
+uint64_t phos_t, phos_t_in;
+
+// Spectra, averaged over every block since the last waterfall line
+struct welch spec_welch[MAX_CHANS];
+int spec_size=SPEC_SIZE, spec_chans, spec_new;
+float spec_db[FFT_MAX_SIZE / 2];
+GLushort *spec_vals;
+uint64_t spec_t, spec_t_in;
+
+// Roll (strip chart) columns, each the min/max of roll_frames frames,
+// in a ring of roll_cols for each channel. roll_head counts the columns
+// done, roll_pub those handed over; roll_join is the last value of the
+// previous column, which each one is extended to, so the trace joins up.
+GLushort *roll_vals;
+uint16_t roll_lo[MAX_CHANS], roll_hi[MAX_CHANS], roll_join[MAX_CHANS];
+int roll_cols, roll_frames, roll_n;
+unsigned int roll_head, roll_pub;
+uint64_t roll_t_in;
+
+// Vertex staging buffer, filled by the ingest thread
+typedef struct {
+    GLushort *vals;     // num_chans traces of nverts values
+    int size;           // values allocated
+    int nverts, vpp;    // values per trace, and per x-value
+    int chans;          // traces, only fewer than num_chans in a benchmark
+    unsigned int vers[MAX_CHANS];   // trace versions (mod counts)
+    uint64_t t_in;      // time the data arrived, nsec
+    int kind;           // view: values, phosphor image, spectra or roll
+    float *img, max;    // phosphor image, and its largest value
+    int img_size, cols, rows;   // image size, or roll columns in the ring
+    unsigned int first; // roll: first of the nverts/2 new columns
+} STAGE;
+
+// Triple buffering: ingest fills the back buffer, then swaps it with the
+// middle one. The render thread swaps the middle one with the front one,
+// if it is new. Data swapped out before render took it is dropped.
+STAGE stages[NUM_STAGES];
+atomic_int stage_mid=1;
+int stage_back=2, stage_front=0, stage_shown=1;
+atomic_uint stage_drops;
+unsigned int stage_taken, drops_last, lat_n;
+uint64_t lat_sum, lat_max;
+pthread_t ingest_thread;
+
 // Structure for a 3D point
 typedef struct {
     GLfloat x;
@@ -89,19 +248,23 @@ typedef struct {
     GLfloat z;
 } POINT;
 
-// Structure for a trace
+// Structure for a trace, the grid has points, channels 16-bit values.
+// mod counts the changes, so copies of the values can be checked.
 typedef struct {
-    int np, mod;
+    int np;
+    unsigned int mod;
     POINT *pts;
+    GLushort *vals;
 } TRACE;
 
 // Traces (grid plus channels)
 TRACE traces[MAX_TRACES];
 int num_chans=NUM_CHANS;
 
-// Buffer for FIFO text, and shader compiler messages
+// Buffer for shader compiler messages
 char txtbuff[20000];
-// Buffer for floating-point FIFO values
+// FIFO text parser, and floating-point values of a line
+struct csv_reader fifo_csv;
 float fifo_vals[MAX_VALS];
 
 // Macros for GLSL strings
@@ -153,23 +316,131 @@ char vert_shader[] =
     SL("    f_color = zen && zint<MAX_TRACES ? u_colours[zint] : vec4(0, 0, 0, 0);")
     SL("};");
 
-int add_vertex_data(void);
-void update_polyline(TRACE *tp, float *vals, int np);
+// GLSL vertex shader for traces, each channel drawn as an instance.
+// The 16-bit values are in a texture, u_rows rows for each trace.
+// Vertex n has value n + u_start, wrapping at u_ring for a ring of
+// columns. There are u_vpp values for each x-value, 2 for a min/max
+// envelope, u_xn x-values across the plot, and the first is u_xoff.
+char trace_vert_shader[] =
+#if USE_ES
+    SL("#version 300 es")
+    SL("precision highp float;")
+    SL("flat out vec4 f_color;")
+#else
+    SL("#version 140")
+    SL("out vec4 f_color;")
+#endif
+    SL_DEF(MAX_TRACES)
+    SL_DEF(TRACE1_CHAN)
+    SL_DEF(NORM_XMIN)
+    SL_DEF(NORM_XMAX)
+    SL("uniform highp usampler2D u_vals;")
+    SL("uniform highp int u_start;")
+    SL("uniform highp int u_ring;")
+    SL("uniform highp int u_rows;")
+    SL("uniform highp int u_vpp;")
+    SL("uniform highp int u_xn;")
+    SL("uniform highp int u_xoff;")
+    SL("uniform vec4 u_colours[MAX_TRACES];")
+    SL("uniform vec2 u_scoffs[MAX_TRACES];")
+    SL("void main(void) {")
+    SL("    highp int trace = TRACE1_CHAN + gl_InstanceID;")
+    SL("    highp int n = gl_VertexID + u_start;")
+    SL("    highp int w = textureSize(u_vals, 0).x;")
+    SL("    n = u_ring > 0 ? n % u_ring : n;")
+    SL("    highp uint v = texelFetch(u_vals, ivec2(n % w, gl_InstanceID*u_rows + n / w), 0).r;")
+    SL("    vec2 scoff = u_scoffs[trace];")
+    SL("    float x = NORM_XMIN + (NORM_XMAX-NORM_XMIN) * float(gl_VertexID / u_vpp + u_xoff) /")
+    SL("              float(max(u_xn, 1));")
+    SL("    gl_Position = vec4(x, float(v)*scoff.x + scoff.y, 0, 1);")
+    SL("    f_color = u_colours[trace];")
+    SL("}");
+
+// GLSL vertex shader for images: a quad over the plot area, between
+// y-values u_yrange, with f_pos going from 0 to 1 over it
+char quad_vert_shader[] =
+#if USE_ES
+    SL("#version 300 es")
+#else
+    SL("#version 130")
+#endif
+    SL("uniform vec2 u_yrange;")
+    SL("out vec2 f_pos;")
+    SL("void main(void) {")
+    SL("    vec2 p = vec2(gl_VertexID & 1, gl_VertexID >> 1);")
+    SL("    f_pos = p;")
+    SL("    gl_Position = vec4(p.x * 2.0 - 1.0, mix(u_yrange.x, u_yrange.y, p.y), 0, 1);")
+    SL("}");
+
+// Start of GLSL fragment shaders for images
+#if USE_ES
+#define SL_IMAGE_FRAG SL("#version 300 es") SL("precision highp float;") \
+                      SL("in vec2 f_pos;") SL("layout(location = 0) out vec4 fragColor;")
+#else
+#define SL_IMAGE_FRAG SL("#version 130") SL("in vec2 f_pos;") SL("out vec4 fragColor;")
+#endif
+
+// GLSL colour map, blue through green to red for intensity 0 to 1
+#define SL_COLOUR_MAP SL("vec3 colour_map(float i) {") \
+    SL("    return clamp(1.5 - abs(4.0*i - vec3(3, 2, 1)), 0.0, 1.0);") SL("}")
+
+// GLSL fragment shader for the phosphor image: hit counts shown on a
+// log scale, pixels with no hits let the grid show through
+char phos_frag_shader[] =
+    SL_IMAGE_FRAG
+    SL_DEF(PHOS_MIN)
+    SL("uniform highp sampler2D u_img;")
+    SL("uniform float u_gain;")
+    SL_COLOUR_MAP
+    SL("void main(void) {")
+    SL("    float a = texture(u_img, f_pos).r;")
+    SL("    fragColor = vec4(colour_map(clamp(log(1.0 + a) * u_gain, 0.0, 1.0)),")
+    SL("                     a >= PHOS_MIN ? 1.0 : 0.0);")
+    SL("}");
+
+// GLSL fragment shader for the waterfall: u_lines rows of spectra for
+// each channel, written in turn, u_row the newest. Each channel has a
+// band, like the traces, with the newest line at its top.
+char wf_frag_shader[] =
+    SL_IMAGE_FRAG
+    SL("uniform highp usampler2D u_wf;")
+    SL("uniform highp int u_chans;")
+    SL("uniform highp int u_lines;")
+    SL("uniform highp int u_row;")
+    SL_COLOUR_MAP
+    SL("void main(void) {")
+    SL("    highp int c = min(int(f_pos.y * float(u_chans)), u_chans - 1);")
+    SL("    highp int age = int((1.0 - fract(f_pos.y * float(u_chans))) * float(u_lines));")
+    SL("    highp int row = c*u_lines + (u_row - min(age, u_lines-1) + u_lines) % u_lines;")
+    SL("    highp int bins = textureSize(u_wf, 0).x;")
+    SL("    highp int col = min(int(f_pos.x * float(bins)), bins - 1);")
+    SL("    highp uint v = texelFetch(u_wf, ivec2(col, row), 0).r;")
+    SL("    fragColor = vec4(colour_map(float(v) / 65535.0), 1);")
+    SL("}");
+
+int add_vertex_data(STAGE *sp);
+int add_phos_texture(STAGE *sp);
+int add_waterfall_line(STAGE *sp);
+int add_roll_columns(STAGE *sp);
+int resize_traces(int nvals);
+int trace_verts(void);
+void update_trace(TRACE *tp, float *vals, int np);
 int is_fifo(char *fname);
+int ring_attach(void);
+void ring_detach(void);
 void do_graph(void);
+uint64_t now_ns(void);
 
 int main(int argc, char *argv[])
 {
+    int chans_set=0;
+
     printf("RPi streaming display v" VERSION "\n");
-    glutInit(&argc, argv);
-    if (!is_fifo(FIFO) || (fifo_fd = open(FIFO, O_RDONLY)) == -1 ||
-            fcntl(fifo_fd, F_SETFL, O_NONBLOCK) == -1)
-        printf("Can't open %s\n", FIFO);
-    else
-    {
-        printf("Reading FIFO %s\n", FIFO);
-        use_fifo = 1;
-    }
+    // GLUT needs a display, so isn't used when drawing offscreen
+    for (int i=1; i<argc; i++)
+        offscreen |= argv[i][0] == '-' && toupper((int)argv[i][1]) == 'O';
+    if (!offscreen)
+        glutInit(&argc, argv);
     while (argc > ++args)               // Process command-line args
     {
         if (argv[args][0] == '-')
@@ -181,18 +452,64 @@ int main(int argc, char *argv[])
                     fprintf(stderr, "Error: no input chan count\n");
                 else
                     num_chans = atoi(argv[++args]);
+                if (num_chans < 1 || num_chans > MAX_CHANS)
+                {
+                    fprintf(stderr, "Error: 1 to %u input chans\n", MAX_CHANS);
+                    num_chans = NUM_CHANS;
+                }
+                chans_set = 1;
+                break;
+            case 'B':                   // -B: benchmark FPS against values per frame
+                bench = 1;
+                break;
+            case 'D':                   // -D: digital phosphor, decay msec (0 to keep)
+                if (args>=argc-1 || !isdigit((int)argv[args+1][0]))
+                    fprintf(stderr, "Error: no decay time\n");
+                else
+                    phos_tau = atof(argv[++args]) / 1000;
+                view = VIEW_PHOS;
+                break;
+            case 'F':                   // -F: spectrum, with FFT size
+                if (args>=argc-1 || !isdigit((int)argv[args+1][0]))
+                    fprintf(stderr, "Error: no FFT size\n");
+                else
+                    spec_size = atoi(argv[++args]);
+                if (spec_size < FFT_MIN_SIZE || spec_size > FFT_MAX_SIZE ||
+                    (spec_size & (spec_size - 1)))
+                {
+                    fprintf(stderr, "Error: FFT size power of 2, %u to %u\n",
+                            FFT_MIN_SIZE, FFT_MAX_SIZE);
+                    spec_size = SPEC_SIZE;
+                }
+                view = VIEW_SPEC;
+                break;
+            case 'O':                   // -O: offscreen, frames to draw (0 with -B: whole benchmark)
+                if (args>=argc-1 || !isdigit((int)argv[args+1][0]))
+                    fprintf(stderr, "Error: no frame count\n");
+                else
+                    off_frames = atoi(argv[++args]);
                 break;
             case 'N':                   // -N: number of values per block
                 if (args>=argc-1 || !isdigit((int)argv[args+1][0]) ||
                     (num_vals = atoi(argv[++args])) < 1)
                     fprintf(stderr, "Error: no sample count\n");
-                else if (num_vals > MAX_VALS)
+                else if (num_vals > MAX_RING_VALS)
                 {
-                    fprintf(stderr, "Error: maximum sample count %u\n", MAX_VALS);
-                    num_vals = MAX_VALS;
+                    fprintf(stderr, "Error: maximum sample count %u\n", MAX_RING_VALS);
+                    num_vals = MAX_RING_VALS;
                 }
                 break;
-            case 'S':                   // -S: stream from named pipe (FIFO)
+            case 'R':                   // -R: roll mode, secs across the plot
+                if (args>=argc-1 || !isdigit((int)argv[args+1][0]))
+                    fprintf(stderr, "Error: no roll time\n");
+                else if ((roll_secs = atof(argv[++args])) <= 0)
+                {
+                    fprintf(stderr, "Error: invalid roll time\n");
+                    roll_secs = ROLL_SECS;
+                }
+                view = VIEW_ROLL;
+                break;
+            case 'S':                   // -S: text from named pipe (FIFO)
                 if (args>=argc-1 || !argv[args+1][0])
                     fprintf(stderr, "Error: no FIFO name\n");
                 else
@@ -201,6 +518,12 @@ int main(int argc, char *argv[])
             case 'V':                   // -V: verbose mode (display hex data)
                 verbose = 1;
                 break;
+            case 'W':                   // -W: write the last offscreen image (PPM)
+                if (args>=argc-1 || !argv[args+1][0])
+                    fprintf(stderr, "Error: no image file name\n");
+                else
+                    img_name = argv[++args];
+                break;
             case 'Y':                   // -Y: max y-value for each chan
                 if (args>=argc-1 || !isdigit((int)argv[args+1][0]))
                     fprintf(stderr, "Error: no max y-value\n");
@@ -216,83 +539,841 @@ int main(int argc, char *argv[])
             }
         }
     }
+    // Only the benchmark ends by itself, so it needs no frame count
+    if (offscreen && off_frames < 1 && !bench)
+    {
+        fprintf(stderr, "Error: offscreen frame count must be 1 or more, or use -B\n");
+        exit(1);
+    }
+    if (bench)
+        printf("Benchmark, %u channels\n", num_chans);
+    else if (fifo_name)
+    {
+        if (!is_fifo(fifo_name) || (fifo_fd = open(fifo_name, O_RDONLY)) == -1 ||
+                fcntl(fifo_fd, F_SETFL, O_NONBLOCK) == -1)
+            printf("Can't open %s\n", fifo_name);
+        else
+        {
+            printf("Reading FIFO %s\n", fifo_name);
+            csv_init(&fifo_csv);
+            use_fifo = 1;
+        }
+        if (num_vals > MAX_VALS)
+        {
+            fprintf(stderr, "Error: maximum FIFO sample count %u\n", MAX_VALS);
+            num_vals = MAX_VALS;
+        }
+    }
+    else if (ring_attach() == 0)
+    {
+        printf("Reading ring %s: %u ADC x %u channels\n", SHM_NAME,
+               ring->info.ndevs, ring->info.nchans);
+        if (!chans_set)
+            num_chans = ring_words < MAX_CHANS ? ring_words : MAX_CHANS;
+    }
+    else if (offscreen)
+    {
+        printf("Synthetic data, %u channels\n", num_chans);
+        synth = 1;
+    }
+    else
+        printf("Waiting for ring %s\n", SHM_NAME);
+    val_lsb = use_fifo ? FIFO_LSB : ADC_VOLTAGE(1.0);
+    if (bench)
+        num_vals = BENCH_MIN_VALS;
+    // Single-buffered, so the display refresh doesn't cap the rate
+    if (bench || offscreen)
+        glut_mode = GLUT_SINGLE;
     chan_vals = num_vals / num_chans;
     do_graph();
 }
 
-// Read in comma or space-delimited floating-point values
+// Read a line of comma or space-delimited floating-point values
 int fifo_read(float *vals, int maxvals)
 {
-    int i, n, nvals=0, done=0;
-    char *s;
+    int i, nvals=csv_read_line(&fifo_csv, fifo_fd, vals, maxvals);
+
+    if (nvals <= 0)
+        return(0);
+    if (verbose)
+    {
+        for (i=0; i<nvals; i++)
+            printf("%1.3f ", vals[i]);
+        printf("\n");
+    }
+    return(nvals);
+}
 
-    while (!done && (n = read(fifo_fd, &txtbuff[fifo_in], sizeof(txtbuff)-fifo_in-1)) > 0)
+// Map the ring read-only, if the producer has created it
+int ring_attach(void)
+{
+    int fd;
+
+    // Probe first, shmem_open_ro() complains about a missing ring
+    if ((fd = shm_open(SHM_NAME, O_RDONLY, 0)) < 0)
+        return(-1);
+    close(fd);
+    if (shmem_open_ro(SHM_NAME, SHM_SIZE, &shm_info) != 0)
+        return(-1);
+    ring = shm_info.buff;
+    // The producer sets the stream info just after creating the ring
+    if (!ring_is_ok(ring) || (ring_words = ADC_FRAME_WORDS(&ring->info)) == 0)
     {
-        txtbuff[fifo_in + n] = 0;
-        if ((s=strchr(&txtbuff[fifo_in], '\n')) != 0)
+        ring_detach();
+        return(-1);
+    }
+    ring_windex = atomic_load_explicit(&ring->windex, memory_order_acquire);
+    ring_stalled = 0;
+    return(0);
+}
+
+// Unmap the ring, when the producer has gone
+void ring_detach(void)
+{
+    shmem_close(&shm_info);
+    free((void *)shm_info.name);
+    memset(&shm_info, 0, sizeof(shm_info));
+    ring = 0;
+}
+
+// Check if the ring mapped is no longer the one the producer has
+int ring_gone(void)
+{
+    struct stat st, cur;
+    int fd, gone;
+
+    if ((fd = shm_open(SHM_NAME, O_RDONLY, 0)) < 0)
+        return(1);
+    gone = fstat(fd, &st) || fstat(shm_info.fd, &cur) || st.st_ino != cur.st_ino;
+    close(fd);
+    return(gone || !ring_is_ok(ring));
+}
+
+// Copy the newest blocks from the ring without consuming them,
+// converting the raw samples straight into the trace values
+int ring_peek(void)
+{
+    unsigned int w, fpb, nblks, b, f0, nf, np, n=0;
+    int c;
+
+    w = atomic_load_explicit(&ring->windex, memory_order_acquire);
+    if (w == ring_windex)
+        return(0);
+    ring_stalled = 0;
+    np = chan_vals;
+    fpb = MAX_SAMPS / ring_words;
+    nblks = (np + fpb - 1) / fpb;
+    if (nblks > NUM_DATA_CHUNKS / 2)
+        nblks = NUM_DATA_CHUNKS / 2;
+    if (nblks > w)
+        nblks = w;
+    if (np > nblks * fpb)
+        np = nblks * fpb;
+    if (!np)
+        return(0);
+    // The newest values end the trace, any older part is cleared
+    n = chan_vals - np;
+    for (c=0; c<num_chans && c<ring_words && n; c++)
+        memset(traces[TRACE1_CHAN+c].vals, 0, n * sizeof(GLushort));
+    for (b=w-nblks; b!=w; b++)
+    {
+        // Only fails if the writer wrapped round, try again next time
+        if (ring_copy_samples(ring, (uint64_t)b * MAX_SAMPS, ring_block, fpb * ring_words))
+            return(0);
+        // Skip the oldest frames of the first block
+        f0 = b == w - nblks ? nblks * fpb - np : 0;
+        nf = fpb - f0;
+        for (c=0; c<num_chans && c<ring_words; c++)
+            adc_raw_to_i16((int16_t *)&traces[TRACE1_CHAN+c].vals[n],
+                           &ring_block[f0 * ring_words + c], nf, ring_words);
+        n += nf;
+        if (verbose)
+            printf("Block %u: %04x\n", b, ADC_RAW2CODE(ring_block[0]));
+    }
+    for (c=0; c<num_chans && c<ring_words; c++)
+        traces[TRACE1_CHAN+c].mod++;
+    ring_windex = w;
+    return(n);
+}
+
+// Start the phosphor image again, empty
+void phos_reset(uint64_t t)
+{
+    if (phos_img)
+        memset(phos_img, 0, phos_cols * phos_rows * sizeof(float));
+    phos_pos = phos_new = 0;
+    phos_max = 0;
+    phos_t = t;
+}
+
+// Add a sweep of each trace to the phosphor image, in the trace's
+// place on the plot. The image is re-created if the plot was resized.
+void phos_add_traces(uint64_t t)
+{
+    int c, cols=env_cols, rows=plot_rows;
+    float scale, off;
+
+    if (cols != phos_cols || rows != phos_rows)
+    {
+        free(phos_img);
+        phos_img = cols > 0 && rows > 0 ? (float *)calloc(cols * rows, sizeof(float)) : 0;
+        phos_cols = phos_img ? cols : 0;
+        phos_rows = phos_img ? rows : 0;
+        phos_reset(t);
+    }
+    if (!phos_img)
+        return;
+    for (c=0; c<num_chans; c++)
+    {
+        // Normalised y-value to image row
+        scale = trace_scoffs[TRACE1_CHAN+c][0] * rows / (NORM_YMAX-NORM_YMIN);
+        off = (trace_scoffs[TRACE1_CHAN+c][1] - NORM_YMIN) * rows / (NORM_YMAX-NORM_YMIN);
+        phos_sweep(phos_img, cols, rows, traces[TRACE1_CHAN+c].vals, chan_vals, scale, off);
+        traces[TRACE1_CHAN+c].mod++;
+    }
+    if (!phos_new)
+        phos_t_in = t;
+    phos_new = 1;
+}
+
+// Convert every new block from the ring, filling the traces a sweep at
+// a time, and adding each sweep to the phosphor image when it is full
+int ring_sweep(uint64_t t)
+{
+    unsigned int w, fpb, b, f, nf, n=0;
+    int c;
+
+    w = atomic_load_explicit(&ring->windex, memory_order_acquire);
+    if (w == ring_windex)
+        return(0);
+    ring_stalled = 0;
+    fpb = MAX_SAMPS / ring_words;
+    // If too far behind, skip to blocks the writer won't overwrite yet
+    if (w - ring_windex > NUM_DATA_CHUNKS / 2)
+        ring_windex = w - NUM_DATA_CHUNKS / 2;
+    for (b=ring_windex; b!=w; b++)
+    {
+        if (ring_copy_samples(ring, (uint64_t)b * MAX_SAMPS, ring_block, fpb * ring_words))
+            continue;
+        for (f=0; f<fpb; f+=nf)
         {
-            s = txtbuff;
-            while (!done && (i = strcspn(s, " ,\t\r\n")) > 0 && nvals < maxvals)
+            nf = chan_vals - phos_pos < fpb - f ? chan_vals - phos_pos : fpb - f;
+            for (c=0; c<num_chans && c<ring_words; c++)
+                adc_raw_to_i16((int16_t *)&traces[TRACE1_CHAN+c].vals[phos_pos],
+                               &ring_block[f * ring_words + c], nf, ring_words);
+            if ((phos_pos += nf) == chan_vals)
             {
-                if (!discard)
-                    vals[nvals++] = atof(s);
-                s += i;
-                if (*s == '\n')
-                {
-                    if ((i=strlen(s+1)) > 0)
-                    {
-                        strcpy(txtbuff, s+1);
-                        fifo_in = i;
-                    }
-                    else
-                        fifo_in = 0;
-                    done = 1;
-                }
-                else while (*s==',' || *s==' ' || *s=='\t' || *s=='\r')
-                    s++;
+                phos_add_traces(t);
+                phos_pos = 0;
             }
-            discard = 0;
         }
-        else if ((fifo_in += n) >= sizeof(txtbuff)-2)
+        n += fpb;
+    }
+    ring_windex = w;
+    return(n);
+}
+
+// Fade the phosphor image, and hand a copy over to the render thread,
+// only when it has taken the last one, so no sweep is ever dropped
+int phos_publish(uint64_t t)
+{
+    STAGE *sp = &stages[stage_back];
+    int old, n=phos_cols * phos_rows;
+
+    if (!phos_img || (atomic_load(&stage_mid) & STAGE_NEW) ||
+        (!phos_new && (phos_tau == 0 || phos_max < PHOS_MIN)))
+        return(0);
+    phos_max = phos_decay(phos_img, n, (t - phos_t) / 1e9, phos_tau);
+    phos_t = t;
+    if (sp->img_size < n)
+    {
+        free(sp->img);
+        if (!(sp->img = (float *)malloc(n * sizeof(float))))
+        {
+            sp->img_size = 0;
+            return(0);
+        }
+        sp->img_size = n;
+    }
+    memcpy(sp->img, phos_img, n * sizeof(float));
+    sp->cols = phos_cols;
+    sp->rows = phos_rows;
+    sp->max = phos_max;
+    sp->kind = VIEW_PHOS;
+    sp->t_in = phos_new ? phos_t_in : t;
+    phos_new = 0;
+    old = atomic_exchange(&stage_mid, stage_back | STAGE_NEW);
+    stage_back = old & ~STAGE_NEW;
+    return(1);
+}
+
+// Set up the spectrum averaging for each channel, once
+int spec_init(void)
+{
+    int c;
+
+    if (spec_chans)
+        return(1);
+    if (!(spec_vals = (GLushort *)calloc(num_chans * spec_size / 2, sizeof(GLushort))))
+        return(0);
+    for (c=0; c<num_chans; c++)
+    {
+        if (welch_init(&spec_welch[c], spec_size) != 0)
         {
-            discard = 1;
-            fifo_in = nvals = 0;
+            while (c--)
+                welch_free(&spec_welch[c]);
+            free(spec_vals);
+            spec_vals = 0;
+            return(0);
         }
-        if (verbose && nvals)
+    }
+    spec_chans = num_chans;
+    return(1);
+}
+
+// Discard the spectra averaged so far
+void spec_reset(uint64_t t)
+{
+    int c;
+
+    for (c=0; c<spec_chans; c++)
+        welch_read(&spec_welch[c], spec_db);
+    spec_new = 0;
+    spec_t = t;
+}
+
+// Convert every new block from the ring, and add each channel to its
+// spectrum. As with the sweeps, if too far behind, skip to blocks the
+// writer won't overwrite yet, so the latency stays bounded.
+int ring_spectrum(uint64_t t)
+{
+    unsigned int w, fpb, b, n=0;
+    int c;
+
+    w = atomic_load_explicit(&ring->windex, memory_order_acquire);
+    if (w == ring_windex || !spec_init())
+        return(0);
+    ring_stalled = 0;
+    fpb = MAX_SAMPS / ring_words;
+    if (w - ring_windex > NUM_DATA_CHUNKS / 2)
+        ring_windex = w - NUM_DATA_CHUNKS / 2;
+    for (b=ring_windex; b!=w; b++)
+    {
+        if (ring_copy_samples(ring, (uint64_t)b * MAX_SAMPS, ring_block, fpb * ring_words))
+            continue;
+        for (c=0; c<num_chans && c<ring_words; c++)
         {
-            for (i=0; i<nvals; i++)
-                printf("%1.3f ", vals[i]);
-            printf("\n");
+            adc_raw_to_i16(blk_codes, &ring_block[c], fpb, ring_words);
+            welch_add(&spec_welch[c], blk_codes, fpb);
         }
+        n += fpb;
     }
-    return(nvals);
+    ring_windex = w;
+    if (n && !spec_new)
+    {
+        spec_t_in = t;
+        spec_new = 1;
+    }
+    spec_rate = ring->info.sample_rate;
+    return(n);
 }
 
-// Handler for idle events
-void idle_handler(void)
+// Spectrum value in dB to a 16-bit trace value
+GLushort spec_val(float db)
+{
+    db = (db - SPEC_DB_MIN) / (SPEC_DB_MAX - SPEC_DB_MIN);
+    return(db <= 0 ? 0 : db >= 1 ? 65535 : (GLushort)(db * 65535));
+}
+
+// Every SPEC_LINE_MSEC, hand the spectra over as traces, and a line
+// of the waterfall. As with the phosphor image, only when the render
+// thread has taken the last one; if it is slow, more is averaged.
+int spec_publish(uint64_t t)
+{
+    STAGE *sp = &stages[stage_back];
+    int c, k, old, nbins=spec_size / 2;
+
+    if (!spec_new || t - spec_t < SPEC_LINE_MSEC * 1000000ULL ||
+        (atomic_load(&stage_mid) & STAGE_NEW))
+        return(0);
+    for (c=0; c<num_chans; c++)
+    {
+        // Channels with no new segments keep their last spectrum
+        if (welch_read(&spec_welch[c], spec_db))
+            for (k=0; k<nbins; k++)
+                spec_vals[c * nbins + k] = spec_val(spec_db[k]);
+    }
+    if (sp->size < num_chans * nbins)
+    {
+        free(sp->vals);
+        if (!(sp->vals = (GLushort *)malloc(num_chans * nbins * sizeof(GLushort))))
+        {
+            sp->size = 0;
+            return(0);
+        }
+        sp->size = num_chans * nbins;
+    }
+    memcpy(sp->vals, spec_vals, num_chans * nbins * sizeof(GLushort));
+    // New versions, so the vertex buffer regions are all rewritten
+    for (c=0; c<num_chans; c++)
+        sp->vers[c] = ++traces[TRACE1_CHAN+c].mod;
+    sp->nverts = nbins;
+    sp->vpp = 1;
+    sp->chans = num_chans;
+    sp->kind = VIEW_SPEC;
+    sp->t_in = spec_t_in;
+    spec_new = 0;
+    spec_t = t;
+    old = atomic_exchange(&stage_mid, stage_back | STAGE_NEW);
+    stage_back = old & ~STAGE_NEW;
+    return(1);
+}
+
+// Start the roll again, with no columns
+void roll_reset(void)
+{
+    for (int c=0; c<MAX_CHANS; c++)
+    {
+        roll_lo[c] = UINT16_MAX;
+        roll_hi[c] = 0;
+    }
+    roll_head = roll_pub = roll_n = 0;
+}
+
+// Set up the roll with a column per pixel, each covering roll_secs over
+// the plot width. Even, so a column's place in the ring has the parity
+// of its number. Started again if the plot width or sample rate changed.
+int roll_init(void)
+{
+    int cols=env_cols & ~1, frames;
+
+    if (cols < 2)
+        return(0);
+    frames = ring->info.sample_rate * roll_secs / cols + 0.5;
+    frames = frames < 1 ? 1 : frames;
+    if (cols != roll_cols)
+    {
+        free(roll_vals);
+        if (!(roll_vals = (GLushort *)malloc(num_chans * cols * 2 * sizeof(GLushort))))
+        {
+            roll_cols = 0;
+            return(0);
+        }
+        roll_cols = cols;
+        roll_reset();
+    }
+    if (frames != roll_frames)
+    {
+        roll_frames = frames;
+        roll_reset();
+    }
+    return(1);
+}
+
+// Finish a roll column for each channel, as min then max, or max then
+// min on odd columns, so a line strip joins the spans
+void roll_column(uint64_t t)
+{
+    int c;
+    GLushort *p;
+
+    for (c=0; c<num_chans; c++)
+    {
+        if (roll_head)
+        {
+            roll_lo[c] = roll_join[c] < roll_lo[c] ? roll_join[c] : roll_lo[c];
+            roll_hi[c] = roll_join[c] > roll_hi[c] ? roll_join[c] : roll_hi[c];
+        }
+        p = &roll_vals[(c * roll_cols + roll_head % roll_cols) * 2];
+        p[roll_head & 1] = roll_lo[c];
+        p[~roll_head & 1] = roll_hi[c];
+        roll_lo[c] = UINT16_MAX;
+        roll_hi[c] = 0;
+    }
+    if (roll_head == roll_pub)
+        roll_t_in = t;
+    roll_head++;
+    roll_n = 0;
+}
+
+// Convert every new block from the ring, and reduce it to roll columns.
+// As with the sweeps, if too far behind, skip to blocks the writer won't
+// overwrite yet, so the latency stays bounded.
+int ring_roll(uint64_t t)
+{
+    unsigned int w, fpb, b, f, nf, n=0;
+    uint16_t lo, hi;
+    int c;
+
+    w = atomic_load_explicit(&ring->windex, memory_order_acquire);
+    if (w == ring_windex || !roll_init())
+        return(0);
+    ring_stalled = 0;
+    fpb = MAX_SAMPS / ring_words;
+    if (w - ring_windex > NUM_DATA_CHUNKS / 2)
+        ring_windex = w - NUM_DATA_CHUNKS / 2;
+    for (b=ring_windex; b!=w; b++)
+    {
+        if (ring_copy_samples(ring, (uint64_t)b * MAX_SAMPS, ring_block, fpb * ring_words))
+            continue;
+        for (c=0; c<num_chans && c<ring_words; c++)
+            adc_raw_to_i16(&blk_codes[c * fpb], &ring_block[c], fpb, ring_words);
+        for (f=0; f<fpb; f+=nf)
+        {
+            nf = roll_frames - roll_n < fpb - f ? roll_frames - roll_n : fpb - f;
+            for (c=0; c<num_chans && c<ring_words; c++)
+            {
+                simd_minmax_u16((uint16_t *)&blk_codes[c * fpb + f], nf, &lo, &hi);
+                roll_lo[c] = lo < roll_lo[c] ? lo : roll_lo[c];
+                roll_hi[c] = hi > roll_hi[c] ? hi : roll_hi[c];
+                roll_join[c] = blk_codes[c * fpb + f + nf - 1];
+            }
+            if ((roll_n += nf) == roll_frames)
+                roll_column(t);
+        }
+        n += fpb;
+    }
+    ring_windex = w;
+    return(n);
+}
+
+// Hand the columns done since the last time over to the render thread,
+// only when it has taken the last ones, so it just uploads new columns.
+// If it has fallen a whole plot width behind, the older ones are skipped.
+int roll_publish(uint64_t t)
+{
+    STAGE *sp = &stages[stage_back];
+    int c, j, old, n=roll_head - roll_pub;
+
+    if (!n || (atomic_load(&stage_mid) & STAGE_NEW))
+        return(0);
+    if (n > roll_cols)
+    {
+        roll_pub = roll_head - roll_cols;
+        n = roll_cols;
+    }
+    if (sp->size < num_chans * n * 2)
+    {
+        free(sp->vals);
+        if (!(sp->vals = (GLushort *)malloc(num_chans * roll_cols * 2 * sizeof(GLushort))))
+        {
+            sp->size = 0;
+            return(0);
+        }
+        sp->size = num_chans * roll_cols * 2;
+    }
+    for (c=0; c<num_chans; c++)
+    {
+        for (j=0; j<n; j++)
+            memcpy(&sp->vals[(c * n + j) * 2],
+                   &roll_vals[(c * roll_cols + (roll_pub + j) % roll_cols) * 2],
+                   2 * sizeof(GLushort));
+    }
+    sp->first = roll_pub;
+    sp->nverts = n * 2;
+    sp->cols = roll_cols;
+    sp->kind = VIEW_ROLL;
+    sp->t_in = roll_t_in;
+    roll_pub = roll_head;
+    old = atomic_exchange(&stage_mid, stage_back | STAGE_NEW);
+    stage_back = old & ~STAGE_NEW;
+    return(1);
+}
+
+// Monotonic time in nanoseconds
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+// Create the synthetic data, once: a sine with noise, and a one-sample
+// glitch the envelope shouldn't lose. It is the same every run.
+int synth_init(void)
+{
+    int i;
+
+    if (bench_data)
+        return(1);
+    if (!(bench_data = (GLushort *)malloc((MAX_RING_VALS + BENCH_SHIFT) * sizeof(GLushort))))
+        return(0);
+    for (i=0; i<MAX_RING_VALS + BENCH_SHIFT; i++)
+        bench_data[i] = 1024 + 800 * sin(i * 2 * M_PI / 5000) + rand() % 64 +
+                        (i % 100003 == 0 ? 200 : 0);
+    return(1);
+}
+
+// Fill the traces of chans channels with synthetic data, moved along
+// for each frame
+int synth_fill(unsigned int frame, int chans)
+{
+    int c, off=(frame * 997) % BENCH_SHIFT;
+
+    for (c=0; c<chans; c++)
+    {
+        memcpy(traces[TRACE1_CHAN+c].vals, &bench_data[off + c * chan_vals / chans],
+               chan_vals * sizeof(GLushort));
+        traces[TRACE1_CHAN+c].mod++;
+    }
+    return(chan_vals);
+}
+
+// Benchmark step: new values for every frame. Each count of values is
+// drawn as a polyline, then as an envelope if wider than the window,
+// shared between 1 channel, then 2, 4.. up to num_chans.
+int bench_step(void)
+{
+    uint64_t t=now_ns();
+    unsigned int frames=bench_frames;
+
+    if (bench_warm)
+    {
+        // Frames of the previous count have been drawn, start timing
+        bench_start = t;
+        bench_frames = frames = bench_warm = 0;
+    }
+    else if (!bench_vals)
+    {
+        if (!synth_init())
+        {
+            bench_done = 1;
+            return(0);
+        }
+        bench_vals = num_vals;
+        bench_chans = 1;
+        resize_traces(bench_vals);
+        env_off = 1;
+        bench_warm = 1;
+    }
+    else if (t - bench_start >= BENCH_SECS * 1000000000ULL)
+    {
+        printf("%2u chans %8u values/frame %-8s %7.1f FPS %8.2f ms/frame\n", bench_chans,
+               bench_vals, trace_verts() == chan_vals ? "polyline" : "envelope",
+               frames * 1e9 / (t - bench_start),
+               frames ? (t - bench_start) / 1e6 / frames : 0.0);
+        if (env_off && chan_vals > env_cols * 2)
+            env_off = 0;
+        else if (bench_vals < MAX_RING_VALS)
+        {
+            bench_vals = bench_vals * 10 < MAX_RING_VALS ? bench_vals * 10 : MAX_RING_VALS;
+            env_off = 1;
+        }
+        else if (bench_chans < num_chans)
+        {
+            bench_chans = bench_chans * 2 < num_chans ? bench_chans * 2 : num_chans;
+            bench_vals = num_vals;
+            env_off = 1;
+        }
+        else
+        {
+            bench_done = 1;
+            return(0);
+        }
+        resize_traces(bench_vals / bench_chans);
+        bench_warm = 1;
+    }
+    return(synth_fill(frames, bench_chans));
+}
+
+// Fill the back staging buffer from the traces, and hand it over
+void stage_publish(uint64_t t_in)
+{
+    STAGE *sp = &stages[stage_back];
+    int c, i, old, ncols=env_cols, nverts=trace_verts(), chans=bench ? bench_chans : num_chans;
+    GLushort *vals, v;
+
+    if (sp->size < num_chans * nverts)
+    {
+        free(sp->vals);
+        if (!(sp->vals = (GLushort *)malloc(num_chans * nverts * sizeof(GLushort))))
+        {
+            sp->size = 0;
+            return;
+        }
+        sp->size = num_chans * nverts;
+        sp->nverts = 0;
+    }
+    for (c=0; c<chans; c++)
+    {
+        // Skip traces this buffer already has
+        if (sp->kind == VIEW_TRACES && sp->nverts == nverts && sp->vals &&
+            sp->vers[c] == traces[TRACE1_CHAN+c].mod &&
+            (nverts == chan_vals || ncols == sp->nverts / 2))
+            continue;
+        sp->vers[c] = traces[TRACE1_CHAN+c].mod;
+        vals = &sp->vals[c * nverts];
+        if (nverts == chan_vals)
+            memcpy(vals, traces[TRACE1_CHAN+c].vals, chan_vals * sizeof(GLushort));
+        else
+        {
+            // Max then min on odd columns, so a line strip
+            // joins the spans, and draws a flat trace
+            env_columns(traces[TRACE1_CHAN+c].vals, chan_vals, ncols, vals);
+            for (i=1; i<ncols; i+=2)
+            {
+                v = vals[i*2];
+                vals[i*2] = vals[i*2+1];
+                vals[i*2+1] = v;
+            }
+        }
+    }
+    sp->nverts = nverts;
+    sp->vpp = nverts == chan_vals ? 1 : 2;
+    sp->chans = chans;
+    sp->t_in = t_in;
+    sp->kind = VIEW_TRACES;
+    old = atomic_exchange(&stage_mid, stage_back | STAGE_NEW);
+    if (old & STAGE_NEW)
+        stage_drops++;
+    stage_back = old & ~STAGE_NEW;
+}
+
+// Take the newest staging buffer, if any, and copy it to the GPU
+int stage_take(void)
+{
+    int old;
+
+    if (!(atomic_load(&stage_mid) & STAGE_NEW))
+        return(0);
+    old = atomic_exchange(&stage_mid, stage_front);
+    stage_front = old & ~STAGE_NEW;
+    stage_shown = 0;
+    stage_taken++;
+    if ((shown = stages[stage_front].kind) == VIEW_PHOS)
+        add_phos_texture(&stages[stage_front]);
+    else if (shown == VIEW_ROLL)
+        add_roll_columns(&stages[stage_front]);
+    else
+        add_vertex_data(&stages[stage_front]);
+    if (shown == VIEW_SPEC)
+        add_waterfall_line(&stages[stage_front]);
+    return(1);
+}
+
+// Re-attach if the producer restarted, or has started
+void ring_check(void)
 {
-    int n, i;
+    if (ring && ring_windex == atomic_load_explicit(&ring->windex, memory_order_relaxed) &&
+        ++ring_stalled > 1 && ring_gone())
+    {
+        printf("Ring %s closed\n", SHM_NAME);
+        ring_detach();
+    }
+    if (!ring && !use_fifo && !bench && !synth && ring_attach() == 0)
+        printf("Reading ring %s\n", SHM_NAME);
+}
+
+// Ingest thread: read, convert and stage the data, so neither a slow
+// read stalls the drawing, nor a slow frame the reading
+void *ingest_main(void *arg)
+{
+    int n, i, last_verts=-1, last_cols=-1, last_mode=VIEW_TRACES, mode;
+    uint64_t t, check=0;
 
-    if (use_fifo && (n = fifo_read(fifo_vals, MAX_VALS)) > 0 && !paused)
+    while (!ingest_stop)
     {
-        for (i=0; i<num_chans; i++)
-            update_polyline(&traces[TRACE1_CHAN+i], fifo_vals+i, n/num_chans);
-        add_vertex_data();
+        n = 0;
+        t = now_ns();
+        mode = bench ? VIEW_TRACES : view;
+        if (mode != last_mode)
+        {
+            // Start with an empty image, spectra or roll, or re-stage
+            // the traces, as new versions as the spectra used theirs
+            phos_reset(t);
+            spec_reset(t);
+            roll_reset();
+            for (i=0; i<num_chans; i++)
+                traces[TRACE1_CHAN+i].mod++;
+            last_mode = mode;
+            last_verts = -1;
+        }
+        if (paused || bench_done)
+            ;
+        else if (bench)
+        {
+            // Only as fast as frames are drawn
+            if (!(atomic_load(&stage_mid) & STAGE_NEW))
+                n = bench_step();
+        }
+        else if (synth)
+        {
+            // The same for every run, so images can be compared
+            if (!(atomic_load(&stage_mid) & STAGE_NEW) && synth_init())
+                n = synth_fill(synth_frames++, num_chans);
+        }
+        else if (use_fifo && (n = fifo_read(fifo_vals, MAX_VALS)) > 0)
+        {
+            for (i=0; i<num_chans; i++)
+                update_trace(&traces[TRACE1_CHAN+i], fifo_vals+i, n/num_chans);
+            // Each line of values is a sweep
+            if (mode == VIEW_PHOS)
+                phos_add_traces(t);
+        }
+        else if (ring)
+            n = mode == VIEW_PHOS ? ring_sweep(t) : mode == VIEW_SPEC ? ring_spectrum(t) :
+                mode == VIEW_ROLL ? ring_roll(t) : ring_peek();
+        if (mode != VIEW_TRACES)
+        {
+            // Keep reading while the render thread has a new image
+            if (!(mode == VIEW_PHOS ? phos_publish(t) : mode == VIEW_SPEC ? spec_publish(t) :
+                  roll_publish(t)) && n <= 0)
+                usleep(INGEST_USEC);
+        }
+        // Re-stage the old data if the window width or envelope changed
+        else if (n > 0 || trace_verts() != last_verts ||
+            (last_verts != chan_vals && env_cols != last_cols))
+        {
+            last_verts = trace_verts();
+            last_cols = env_cols;
+            stage_publish(t);
+        }
+        else
+            usleep(INGEST_USEC);
+        if (t - check >= TIMER_MSEC * 1000000ULL)
+        {
+            ring_check();
+            check = t;
+        }
     }
-    glutPostRedisplay();
+    return(0);
+}
+
+// Handler for idle events
+void idle_handler(void)
+{
+    if (bench_done)
+        glutLeaveMainLoop();
+    else if (stage_take())
+        glutPostRedisplay();
+    else
+        usleep(INGEST_USEC);
 }
 
 // Handler for timer events
 void timer_handler(int value)
 {
-    char temps[50] = "";
+    char temps[150] = "";
+    unsigned int drops=stage_drops, ndrop=drops-drops_last;
 
     if (value)
     {
-        sprintf(temps, "%d FPS, %u x %u", frame_count, win_width, win_height);
+        sprintf(temps, "%d FPS, %u x %u, %u%% dropped, %.1f/%.1f ms latency",
+                frame_count, win_width, win_height,
+                ndrop + stage_taken ? ndrop * 100 / (ndrop + stage_taken) : 0,
+                lat_n ? lat_sum / 1e6 / lat_n : 0.0, lat_max / 1e6);
+        // Spectra have 10 divisions across, 4 in the top half
+        if (shown == VIEW_SPEC)
+            sprintf(&temps[strlen(temps)], ", %g kHz/div, %g dB/div",
+                    spec_rate / 2e3 / 10, (SPEC_DB_MAX - SPEC_DB_MIN) / 4);
+        else if (shown == VIEW_ROLL)
+            sprintf(&temps[strlen(temps)], ", %g s/div", roll_secs / 10);
         glutSetWindowTitle(temps);
     }
-    frame_count = 0;
+    frame_count = stage_taken = lat_n = 0;
+    lat_sum = lat_max = 0;
+    drops_last = drops;
     glutTimerFunc(TIMER_MSEC, timer_handler, 1);
 }
 
@@ -308,7 +1389,7 @@ GLint get_attrib(GLuint prog, const char *name)
 // Get uniform
 GLint get_uniform(GLuint prog, const char *name)
 {
-    GLint uniform = glGetUniformLocation(program, name);
+    GLint uniform = glGetUniformLocation(prog, name);
     if (uniform == -1)
         fprintf(stderr, "Could not bind uniform '%s'\n", name);
     return(uniform);
@@ -400,66 +1481,45 @@ int create_grid(TRACE *tp, int nx, int ny, int z)
         tp->pts = (POINT *)malloc((nx+1+ny+1)*4 * sizeof(POINT));
     if (tp->pts)
         n = draw_grid(tp->pts, nx, ny, z);
-    tp->mod = 1;
+    tp->mod++;
     return(tp->np = n);
 }
 
-// Create polyline data, given trace values
-int create_polyline(TRACE *tp, float xmin, float ymin, float xmax, float ymax, float *vals, int np, int zval)
+// Convert a value in volts to a 16-bit trace value
+GLushort trace_val(float v)
 {
-    int n, start=1;
-    float x, y;
-    POINT *pts;
-
-    tp->np = np + 2;
-    if ((pts = tp->pts = (POINT *)calloc(tp->np, sizeof(POINT))) != 0)
-    {
-        for (n=0; n<np; n++)
-        {
-            x = xmin + (xmax-xmin) * n / (np - 1);
-            y = vals ? *vals++ : 0;
-            if (start)
-                set_point(pts++, x, y, zval);
-            set_point(pts++, x, y, ZEN(zval));
-            start = 0;
-        }
-        set_point(pts++, x, y, 0);
-    }
-    tp->mod = 1;
-    return(pts ? tp->np : 0);
+    v /= val_lsb;
+    return(v <= 0 ? 0 : v >= 65535 ? 65535 : (GLushort)(v + 0.5));
 }
 
-// Update y data in an existing polyline
-void update_polyline(TRACE *tp, float *vals, int np)
+// Create trace data, given values
+int create_trace(TRACE *tp, float *vals, int np)
 {
-    int n, start=1;
-    POINT *pts = tp->pts;
-    float val;
+    int n;
 
-    np = np > tp->np-2 ? tp->np-2 : np;
-    for (n=0; n<np; n++)
+    tp->np = np;
+    if ((tp->vals = (GLushort *)calloc(np, sizeof(GLushort))) != 0)
     {
-        val = vals[n*num_chans];
-        if (start)
-            pts++->y = val;
-        pts++->y = val;
-        start = 0;
+        for (n=0; vals && n<np; n++)
+            tp->vals[n] = trace_val(vals[n]);
     }
-    pts->y = val;
-    tp->mod = 1;
+    tp->mod++;
+    return(tp->vals ? np : 0);
 }
 
-// Create a trace
-int create_trace(TRACE *tp, int idx, float *vals, int np, int zval)
+// Update values in an existing trace
+void update_trace(TRACE *tp, float *vals, int np)
 {
-    float ymin = NORM_YMIN + (NORM_YMAX-NORM_YMIN) * idx / num_chans;
-    float ymax = ymin + (NORM_YMAX-NORM_YMIN) / num_chans;
+    int n;
 
-    return(create_polyline(tp, NORM_XMIN, ymin, NORM_XMAX, ymax, vals, np, zval));
+    np = np > tp->np ? tp->np : np;
+    for (n=0; n<np; n++)
+        tp->vals[n] = trace_val(vals[n*num_chans]);
+    tp->mod++;
 }
 
 // Create the traces, and initialise them with test data
-int create_test_trace(TRACE *tp, int idx, int np, int zval)
+int create_test_trace(TRACE *tp, int np)
 {
     int i, n=0;
     float *vals = (float *)malloc(np * sizeof(float));
@@ -469,13 +1529,26 @@ int create_test_trace(TRACE *tp, int idx, int np, int zval)
         for (i=0; i<np; i++)
             vals[i] = (sin(i / 10.0 - M_PI / 2) + 1) *
                        trace_ymax / (2.0 + i/100.0);
-        n = create_trace(tp, idx, vals, np, zval);
+        n = create_trace(tp, vals, np);
         free(vals);
     }
     return(n);
 }
 
-// Free memory for all traces
+// Recreate the channel traces for a new number of values
+int resize_traces(int nvals)
+{
+    for (int i=0; i<num_chans; i++)
+    {
+        free(traces[TRACE1_CHAN+i].vals);
+        if (!create_trace(&traces[TRACE1_CHAN+i], 0, nvals))
+            return(0);
+    }
+    chan_vals = nvals;
+    return(nvals);
+}
+
+// Free memory for all traces, the phosphor image and spectra
 void free_traces(void)
 {
     int i;
@@ -484,7 +1557,14 @@ void free_traces(void)
     {
         if (traces[i].pts)
             free(traces[i].pts);
+        if (traces[i].vals)
+            free(traces[i].vals);
     }
+    for (i=0; i<spec_chans; i++)
+        welch_free(&spec_welch[i]);
+    free(spec_vals);
+    free(phos_img);
+    free(roll_vals);
 }
 
 // Set up the scale and offset values for the channels
@@ -492,8 +1572,11 @@ void init_scale_offset(float ymax)
 {
     for (int n=0; n<num_chans; n++)
     {
-        trace_scoffs[n+TRACE1_CHAN][0] = (NORM_YMAX-NORM_YMIN) / (ymax*num_chans);
+        trace_scoffs[n+TRACE1_CHAN][0] = (NORM_YMAX-NORM_YMIN) * val_lsb / (ymax*num_chans);
         trace_scoffs[n+TRACE1_CHAN][1] = NORM_YMIN + n * (NORM_YMAX-NORM_YMIN) / num_chans;
+        // Spectra are overlaid, in the top half
+        spec_scoffs[n+TRACE1_CHAN][0] = NORM_YMAX / 65535.0;
+        spec_scoffs[n+TRACE1_CHAN][1] = 0;
     }
 }
 
@@ -503,48 +1586,253 @@ void reshape(int width, int height)
     width = (win_width = width) - X_MARGIN * 2;
     height = (win_height = height) - Y_MARGIN * 2;
     glViewport(X_MARGIN, Y_MARGIN, (GLsizei)width, (GLsizei)height);
+    // One envelope column and phosphor image column per pixel
+    if (width > 0)
+        env_cols = width;
+    if (height > 0)
+        plot_rows = height;
+}
+
+// Vertices for each trace; with more values than pixels, draw
+// a min/max envelope, so the time to draw depends on the window width
+int trace_verts(void)
+{
+    return(!env_off && env_cols && chan_vals > env_cols * 2 ? env_cols * 2 : chan_vals);
 }
 
-// Add trace vertex data to program
-// If vertex buffer doesn't exist, create it
-int add_vertex_data(void)
+// Write n values of trace c to a value texture, w values wide with rows
+// rows for each trace, from value k on. Whole rows are written at once.
+// With an unpack buffer bound, p is the offset of the values in it.
+void tex_write(int w, int rows, int c, int k, int n, const GLushort *p)
 {
-    int i, npts;
+    int x, m;
 
-    if (!vert_buff_alloc)
+    upload_bytes += n * sizeof(GLushort);
+    for (; n > 0; k += m, n -= m, p += m)
+    {
+        if ((x = k % w) == 0 && n >= w)
+        {
+            m = n - n % w;
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, c * rows + k / w, w, m / w,
+                            GL_RED_INTEGER, GL_UNSIGNED_SHORT, p);
+        }
+        else
+        {
+            m = n < w - x ? n : w - x;
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x, c * rows + k / w, m, 1,
+                            GL_RED_INTEGER, GL_UNSIGNED_SHORT, p);
+        }
+    }
+}
+
+// Create a 16-bit value texture for num_chans traces of n values
+void create_val_texture(GLuint tex, int n, int *w, int *rows)
+{
+    *w = n < max_tex_size ? n : max_tex_size;
+    *rows = (n + *w - 1) / *w;
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, *w, *rows * num_chans, 0,
+                 GL_RED_INTEGER, GL_UNSIGNED_SHORT, 0);
+}
+
+// Create the trace upload buffer, with VBO_REGIONS regions of nverts
+// values for each trace, and the value texture they are copied to. If
+// buffer storage is supported, it stays mapped, otherwise each region
+// is mapped unsynchronized when written. Fences make sure the GPU has
+// finished copying a region before it is reused.
+void create_vertex_buffer(int nverts)
+{
+    GLsizeiptr size = VBO_REGIONS * num_chans * nverts * sizeof(GLushort);
+    int i;
+
+    for (i=0; i<VBO_REGIONS; i++)
+    {
+        if (vbo_fences[i])
+            glDeleteSync(vbo_fences[i]);
+        vbo_fences[i] = 0;
+    }
+    if (vbo)
+        glDeleteBuffers(1, &vbo);
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, vbo);
+    vbo_map = 0;
+    if (vbo_persistent)
+    {
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, 0, GL_MAP_WRITE_BIT |
+                        GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+        vbo_map = (GLushort *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT |
+                        GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+    }
+    else
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, 0, GL_STREAM_DRAW);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    create_val_texture(val_tex, nverts, &val_tex_w, &val_tex_rows);
+    memset(val_tex_vers, 0, sizeof(val_tex_vers));
+    vert_buff_alloc = nverts;
+}
+
+// Copy the traces of a staging buffer that changed to the next region
+// of the upload buffer, and from there to the value texture, so all the
+// traces can be drawn at once. If the vertex count changed, re-create it.
+int add_vertex_data(STAGE *sp)
+{
+    int c, r=(vbo_region + 1) % VBO_REGIONS, nverts=sp->nverts;
+    GLintptr offset = r * num_chans * nverts * sizeof(GLushort);
+    unsigned int changed=0;
+    GLushort *p;
+
+    if (vert_buff_alloc != nverts)
+        create_vertex_buffer(nverts);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, vbo);
+    if (vbo_fences[r])
+    {
+        glClientWaitSync(vbo_fences[r], GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_NSEC);
+        glDeleteSync(vbo_fences[r]);
+        vbo_fences[r] = 0;
+    }
+    p = vbo_map ? vbo_map + offset / sizeof(GLushort) :
+        (GLushort *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset,
+                                     num_chans * nverts * sizeof(GLushort),
+                                     GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (!p)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return(0);
+    }
+    for (c=0; c<sp->chans; c++)
+    {
+        if (val_tex_vers[c] == sp->vers[c])
+            continue;
+        memcpy(&p[c * nverts], &sp->vals[c * nverts], nverts * sizeof(GLushort));
+        changed |= 1 << c;
+    }
+    if (!vbo_map)
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindTexture(GL_TEXTURE_2D, val_tex);
+    for (c=0; c<sp->chans; c++)
+    {
+        if (!(changed & (1 << c)))
+            continue;
+        tex_write(val_tex_w, val_tex_rows, c, 0, nverts,
+                  (GLushort *)(offset + c * nverts * sizeof(GLushort)));
+        val_tex_vers[c] = sp->vers[c];
+    }
+    // The region can be written again when the GPU has copied it
+    if (changed)
+        vbo_fences[r] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    vbo_region = r;
+    vert_vpp = sp->vpp;
+    vert_chans = sp->chans;
+    return(num_chans*nverts);
+}
+
+// Copy the phosphor image of a staging buffer to the texture, and set
+// the scale so the largest count is at the top of the colour map
+int add_phos_texture(STAGE *sp)
+{
+    glBindTexture(GL_TEXTURE_2D, phos_tex);
+    if (phos_tex_cols != sp->cols || phos_tex_rows != sp->rows)
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, sp->cols, sp->rows, 0, GL_RED, GL_FLOAT, sp->img);
+        phos_tex_cols = sp->cols;
+        phos_tex_rows = sp->rows;
+    }
+    else
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, sp->cols, sp->rows, GL_RED, GL_FLOAT, sp->img);
+    phos_gain = sp->max > 0 ? 1 / log1pf(sp->max) : 0;
+    upload_bytes += sp->cols * sp->rows * sizeof(float);
+    return(sp->cols * sp->rows);
+}
+
+// Write the spectra of a staging buffer to the next line of the
+// waterfall texture, clearing it first if the number of bins changed
+int add_waterfall_line(STAGE *sp)
+{
+    int c, nbins=sp->nverts;
+    GLushort *zeros;
+
+    glBindTexture(GL_TEXTURE_2D, wf_tex);
+    if (wf_bins != nbins)
     {
-        for(i=npts=0; traces[i].np>0; i++)
-            npts += traces[i].np;
-        glBufferData(GL_ARRAY_BUFFER, npts*sizeof(POINT), 0, GL_STATIC_DRAW);
-        vert_buff_alloc = 1;
+        if (!(zeros = (GLushort *)calloc(nbins * WF_LINES * num_chans, sizeof(GLushort))))
+            return(0);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, nbins, WF_LINES * num_chans, 0,
+                     GL_RED_INTEGER, GL_UNSIGNED_SHORT, zeros);
+        free(zeros);
+        wf_bins = nbins;
     }
-    for(i=npts=0; traces[i].np>0; i++)
+    wf_row = (wf_row + 1) % WF_LINES;
+    for (c=0; c<num_chans; c++)
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, c * WF_LINES + wf_row, nbins, 1,
+                        GL_RED_INTEGER, GL_UNSIGNED_SHORT, &sp->vals[c * nbins]);
+    upload_bytes += num_chans * nbins * sizeof(GLushort);
+    return(nbins);
+}
+
+// Write the new columns of a staging buffer to their places in the roll
+// texture, so only they are uploaded. The texture is a ring of min/max
+// values for each channel, started again with the first column.
+int add_roll_columns(STAGE *sp)
+{
+    int c, j, pos, run, cols=sp->cols, n=sp->nverts / 2;
+
+    glBindTexture(GL_TEXTURE_2D, roll_tex);
+    if (roll_tex_cols != cols || sp->first == 0)
+    {
+        create_val_texture(roll_tex, cols * 2, &roll_tex_w, &roll_tex_rows);
+        roll_tex_cols = cols;
+    }
+    for (j=0; j<n; j+=run)
     {
-        if (traces[i].mod)
-            glBufferSubData(GL_ARRAY_BUFFER, npts*sizeof(POINT),
-                traces[i].np*sizeof(POINT), traces[i].pts);
-        npts += traces[i].np;
+        pos = (sp->first + j) % cols;
+        run = n - j < cols - pos ? n - j : cols - pos;
+        for (c=0; c<num_chans; c++)
+            tex_write(roll_tex_w, roll_tex_rows, c, pos * 2, run * 2,
+                      &sp->vals[(c * n + j) * 2]);
     }
-    return(npts);
+    roll_tex_head = sp->first + n;
+    return(n);
 }
 
 // Initialise graph
 int graph_init()
 {
     program = create_program(vert_shader, frag_shader);
-    if (program == 0)
+    trace_program = create_program(trace_vert_shader, frag_shader);
+    phos_program = create_program(quad_vert_shader, phos_frag_shader);
+    wf_program = create_program(quad_vert_shader, wf_frag_shader);
+    if (program == 0 || trace_program == 0 || phos_program == 0 || wf_program == 0)
         return 0;
     a_coord3d = get_attrib(program, "coord3d");
     u_colours = get_uniform(program, "u_colours");
     u_scoffs = get_uniform(program, "u_scoffs");
-
-    if (a_coord3d == -1 || u_colours == -1 || u_scoffs == -1)
+    u_tstart = get_uniform(trace_program, "u_start");
+    u_tring = get_uniform(trace_program, "u_ring");
+    u_trows = get_uniform(trace_program, "u_rows");
+    u_tvpp = get_uniform(trace_program, "u_vpp");
+    u_txn = get_uniform(trace_program, "u_xn");
+    u_txoff = get_uniform(trace_program, "u_xoff");
+    u_tcolours = get_uniform(trace_program, "u_colours");
+    u_tscoffs = get_uniform(trace_program, "u_scoffs");
+    u_pyrange = get_uniform(phos_program, "u_yrange");
+    u_pgain = get_uniform(phos_program, "u_gain");
+    u_wyrange = get_uniform(wf_program, "u_yrange");
+    u_wchans = get_uniform(wf_program, "u_chans");
+    u_wlines = get_uniform(wf_program, "u_lines");
+    u_wrow = get_uniform(wf_program, "u_row");
+
+    if (a_coord3d == -1 || u_colours == -1 || u_scoffs == -1 ||
+        u_tstart == -1 || u_tring == -1 || u_trows == -1 || u_tvpp == -1 || u_txn == -1 ||
+        u_txoff == -1 || u_tcolours == -1 || u_tscoffs == -1 ||
+        u_pyrange == -1 || u_pgain == -1 ||
+        u_wyrange == -1 || u_wchans == -1 || u_wlines == -1 || u_wrow == -1)
         return(0);
 
     // Draw grid and trace
     create_grid(&traces[0], GRID_DIVS, GRID_CHAN);
     for (int i=0; i<num_chans; i++)
-        create_test_trace(&traces[i+1], i, chan_vals, TRACE1_CHAN+i);
+        create_test_trace(&traces[i+1], chan_vals);
 
     // Line width, and multisample anti-alias
     glLineWidth(LINE_WIDTH);
@@ -554,36 +1842,146 @@ int graph_init()
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    // Create the vertex buffer object
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    // The grid doesn't change, so is only copied once
+    glGenBuffers(1, &grid_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, grid_vbo);
+    glBufferData(GL_ARRAY_BUFFER, traces[0].np*sizeof(POINT), traces[0].pts, GL_STATIC_DRAW);
+
+    // The upload buffer is created when the ingest thread stages values
+    vbo_persistent = GLEW_ARB_buffer_storage;
+    printf("%s upload buffer\n", vbo_persistent ? "Persistent mapped" : "Unsynchronized mapped");
+
+    // Value textures for the traces and roll, rows of 16-bit integers
+    // that can be any width, created when first staged
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_tex_size);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glGenTextures(1, &val_tex);
+    glGenTextures(1, &roll_tex);
+    for (int i=0; i<2; i++)
+    {
+        glBindTexture(GL_TEXTURE_2D, i ? roll_tex : val_tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
 
-    // Copy data into the buffer object
-    nvertices = add_vertex_data();
-    glEnableVertexAttribArray(a_coord3d);
-    glVertexAttribPointer(a_coord3d, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    // Phosphor texture, one texel per pixel, created when first staged
+    glGenTextures(1, &phos_tex);
+    glBindTexture(GL_TEXTURE_2D, phos_tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // Waterfall texture, 16-bit integer, created with the first spectra
+    glGenTextures(1, &wf_tex);
+    glBindTexture(GL_TEXTURE_2D, wf_tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
     init_scale_offset(trace_ymax);
     return(1);
 }
 
+// Draw the traces in the value texture, one instance for each
+void draw_traces(GLfloat scoffs[][2])
+{
+    if (!vert_buff_alloc)
+        return;
+    glUseProgram(trace_program);
+    glUniform1i(u_tstart, 0);
+    glUniform1i(u_tring, 0);
+    glUniform1i(u_trows, val_tex_rows);
+    glUniform1i(u_tvpp, vert_vpp);
+    glUniform1i(u_txn, vert_buff_alloc / vert_vpp - 1);
+    glUniform1i(u_txoff, 0);
+    glUniform4fv(u_tcolours, MAX_TRACES, (GLfloat *)trace_colours);
+    glUniform2fv(u_tscoffs, MAX_TRACES, (GLfloat *)scoffs);
+    glBindTexture(GL_TEXTURE_2D, val_tex);
+    glDrawArraysInstanced(GL_LINE_STRIP, 0, vert_buff_alloc, vert_chans);
+}
+
+// Draw the roll columns, from the oldest on the left. Until the ring
+// is full, the columns so far are on the right.
+void draw_roll(void)
+{
+    int cols=roll_tex_cols, ncols=roll_tex_head < cols ? roll_tex_head : cols;
+
+    if (!ncols)
+        return;
+    glUseProgram(trace_program);
+    glUniform1i(u_tstart, (roll_tex_head - ncols) % cols * 2);
+    glUniform1i(u_tring, cols * 2);
+    glUniform1i(u_trows, roll_tex_rows);
+    glUniform1i(u_tvpp, 2);
+    glUniform1i(u_txn, cols - 1);
+    glUniform1i(u_txoff, cols - ncols);
+    glUniform4fv(u_tcolours, MAX_TRACES, (GLfloat *)trace_colours);
+    glUniform2fv(u_tscoffs, MAX_TRACES, (GLfloat *)trace_scoffs);
+    glBindTexture(GL_TEXTURE_2D, roll_tex);
+    glDrawArraysInstanced(GL_LINE_STRIP, 0, ncols * 2, num_chans);
+}
+
 // Run the shaders to update the display
 void graph_display()
 {
-    glUseProgram(program);
+    glClearColor(CLEAR_COLOUR);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // Waterfall in the bottom half, under the grid
+    if (shown == VIEW_SPEC && wf_bins)
+    {
+        glUseProgram(wf_program);
+        glUniform2f(u_wyrange, NORM_YMIN, 0);
+        glUniform1i(u_wchans, num_chans);
+        glUniform1i(u_wlines, WF_LINES);
+        glUniform1i(u_wrow, wf_row);
+        glBindTexture(GL_TEXTURE_2D, wf_tex);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
 
+    glUseProgram(program);
     glUniform4fv(u_colours, MAX_TRACES, (GLfloat *)trace_colours);
     glUniform2fv(u_scoffs, MAX_TRACES, (GLfloat *)trace_scoffs);
+    glBindBuffer(GL_ARRAY_BUFFER, grid_vbo);
+    glEnableVertexAttribArray(a_coord3d);
+    glVertexAttribPointer(a_coord3d, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glDrawArrays(GL_LINE_STRIP, 0, traces[0].np);
+    glDisableVertexAttribArray(a_coord3d);
 
-    glClearColor(CLEAR_COLOUR);
-    glClear(GL_COLOR_BUFFER_BIT);
+    // Phosphor image, blended over the grid
+    if (shown == VIEW_PHOS)
+    {
+        glUseProgram(phos_program);
+        glUniform2f(u_pyrange, NORM_YMIN, NORM_YMAX);
+        glUniform1f(u_pgain, phos_gain);
+        glBindTexture(GL_TEXTURE_2D, phos_tex);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+    else if (shown == VIEW_ROLL)
+        draw_roll();
+    else
+        draw_traces(shown == VIEW_SPEC ? spec_scoffs : trace_scoffs);
+    // Swap is paced by the display refresh (vsync)
+    if (glut_mode == GLUT_DOUBLE)
+        glutSwapBuffers();
+    else
+        glFlush();
+    // Benchmark frames are only done when drawn
+    if (bench)
+    {
+        glFinish();
+        bench_frames++;
+    }
+    // Latency from data arriving to the frame showing it being swapped
+    if ((vert_buff_alloc || shown != VIEW_TRACES) && !stage_shown)
+    {
+        uint64_t lat = now_ns() - stages[stage_front].t_in;
 
-    glDrawArrays(GL_LINE_STRIP, 0, nvertices);
-#if GLUT_MODE == GLUT_DOUBLE
-    glutSwapBuffers();
-#else
-    glFlush();
-#endif
+        lat_sum += lat;
+        lat_max = lat > lat_max ? lat : lat_max;
+        lat_n++;
+        stage_shown = 1;
+    }
     frame_count++;
 }
 
@@ -591,6 +1989,13 @@ void graph_display()
 void graph_free()
 {
     glDeleteProgram(program);
+    glDeleteProgram(trace_program);
+    glDeleteProgram(phos_program);
+    glDeleteProgram(wf_program);
+    glDeleteTextures(1, &phos_tex);
+    glDeleteTextures(1, &wf_tex);
+    glDeleteTextures(1, &val_tex);
+    glDeleteTextures(1, &roll_tex);
 }
 
 // Check if fifo exists
@@ -609,8 +2014,6 @@ void key_handler(unsigned char key, int x, int y)
     case 'Q':
         glutLeaveMainLoop();
         printf("Closing program\n");
-        free_traces();
-        graph_free();
         break;
 
     case ' ':
@@ -619,18 +2022,235 @@ void key_handler(unsigned char key, int x, int y)
         paused = !paused;
         printf("%s\n", paused ? "Paused" : "Running");
         break;
+
+    case 'e':
+    case 'E':
+        env_off = !env_off;
+        printf("Envelope %s\n", env_off ? "off" : "on");
+        break;
+
+    case 'd':
+    case 'D':
+        view = view == VIEW_PHOS ? VIEW_TRACES : VIEW_PHOS;
+        if (view == VIEW_PHOS)
+            printf("Phosphor on, %g ms decay\n", phos_tau * 1000);
+        else
+            printf("Phosphor off\n");
+        break;
+
+    case 'f':
+    case 'F':
+        view = view == VIEW_SPEC ? VIEW_TRACES : VIEW_SPEC;
+        if (view == VIEW_SPEC)
+            printf("Spectrum on, %u point FFT%s\n", spec_size,
+                   use_fifo ? ", from the ring only" : "");
+        else
+            printf("Spectrum off\n");
+        break;
+
+    case 'r':
+    case 'R':
+        view = view == VIEW_ROLL ? VIEW_TRACES : VIEW_ROLL;
+        if (view == VIEW_ROLL)
+            printf("Roll on, %g s across%s\n", roll_secs,
+                   use_fifo ? ", from the ring only" : "");
+        else
+            printf("Roll off\n");
+        break;
     }
 }
 
+#if USE_EGL
+// Create an OpenGL context with no window, so the display can be run on
+// a machine with no screen or GPU (Mesa llvmpipe). Surfaceless if EGL
+// supports it, else with a pbuffer; the drawing is to a framebuffer.
+int offscreen_init(void)
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_display;
+    const char *exts=eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    EGLint major, minor, n=0, pb_attrs[]={EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+    EGLint cfg_attrs[]={EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+                        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+    EGLConfig cfg=0;
+
+    get_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (get_display && exts && strstr(exts, "EGL_MESA_platform_surfaceless"))
+        egl_dpy = get_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0);
+    else
+        egl_dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (egl_dpy == EGL_NO_DISPLAY || !eglInitialize(egl_dpy, &major, &minor) ||
+        !eglBindAPI(EGL_OPENGL_API))
+        return(0);
+    if (eglChooseConfig(egl_dpy, cfg_attrs, &cfg, 1, &n) && n > 0)
+        egl_surf = eglCreatePbufferSurface(egl_dpy, cfg, pb_attrs);
+    egl_ctx = eglCreateContext(egl_dpy, n > 0 ? cfg : EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, 0);
+    if (egl_ctx == EGL_NO_CONTEXT || !eglMakeCurrent(egl_dpy, egl_surf, egl_surf, egl_ctx))
+        return(0);
+    printf("Offscreen EGL %d.%d, %s\n", major, minor,
+           egl_surf == EGL_NO_SURFACE ? "surfaceless" : "pbuffer");
+    return(1);
+}
+
+// Free the offscreen context
+void offscreen_free(void)
+{
+    if (egl_dpy == EGL_NO_DISPLAY)
+        return;
+    eglMakeCurrent(egl_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (egl_ctx != EGL_NO_CONTEXT)
+        eglDestroyContext(egl_dpy, egl_ctx);
+    if (egl_surf != EGL_NO_SURFACE)
+        eglDestroySurface(egl_dpy, egl_surf);
+    eglTerminate(egl_dpy);
+}
+#else
+int offscreen_init(void)
+{
+    fprintf(stderr, "Error: built without EGL\n");
+    return(0);
+}
+
+void offscreen_free(void)
+{
+}
+#endif
+
+// Write the image drawn as a binary PPM file, top row first
+int write_ppm(char *fname, int w, int h)
+{
+    unsigned char *p=(unsigned char *)malloc(w * h * 3);
+    FILE *f;
+    int y;
+
+    if (!p || !(f = fopen(fname, "wb")))
+    {
+        free(p);
+        return(0);
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, p);
+    fprintf(f, "P6\n%d %d\n255\n", w, h);
+    for (y=h-1; y>=0; y--)
+        fwrite(&p[y * w * 3], 1, w * 3, f);
+    fclose(f);
+    free(p);
+    return(1);
+}
+
+// Compare frame times, for sorting
+int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x=*(const uint64_t *)a, y=*(const uint64_t *)b;
+
+    return(x < y ? -1 : x > y);
+}
+
+// Draw up to frames frames offscreen, each as data is staged, or the
+// whole benchmark if frames is 0. Then report the frame times, from
+// taking the data to the GPU finishing, the bytes copied to the GPU, and
+// the CPU time of all the threads. The first frame, with the start-up
+// work, isn't counted. The last image can be written out.
+void offscreen_run(int frames)
+{
+    int size[]={OFF_SIZE}, w=size[0], h=size[1], n=0, nalloc=0, warm=0;
+    uint64_t *times=0, *tp, t, t0, wait;
+    unsigned int drops;
+    struct timespec cpu0, cpu1;
+    double cpu;
+    GLuint fbo, rbo;
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glGenRenderbuffers(1, &rbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, rbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rbo);
+    reshape(w, h);
+    wait = now_ns();
+    while (frames ? n < frames : !bench_done)
+    {
+        t = now_ns();
+        if (!stage_take())
+        {
+            if (t - wait >= OFF_WAIT_SECS * 1000000000ULL)
+            {
+                printf("No data for %u s\n", OFF_WAIT_SECS);
+                break;
+            }
+            usleep(INGEST_USEC);
+            continue;
+        }
+        graph_display();
+        glFinish();
+        if (!warm)
+        {
+            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu0);
+            t0 = wait = now_ns();
+            drops = stage_drops;
+            upload_bytes = stage_taken = lat_n = 0;
+            lat_sum = lat_max = 0;
+            warm = 1;
+            continue;
+        }
+        if (n >= nalloc)
+        {
+            nalloc = nalloc ? nalloc * 2 : 1024;
+            if (!(tp = (uint64_t *)realloc(times, nalloc * sizeof(uint64_t))))
+                break;
+            times = tp;
+        }
+        wait = now_ns();
+        times[n++] = wait - t;
+    }
+    if (n)
+    {
+        t = now_ns() - t0;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu1);
+        cpu = (cpu1.tv_sec - cpu0.tv_sec) * 1e3 + (cpu1.tv_nsec - cpu0.tv_nsec) / 1e6;
+        drops = stage_drops - drops;
+        qsort(times, n, sizeof(uint64_t), cmp_u64);
+        printf("%u frames in %.2f s, %.1f FPS, %u%% dropped\n", n, t / 1e9, n * 1e9 / t,
+               drops * 100 / (drops + stage_taken));
+        printf("Frame time p50 %.2f p90 %.2f p99 %.2f max %.2f ms\n",
+               times[(n - 1) * 50 / 100] / 1e6, times[(n - 1) * 90 / 100] / 1e6,
+               times[(n - 1) * 99 / 100] / 1e6, times[n - 1] / 1e6);
+        printf("Upload %.0f bytes/frame, CPU %.2f ms/frame, latency %.1f/%.1f ms\n",
+               (double)upload_bytes / n, cpu / n, lat_n ? lat_sum / 1e6 / lat_n : 0.0,
+               lat_max / 1e6);
+    }
+    if (img_name && !write_ppm(img_name, w, h))
+        printf("Can't write %s\n", img_name);
+    free(times);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteRenderbuffers(1, &rbo);
+    glDeleteFramebuffers(1, &fbo);
+}
+
 // Initialise display, and update with data
 void do_graph(void)
 {
-    glutInitDisplayMode(GLUT_MODE | GLUT_RGB | GLUT_MULTISAMPLE);
+    GLenum glew_status;
+
+    if (offscreen)
+    {
+        if (!offscreen_init())
+        {
+            fprintf(stderr, "Error: can't create offscreen context\n");
+            offscreen_free();
+            return;
+        }
+        // No GLX, so only the context's functions
+        glew_status = glewContextInit();
+    }
+    else
+    {
+        glutInitDisplayMode(glut_mode | GLUT_RGB | GLUT_MULTISAMPLE);
 #ifdef WIN_SIZE
-    glutInitWindowSize(WIN_SIZE);
+        glutInitWindowSize(WIN_SIZE);
 #endif
-    glutCreateWindow("Graph test");
-    GLenum glew_status = glewInit();
+        glutCreateWindow("Graph test");
+        glew_status = glewInit();
+    }
     if (glew_status != GLEW_OK)
     {
         fprintf(stderr, "Error: %s\n", glewGetErrorString(glew_status));
@@ -639,16 +2259,30 @@ void do_graph(void)
     printf("OpenGL version %s\n", glGetString(GL_VERSION));
     if (graph_init())
     {
-        glutDisplayFunc(graph_display);
-        glutIdleFunc(idle_handler);
-        glutKeyboardFunc(key_handler);
-        glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE,
-                      GLUT_ACTION_CONTINUE_EXECUTION);
-        glutTimerFunc(0, timer_handler, 0);
-        glutReshapeFunc(reshape);
-        glutMainLoop();
+        if (pthread_create(&ingest_thread, 0, ingest_main, 0) != 0)
+        {
+            fprintf(stderr, "Error: can't start ingest thread\n");
+            return;
+        }
+        if (offscreen)
+            offscreen_run(off_frames);
+        else
+        {
+            glutDisplayFunc(graph_display);
+            glutIdleFunc(idle_handler);
+            glutKeyboardFunc(key_handler);
+            glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE,
+                          GLUT_ACTION_CONTINUE_EXECUTION);
+            glutTimerFunc(0, timer_handler, 0);
+            glutReshapeFunc(reshape);
+            glutMainLoop();
+        }
+        ingest_stop = 1;
+        pthread_join(ingest_thread, 0);
+        free_traces();
     }
     graph_free();
+    offscreen_free();
 }
 
 // EOF
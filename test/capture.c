@@ -0,0 +1,458 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mva_test.h"
+#include "../adc_capmap.h"
+#include "../adc_capset.h"
+
+#define CAP_TEST_FILE "capture_test.cap"
+#define NUM_TEST_BLOCKS 1500	/* Not a multiple of buffer size */
+#define CAPSET_TEST_DIR "capset_test"
+#define SET_TEST_BLOCKS 3000
+#define SET_SEG_BLOCKS 200	/* blocks in a segment */
+#define SET_USECS0 (UINT32_MAX - 1000000)	/* timer wraps after 1s */
+#define MAP_TEST_BLOCKS 2000
+#define MAP_USECS0 (UINT32_MAX - 500 * 1024)	/* timer wraps at block 500 */
+#define PYR_SPIKE_BLOCK 1234	/* block with a spike on channel 1 */
+#define PYR_SAW(f) ((f) % 2000)	/* channel 0 code of frame f */
+
+static struct adc_data g_block;
+
+/* Write blocks whose samples tell the block number, then read them back */
+static int test_roundtrip(const char *name, const struct awr_cfg *cfg)
+{
+	struct adc_stream_info info = { .ndevs = 1, .nchans = 2, .sample_rate = 500000 };
+	struct cap_header hdr;
+	struct cap_block b;
+	struct cap_writer w;
+	uint64_t seq;
+	off_t size;
+	int fd, i, ret;
+
+	cap_header_init(&hdr, &info, 1000000);
+	ret = cap_open_write(&w, CAP_TEST_FILE, &hdr, cfg);
+	MVA_CHECK(ret, ret, "%s: open failed %d\n", name, ret);
+
+	for (seq = 0; seq < NUM_TEST_BLOCKS; seq++) {
+		g_block.usecs = seq * 1024;
+		for (i = 0; i < MAX_SAMPS; i++)
+			g_block.samples[i] = ((seq + i) & 0xff) << 8 | 0x07;
+		ret = cap_write_block(&w, seq + 100, &g_block);
+		MVA_CHECK(ret, ret, "%s: write failed %d\n", name, ret);
+	}
+	ret = cap_close_write(&w);
+	MVA_CHECK(ret, ret, "%s: close failed %d\n", name, ret);
+
+	fd = open(CAP_TEST_FILE, O_RDONLY);
+	MVA_CHECK(fd < 0, -errno, "%s: can't open capture\n", name);
+
+	ret = cap_read_header(fd, &hdr);
+	MVA_CHECK(ret, ret, "%s: bad header %d\n", name, ret);
+	MVA_CHECK(hdr.nblocks != NUM_TEST_BLOCKS || hdr.info.nchans != 2, -EINVAL,
+		  "%s: header has %llu blocks\n", name, (unsigned long long)hdr.nblocks);
+
+	size = lseek(fd, 0, SEEK_END);
+	MVA_CHECK(size != CAP_HDR_SIZE + NUM_TEST_BLOCKS * sizeof(b), -EINVAL,
+		  "%s: file size %lld\n", name, (long long)size);
+
+	for (seq = 0; seq < NUM_TEST_BLOCKS; seq++) {
+		ret = pread(fd, &b, sizeof(b), CAP_HDR_SIZE + seq * sizeof(b));
+		MVA_CHECK(ret != sizeof(b), -EIO, "%s: short read\n", name);
+		MVA_CHECK(b.seq != seq + 100 || b.usecs != seq * 1024 ||
+			  b.samples[5] != (0x0700 | ((seq + 5) & 0xff)), -EINVAL,
+			  "%s: bad block %llu\n", name, (unsigned long long)seq);
+	}
+	close(fd);
+	unlink(CAP_TEST_FILE);
+
+	printf("Testing capture %s (%s%s) PASSED\n", name,
+	       w.aw.mode == AWR_URING ? "io_uring" : "thread",
+	       w.aw.direct ? ", O_DIRECT" : "");
+
+	return 0;
+}
+
+static int set_write(struct capset_cfg *cfg, struct cap_header *hdr, uint64_t seq0)
+{
+	struct capset_writer w;
+	uint64_t seq;
+	int ret;
+
+	ret = capset_open_write(&w, cfg, hdr);
+	MVA_CHECK(ret, ret, "capset open failed %d\n", ret);
+	for (seq = seq0; seq < seq0 + SET_TEST_BLOCKS; seq++) {
+		/* 1024 usec per block */
+		g_block.usecs = SET_USECS0 + (uint32_t)seq * 1024;
+		g_block.samples[0] = (seq & 0xff) << 8;
+		ret = capset_write_block(&w, seq, &g_block);
+		MVA_CHECK(ret, ret, "capset write failed %d\n", ret);
+	}
+
+	return capset_close_write(&w);
+}
+
+static void set_cleanup(void)
+{
+	char path[CAPSET_NAME_LEN];
+	unsigned int i;
+
+	for (i = 0; i < 64; i++) {
+		snprintf(path, sizeof(path), CAPSET_TEST_DIR "/seg%08u.cap", i);
+		unlink(path);
+		snprintf(path, sizeof(path), CAPSET_TEST_DIR "/seg%08u.idx", i);
+		unlink(path);
+		snprintf(path, sizeof(path), CAPSET_TEST_DIR "/seg%08u.pyr", i);
+		unlink(path);
+	}
+	rmdir(CAPSET_TEST_DIR);
+}
+
+static int test_set()
+{
+	struct adc_stream_info info = { .ndevs = 1, .nchans = 1, .sample_rate = 1000000 };
+	struct capset_cfg cfg = {
+		.dir = CAPSET_TEST_DIR,
+		.seg_bytes = CAP_HDR_SIZE + SET_SEG_BLOCKS * sizeof(struct cap_block),
+	};
+	struct awr_cfg wcfg = AWR_CFG_DEFAULT;
+	struct capset_reader r;
+	struct cap_header hdr;
+	struct cap_block b;
+	uint64_t t, t0, prev;
+	int i, ret;
+
+	set_cleanup();
+	wcfg.buf_size = 64 * 1024;
+	cfg.wcfg = &wcfg;
+	cap_header_init(&hdr, &info, 1000000);
+
+	ret = set_write(&cfg, &hdr, 0);
+	MVA_CHECK(ret, ret, "capset close failed %d\n", ret);
+
+	ret = capset_open_read(&r, CAPSET_TEST_DIR);
+	MVA_CHECK(ret, ret, "capset read open failed %d\n", ret);
+	MVA_CHECK(r.nsegs != SET_TEST_BLOCKS / SET_SEG_BLOCKS, -EINVAL,
+		  "%u segments\n", r.nsegs);
+	t0 = capset_first_ns(&r);
+	MVA_CHECK(t0 != SET_USECS0 * 1000ULL, -EINVAL, "first time %llu\n",
+		  (unsigned long long)t0);
+
+	/* Seek across the timer wrap, into the middle of index strides */
+	for (i = 0; i < SET_TEST_BLOCKS; i += 37) {
+		ret = capset_seek(&r, t0 + i * 1024000ULL + 500);
+		MVA_CHECK(ret, ret, "seek failed %d\n", ret);
+		ret = capset_read_block(&r, &b, &t);
+		MVA_CHECK(ret || b.seq != i || t != t0 + i * 1024000ULL, -EINVAL,
+			  "seek to block %d got %llu\n", i, (unsigned long long)b.seq);
+	}
+
+	/* Read on from the middle of a segment to the end */
+	capset_seek(&r, t0 + 150 * 1024000ULL);
+	for (prev = 149; !(ret = capset_read_block(&r, &b, &t)); prev = b.seq)
+		MVA_CHECK(b.seq != prev + 1, -EINVAL, "block %llu after %llu\n",
+			  (unsigned long long)b.seq, (unsigned long long)prev);
+	MVA_CHECK(ret != -ENODATA || prev != SET_TEST_BLOCKS - 1, -EINVAL,
+		  "read ended at %llu: %d\n", (unsigned long long)prev, ret);
+	capset_close_read(&r);
+
+	/* Second recording keeps time growing and drops old segments */
+	cfg.keep_segs = 20;
+	ret = set_write(&cfg, &hdr, 0);
+	MVA_CHECK(ret, ret, "second recording failed %d\n", ret);
+	ret = capset_open_read(&r, CAPSET_TEST_DIR);
+	MVA_CHECK(ret || r.nsegs != 20 || r.segs[0].num != 10, -EINVAL,
+		  "retention kept %u segments from %u\n", r.nsegs, r.segs[0].num);
+	for (i = 1; i < r.nsegs; i++)
+		MVA_CHECK(r.segs[i].idx[0].time_ns <= r.segs[i - 1].idx[0].time_ns,
+			  -EINVAL, "time goes back in segment %d\n", i);
+	capset_close_read(&r);
+	set_cleanup();
+
+	printf("Testing capture set PASSED\n");
+
+	return 0;
+}
+
+/* The timer wraps after the last index entry, then the set is added to */
+static int test_set_resume()
+{
+	struct adc_stream_info info = { .ndevs = 1, .nchans = 1, .sample_rate = 1000000 };
+	struct capset_cfg cfg = { .dir = CAPSET_TEST_DIR };
+	struct awr_cfg wcfg = AWR_CFG_DEFAULT;
+	struct capset_writer w;
+	struct capset_reader r;
+	struct cap_header hdr;
+	struct cap_block b;
+	uint64_t seq, t_end, t_new;
+	int ret;
+
+	set_cleanup();
+	wcfg.buf_size = 64 * 1024;
+	cfg.wcfg = &wcfg;
+	cap_header_init(&hdr, &info, 1000000);
+
+	ret = capset_open_write(&w, &cfg, &hdr);
+	MVA_CHECK(ret, ret, "capset open failed %d\n", ret);
+	for (seq = 0; seq < 100; seq++) {
+		/* Wraps at block 80, after the index entry of block 64 */
+		g_block.usecs = (uint32_t)(UINT32_MAX - 80 * 1024 + 1 + seq * 1024);
+		ret = capset_write_block(&w, seq, &g_block);
+		MVA_CHECK(ret, ret, "capset write failed %d\n", ret);
+	}
+	ret = capset_close_write(&w);
+	MVA_CHECK(ret, ret, "capset close failed %d\n", ret);
+
+	ret = capset_open_write(&w, &cfg, &hdr);
+	MVA_CHECK(ret, ret, "capset reopen failed %d\n", ret);
+	g_block.usecs = 5;
+	ret = capset_write_block(&w, 100, &g_block);
+	if (!ret)
+		ret = capset_close_write(&w);
+	MVA_CHECK(ret, ret, "second recording failed %d\n", ret);
+
+	ret = capset_open_read(&r, CAPSET_TEST_DIR);
+	MVA_CHECK(ret || r.nsegs != 2, -EINVAL, "resumed set: %d, %u segments\n", ret, r.nsegs);
+	ret = capset_read_at(&r, 0, r.segs[0].nblocks - 1, &b, &t_end);
+	if (!ret)
+		ret = capset_read_at(&r, 1, 0, &b, &t_new);
+	capset_close_read(&r);
+	set_cleanup();
+	MVA_CHECK(ret || t_new <= t_end, -EINVAL, "resumed at %llu, before %llu\n",
+		  (unsigned long long)t_new, (unsigned long long)t_end);
+
+	printf("Testing capture set resume PASSED\n");
+
+	return 0;
+}
+
+/* Point of a query over the whole set that has the channel 1 spike */
+static int pyr_spike_point(struct capset_reader *r, uint64_t t0, struct pyr_point *pts)
+{
+	int i, ret, found = -1;
+
+	ret = pyr_query(r, 1, t0, t0 + SET_TEST_BLOCKS * 1024000ULL, pts, 16);
+	MVA_CHECK(ret != 16, -EINVAL, "spike query returned %d\n", ret);
+	for (i = 0; i < 16; i++) {
+		MVA_CHECK(!pts[i].count || pts[i].min != 50, -EINVAL,
+			  "point %d: min %u count %u\n", i, pts[i].min, pts[i].count);
+		if (pts[i].max == 2000)
+			found = i;
+		else
+			MVA_CHECK(pts[i].max != 50, -EINVAL, "point %d: max %u\n", i, pts[i].max);
+	}
+
+	return found;
+}
+
+/* Two channels: a sawtooth on 0, and a constant with one spike on 1 */
+static int test_pyramid()
+{
+	struct adc_stream_info info = { .ndevs = 1, .nchans = 2, .sample_rate = 500000 };
+	struct capset_cfg cfg = {
+		.dir = CAPSET_TEST_DIR,
+		.seg_bytes = CAP_HDR_SIZE + SET_SEG_BLOCKS * sizeof(struct cap_block),
+	};
+	struct awr_cfg wcfg = AWR_CFG_DEFAULT;
+	struct pyr_point pts[512];
+	char path[CAPSET_NAME_LEN];
+	struct capset_writer w;
+	struct capset_reader r;
+	struct cap_header hdr;
+	uint64_t seq, t0, f;
+	int i, ret, spike;
+
+	set_cleanup();
+	wcfg.buf_size = 64 * 1024;
+	cfg.wcfg = &wcfg;
+	cap_header_init(&hdr, &info, 1000000);
+
+	ret = capset_open_write(&w, &cfg, &hdr);
+	MVA_CHECK(ret, ret, "pyramid open failed %d\n", ret);
+	for (seq = 0; seq < SET_TEST_BLOCKS; seq++) {
+		g_block.usecs = SET_USECS0 + (uint32_t)seq * 1024;
+		for (i = 0; i < MAX_SAMPS / 2; i++) {
+			f = seq * (MAX_SAMPS / 2) + i;
+			/* Raw SPI words are byte swapped */
+			g_block.samples[i * 2] = PYR_SAW(f) << 8 | PYR_SAW(f) >> 8;
+			g_block.samples[i * 2 + 1] = (seq == PYR_SPIKE_BLOCK && i == 7) ?
+						     (2000 << 8 | 2000 >> 8) : 50 << 8;
+		}
+		ret = capset_write_block(&w, seq, &g_block);
+		MVA_CHECK(ret, ret, "pyramid write failed %d\n", ret);
+	}
+	ret = capset_close_write(&w);
+	MVA_CHECK(ret, ret, "pyramid close failed %d\n", ret);
+
+	ret = capset_open_read(&r, CAPSET_TEST_DIR);
+	MVA_CHECK(ret, ret, "pyramid read open failed %d\n", ret);
+	t0 = capset_first_ns(&r);
+
+	/* Zoomed out: the spike is in the point that covers its block */
+	spike = pyr_spike_point(&r, t0, pts);
+	MVA_CHECK(spike != PYR_SPIKE_BLOCK * 16 / SET_TEST_BLOCKS, -EINVAL,
+		  "spike in point %d\n", spike);
+
+	/* Zoomed in: one frame per point, read from the samples */
+	ret = pyr_query(&r, 0, t0 + 1500 * 1024000ULL, t0 + 1501 * 1024000ULL, pts, 512);
+	MVA_CHECK(ret != 512, -EINVAL, "zoomed in query returned %d\n", ret);
+	for (i = 0; i < 512; i++) {
+		f = 1500 * 512 + i;
+		MVA_CHECK(pts[i].count != 1 || pts[i].min != PYR_SAW(f) || pts[i].max != PYR_SAW(f),
+			  -EINVAL, "frame %llu: %u..%u count %u\n", (unsigned long long)f,
+			  pts[i].min, pts[i].max, pts[i].count);
+	}
+
+	/* Middle levels: a sawtooth period has 2000 frames, all codes are in 4 periods */
+	ret = pyr_query(&r, 0, t0 + 100 * 1024000ULL, t0 + 900 * 1024000ULL, pts, 10);
+	MVA_CHECK(ret != 10, -EINVAL, "query returned %d\n", ret);
+	for (i = 0; i < 10; i++)
+		MVA_CHECK(pts[i].min != 0 || pts[i].max != 1999 || pts[i].count < 40960,
+			  -EINVAL, "point %d: %u..%u count %u\n", i, pts[i].min,
+			  pts[i].max, pts[i].count);
+
+	/* After the end: no data */
+	ret = pyr_query(&r, 0, t0 + 4000 * 1024000ULL, t0 + 5000 * 1024000ULL, pts, 4);
+	MVA_CHECK(ret != 4 || pts[0].count || pts[0].min <= pts[0].max, -EINVAL,
+		  "empty query returned %d count %u\n", ret, pts[0].count);
+	capset_close_read(&r);
+
+	/*
+	 * Segment being recorded: no footer, only some of level 0. The spike
+	 * is first in the level 0 written, then in the samples after it.
+	 */
+	capset_seg_path(path, CAPSET_TEST_DIR, PYR_SPIKE_BLOCK / SET_SEG_BLOCKS, "pyr");
+	for (i = 1000; i >= 100; i -= 900) {
+		ret = truncate(path, i * 2 * sizeof(struct pyr_ent));
+		MVA_CHECK(ret, -errno, "can't truncate %s\n", path);
+		ret = capset_open_read(&r, CAPSET_TEST_DIR);
+		MVA_CHECK(ret, ret, "pyramid read open failed %d\n", ret);
+		spike = pyr_spike_point(&r, t0, pts);
+		MVA_CHECK(spike != PYR_SPIKE_BLOCK * 16 / SET_TEST_BLOCKS, -EINVAL,
+			  "live spike in point %d, %d entries\n", spike, i);
+		capset_close_read(&r);
+	}
+
+	/* Segment without a pyramid: same answer from samples */
+	unlink(path);
+	ret = capset_open_read(&r, CAPSET_TEST_DIR);
+	MVA_CHECK(ret, ret, "pyramid read open failed %d\n", ret);
+	spike = pyr_spike_point(&r, t0, pts);
+	MVA_CHECK(spike != PYR_SPIKE_BLOCK * 16 / SET_TEST_BLOCKS, -EINVAL,
+		  "raw spike in point %d\n", spike);
+	capset_close_read(&r);
+	set_cleanup();
+
+	printf("Testing capture pyramid PASSED\n");
+
+	return 0;
+}
+
+/* Channel 0 tells the block, channel 1 the frame in the block */
+static int test_capmap()
+{
+	struct adc_stream_info info = { .ndevs = 1, .nchans = 2, .sample_rate = 500000 };
+	struct awr_cfg cfg = AWR_CFG_DEFAULT;
+	const uint64_t t0 = MAP_USECS0 * 1000ULL;
+	struct capmap_iter it;
+	struct cap_header hdr;
+	struct cap_writer w;
+	struct cap_span sp;
+	struct capmap m;
+	uint64_t seq, t;
+	int i, ret;
+
+	cap_header_init(&hdr, &info, 1000000);
+	ret = cap_open_write(&w, CAP_TEST_FILE, &hdr, &cfg);
+	MVA_CHECK(ret, ret, "capmap: open failed %d\n", ret);
+	for (seq = 0; seq < MAP_TEST_BLOCKS; seq++) {
+		g_block.usecs = MAP_USECS0 + (uint32_t)seq * 1024;
+		for (i = 0; i < MAX_SAMPS / 2; i++) {
+			uint16_t c = seq & ADC_CODE_MASK;
+
+			g_block.samples[i * 2] = c << 8 | c >> 8;
+			g_block.samples[i * 2 + 1] = i << 8 | i >> 8;
+		}
+		ret = cap_write_block(&w, seq, &g_block);
+		MVA_CHECK(ret, ret, "capmap: write failed %d\n", ret);
+	}
+	ret = cap_close_write(&w);
+	MVA_CHECK(ret, ret, "capmap: close failed %d\n", ret);
+
+	ret = capmap_open(&m, CAP_TEST_FILE);
+	MVA_CHECK(ret, ret, "capmap: map failed %d\n", ret);
+	MVA_CHECK(m.nblocks != MAP_TEST_BLOCKS || m.nwords != 2, -EINVAL,
+		  "capmap: %llu blocks of %u words\n", (unsigned long long)m.nblocks, m.nwords);
+
+	/* Times and lookups across the timer wrap */
+	for (seq = 0; seq < MAP_TEST_BLOCKS; seq += 7) {
+		t = capmap_time(&m, seq);
+		MVA_CHECK(t != t0 + seq * 1024000, -EINVAL, "capmap: block %llu at %llu\n",
+			  (unsigned long long)seq, (unsigned long long)t);
+		MVA_CHECK(capmap_find(&m, t) != seq || capmap_find(&m, t + 1) != seq + 1,
+			  -EINVAL, "capmap: find block %llu\n", (unsigned long long)seq);
+	}
+	MVA_CHECK(capmap_find(&m, UINT64_MAX) != MAP_TEST_BLOCKS, -EINVAL,
+		  "capmap: find past the end\n");
+
+	ret = capmap_chan(&m, 1234, 1, &sp);
+	MVA_CHECK(ret || sp.n != MAX_SAMPS / 2 || cap_span_code(&sp, 300) != 300 ||
+		  capmap_block(&m, 1234)->seq != 1234, -EINVAL, "capmap: bad channel span\n");
+	MVA_CHECK(capmap_chan(&m, 0, 2, &sp) != -EINVAL, -EINVAL, "capmap: channel 2\n");
+	capmap_chan(&m, 1024, 0, &sp);
+	MVA_CHECK(cap_span_volts(&sp, 0) != ADC_VREF / 2, -EINVAL,
+		  "capmap: mid scale is %f V\n", cap_span_volts(&sp, 0));
+
+	/* Stream a range longer than the readahead and drop windows */
+	ret = capmap_iter_init(&it, &m, 0, capmap_time(&m, 100), capmap_time(&m, 1900));
+	MVA_CHECK(ret, ret, "capmap: iterator init failed %d\n", ret);
+	for (seq = 100; !(ret = capmap_iter_next(&it, &sp, &t)); seq++)
+		MVA_CHECK(t != t0 + seq * 1024000 || cap_span_code(&sp, 511) != (seq & ADC_CODE_MASK),
+			  -EINVAL, "capmap: iterator at block %llu\n", (unsigned long long)seq);
+	MVA_CHECK(ret != -ENODATA || seq != 1900, -EINVAL, "capmap: iterator ended at %llu\n",
+		  (unsigned long long)seq);
+
+	capmap_close(&m);
+	unlink(CAP_TEST_FILE);
+	printf("Testing capture mapping PASSED\n");
+
+	return 0;
+}
+
+int main()
+{
+	struct awr_cfg cfg = AWR_CFG_DEFAULT;
+	int ret;
+
+	ret = test_roundtrip("default", &cfg);
+
+	cfg.thread = true;
+	cfg.nbufs = 2;
+	cfg.buf_size = 64 * 1024;
+	cfg.sync = AWR_SYNC_BYTES;
+	cfg.sync_bytes = 256 * 1024;
+	if (!ret)
+		ret = test_roundtrip("thread", &cfg);
+
+	cfg.thread = false;
+	cfg.direct = false;
+	cfg.nbufs = 1;
+	if (!ret)
+		ret = test_roundtrip("buffered", &cfg);
+	if (!ret)
+		ret = test_capmap();
+	if (!ret)
+		ret = test_set();
+	if (!ret)
+		ret = test_set_resume();
+	if (!ret)
+		ret = test_pyramid();
+
+	printf("%s\n", ret ? "FAILED" : "PASSED");
+
+	return ret;
+}
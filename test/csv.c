@@ -0,0 +1,151 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mva_test.h"
+#include "../adc_csv.h"
+
+static int test_csv()
+{
+	static const char *lines = "1,2.5, -3\t4e2\r\n\n,7 ,,  8,\n-.5 +12.75 0.001 1.5V\n";
+	static const float expect[] = { 1, 2.5, -3, 400, 7, 8, -0.5, 12.75, 0.001, 1.5 };
+	static const int counts[] = { 4, 0, 2, 4 };
+	static struct csv_reader r;
+	static char text[20000];
+	float vals[16], v;
+	unsigned int i, k, split, fed;
+	int n, fd[2];
+	size_t len;
+
+	/* Every split of the text in two, including mid value */
+	len = strlen(lines);
+	for (split = 0; split <= len; split++) {
+		csv_init(&r);
+		csv_set_text(&r, lines, split);
+		k = i = fed = 0;
+		for (;;) {
+			n = csv_parse_line(&r, &vals[k], ARRAY_SIZE(vals) - k);
+			if (n == -EAGAIN && !fed++) {
+				csv_set_text(&r, &lines[split], len - split);
+				continue;
+			}
+			if (n == -EAGAIN)
+				break;
+			MVA_CHECK(i >= ARRAY_SIZE(counts) || n != counts[i], -EINVAL,
+				  "Split %u line %u: %d values\n", split, i, n);
+			k += n;
+			i++;
+		}
+		MVA_CHECK(i != ARRAY_SIZE(counts), -EINVAL, "Split %u: %u lines\n", split, i);
+		for (i = 0; i < ARRAY_SIZE(expect); i++)
+			MVA_CHECK(vals[i] != expect[i], -EINVAL, "Split %u value %u: %g, expected %g\n",
+				  split, i, vals[i], expect[i]);
+	}
+
+	/* No line length limit, values past the maximum are dropped */
+	for (i = len = 0; i < 3000; i++)
+		len += sprintf(&text[len], "%u ", i);
+	text[len++] = '\n';
+	csv_init(&r);
+	csv_set_text(&r, text, len);
+	n = csv_parse_line(&r, vals, 10);
+	MVA_CHECK(n != 10 || vals[9] != 9, -EINVAL, "Long line: %d values\n", n);
+
+	/* The fast path against atof() */
+	srand(3);
+	for (i = 0; i < 100000; i++) {
+		len = sprintf(text, "%.*f", rand() % 8, (rand() - RAND_MAX / 2) / pow(10, rand() % 6));
+		text[len++] = '\n';
+		csv_set_text(&r, text, len);
+		n = csv_parse_line(&r, &v, 1);
+		text[len - 1] = 0;
+		MVA_CHECK(n != 1 || v != (float)atof(text), -EINVAL, "'%s' read as %g\n", text, v);
+	}
+
+	/* Through a pipe, as from a FIFO */
+	MVA_CHECK(pipe(fd), -errno, "pipe failed\n");
+	csv_init(&r);
+	MVA_CHECK(write(fd[1], "3,4", 3) != 3, -EIO, "pipe write failed\n");
+	close(fd[1]);
+	n = csv_read_line(&r, fd[0], vals, ARRAY_SIZE(vals));
+	MVA_CHECK(n != -ENODATA, -EINVAL, "Partial line read: %d\n", n);
+	close(fd[0]);
+
+	printf("Testing CSV parser PASSED\n");
+
+	return 0;
+}
+
+static double secs_since(const struct timespec *t0)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return (t.tv_sec - t0->tv_sec) + (t.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/* Parse rate of the CSV reader, and of strcspn() and atof() as before */
+static void bench_csv()
+{
+	static struct csv_reader r;
+	static float vals[1000];
+	unsigned int i, reps, nvals = 0;
+	struct timespec t0;
+	size_t len = 0, size = 20 * 1000 * 1000;
+	char *text = malloc(size + 1), *s;
+	double t, fast, slow;
+	int n;
+
+	if (!text)
+		return;
+	srand(4);
+	while (len < size - 100) {
+		len += sprintf(&text[len], "%.3f%c", (rand() % 20001 - 10000) / 1000.0,
+			       ++nvals % ARRAY_SIZE(vals) ? ',' : '\n');
+	}
+	text[len] = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (reps = 0; (t = secs_since(&t0)) < 0.5; reps++) {
+		csv_init(&r);
+		csv_set_text(&r, text, len);
+		while (csv_parse_line(&r, vals, ARRAY_SIZE(vals)) > 0)
+			;
+	}
+	fast = (double)nvals * reps / t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (reps = 0; (t = secs_since(&t0)) < 0.5; reps++) {
+		for (s = text, n = 0; *s; n = n + 1 < ARRAY_SIZE(vals) ? n + 1 : 0) {
+			i = strcspn(s, " ,\t\r\n");
+			vals[n] = atof(s);
+			s += i;
+			while (*s == ',' || *s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')
+				s++;
+		}
+	}
+	slow = (double)nvals * reps / t;
+	free(text);
+
+	printf("CSV parse %.1f M values/s, strcspn and atof %.1f M values/s\n",
+	       fast / 1e6, slow / 1e6);
+}
+
+/* With -b, the parse rate is measured too */
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	ret = test_csv();
+	if (!ret && argc > 1 && !strcmp(argv[1], "-b"))
+		bench_csv();
+
+	printf("%s\n", ret ? "FAILED" : "PASSED");
+
+	return ret;
+}
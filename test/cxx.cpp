@@ -0,0 +1,2 @@
+// Builds as C++: the capture library headers are usable from C++
+#include "../adc_capmap.h"
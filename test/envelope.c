@@ -0,0 +1,63 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mva_test.h"
+#include "../adc_envelope.h"
+
+static int test_envelope()
+{
+	static const unsigned int sizes[][2] = {
+		{ 100000, 640 }, { 1000, 7 }, { 641, 640 }, { 13, 8 }, { 5, 12 },
+	};
+	static uint16_t v[100000], env[2 * 640];
+	unsigned int i, c, k;
+	uint16_t lo, hi;
+	size_t s, e;
+
+	srand(1);
+	for (i = 0; i < ARRAY_SIZE(v); i++)
+		v[i] = rand() & 0xffff;
+	/* A single sample glitch must show in its column */
+	v[54321] = 0xffff;
+
+	for (k = 0; k < ARRAY_SIZE(sizes); k++) {
+		unsigned int n = sizes[k][0], cols = sizes[k][1];
+
+		env_columns(v, n, cols, env);
+		for (c = 0; c < cols; c++) {
+			s = (size_t)c * n / cols;
+			e = (size_t)(c + 1) * n / cols;
+			if (e <= s)
+				e = s + 1;
+			lo = 0xffff;
+			hi = 0;
+			for (; s < e; s++) {
+				lo = v[s] < lo ? v[s] : lo;
+				hi = v[s] > hi ? v[s] : hi;
+			}
+			MVA_CHECK(env[2 * c] != lo || env[2 * c + 1] != hi, -EINVAL,
+				  "envelope %u/%u col %u: %u..%u, expected %u..%u\n",
+				  n, cols, c, env[2 * c], env[2 * c + 1], lo, hi);
+		}
+	}
+
+	env_columns(v, 100000, 640, env);
+	MVA_CHECK(env[2 * (54321 * 640 / 100000) + 1] != 0xffff, -EINVAL,
+		  "glitch missing from the envelope\n");
+
+	printf("Testing min/max envelope PASSED\n");
+
+	return 0;
+}
+
+int main()
+{
+	int ret;
+
+	ret = test_envelope();
+
+	printf("%s\n", ret ? "FAILED" : "PASSED");
+
+	return ret;
+}
@@ -0,0 +1,82 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mva_test.h"
+#include "../adc_fft.h"
+
+static int test_fft()
+{
+	static const unsigned int sizes[] = { 16, 32, 64, 128, 512 };
+	static float re[1024], im[1024], db[512];
+	static int16_t v[10240];
+	struct fft_plan p;
+	struct welch w;
+	unsigned int i, j, k, n, nseg;
+	int ret;
+
+	MVA_CHECK(fft_init(&p, 48) != -EINVAL, -EINVAL, "FFT size 48 accepted\n");
+
+	/* Against a plain DFT, for even and odd powers of 4 */
+	srand(2);
+	for (k = 0; k < ARRAY_SIZE(sizes); k++) {
+		n = sizes[k];
+		for (i = 0; i < n; i++) {
+			re[i] = rand() % 2001 - 1000;
+			im[i] = rand() % 2001 - 1000;
+		}
+		memcpy(&re[n], re, n * sizeof(float));
+		memcpy(&im[n], im, n * sizeof(float));
+		ret = fft_init(&p, n);
+		MVA_CHECK(ret, ret, "fft_init(%u) failed\n", n);
+		fft_run(&p, re, im);
+		for (j = 0; j < n; j++) {
+			double sr = 0, si = 0;
+
+			for (i = 0; i < n; i++) {
+				double a = -2 * M_PI * ((size_t)i * j % n) / n;
+
+				sr += re[n + i] * cos(a) - im[n + i] * sin(a);
+				si += re[n + i] * sin(a) + im[n + i] * cos(a);
+			}
+			MVA_CHECK(fabs(re[j] - sr) + fabs(im[j] - si) > 1e-5 * n * 1000, -EINVAL,
+				  "FFT %u bin %u: %g%+gi, expected %g%+gi\n",
+				  n, j, re[j], im[j], sr, si);
+		}
+		fft_free(&p);
+	}
+
+	/* Full scale sine in bin 64, 19 half overlapping segments */
+	for (i = 0; i < ARRAY_SIZE(v); i++)
+		v[i] = 1024 + lrint(1023 * sin(2 * M_PI * 64 * i / 1024));
+	ret = welch_init(&w, 1024);
+	MVA_CHECK(ret, ret, "welch_init failed\n");
+	for (i = 0; i < ARRAY_SIZE(v); i += 333)
+		welch_add(&w, &v[i], ARRAY_SIZE(v) - i < 333 ? ARRAY_SIZE(v) - i : 333);
+	nseg = welch_read(&w, db);
+	MVA_CHECK(nseg != 19, -EINVAL, "Welch averaged %u segments, expected 19\n", nseg);
+	MVA_CHECK(fabsf(db[64]) > 0.1, -EINVAL, "Welch peak %g dB\n", db[64]);
+	/* Rounding to codes leaves harmonics near -70 dB */
+	for (k = 0; k < 512; k++)
+		MVA_CHECK((k < 62 || k > 66) && db[k] > -60, -EINVAL,
+			  "Welch bin %u: %g dB\n", k, db[k]);
+	MVA_CHECK(welch_read(&w, db), -EINVAL, "Welch read twice\n");
+	welch_free(&w);
+
+	printf("Testing FFT PASSED\n");
+
+	return 0;
+}
+
+int main()
+{
+	int ret;
+
+	ret = test_fft();
+
+	printf("%s\n", ret ? "FAILED" : "PASSED");
+
+	return ret;
+}
@@ -0,0 +1,77 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mva_test.h"
+#include "../adc_phosphor.h"
+
+static int test_phosphor()
+{
+	enum { COLS = 100, ROWS = 50 };
+	static float img[COLS * ROWS];
+	static uint16_t v[1000];
+	unsigned int i, r, c;
+	float max;
+
+	/* Flat trace at row 10, ten samples per column, with a glitch to row 40 */
+	for (i = 0; i < ARRAY_SIZE(v); i++)
+		v[i] = 100;
+	v[555] = 400;
+	phos_sweep(img, COLS, ROWS, v, ARRAY_SIZE(v), 0.1, 0);
+	for (c = 0; c < COLS; c++) {
+		for (r = 0; r < ROWS; r++) {
+			float want = r == 10 ? 10 : 0;
+
+			/* The glitch sample leaves row 10, the next one joins it again */
+			if (c == 55 && r >= 10 && r <= 40)
+				want = r == 10 ? 9 : r == 40 ? 1 : 2;
+			MVA_CHECK(img[r * COLS + c] != want, -EINVAL,
+				  "phosphor col %u row %u: %g, expected %g\n",
+				  c, r, img[r * COLS + c], want);
+		}
+	}
+
+	max = phos_decay(img, COLS * ROWS, 0.5, 0.5);
+	MVA_CHECK(fabsf(max - 10 * expf(-1)) > 1e-4, -EINVAL,
+		  "phosphor decay max %g, expected %g\n", max, 10 * expf(-1));
+	MVA_CHECK(fabsf(img[40 * COLS + 55] - expf(-1)) > 1e-6, -EINVAL,
+		  "phosphor glitch decayed to %g\n", img[40 * COLS + 55]);
+	MVA_CHECK(phos_decay(img, COLS * ROWS, 1, 0) != max, -EINVAL,
+		  "phosphor faded with no decay\n");
+
+	/* Fewer samples than columns: a ramp crossing every row and column */
+	memset(img, 0, sizeof(img));
+	v[0] = 0;
+	v[1] = 499;
+	phos_sweep(img, COLS, ROWS, v, 2, 0.1, 0);
+	for (r = 0; r < ROWS; r++) {
+		float sum = 0;
+
+		for (c = 0; c < COLS; c++)
+			sum += img[r * COLS + c];
+		MVA_CHECK(sum < 1, -EINVAL, "phosphor ramp gap at row %u\n", r);
+	}
+	for (c = 0; c < COLS; c++) {
+		float sum = 0;
+
+		for (r = 0; r < ROWS; r++)
+			sum += img[r * COLS + c];
+		MVA_CHECK(sum != 1, -EINVAL, "phosphor ramp col %u: %g hits\n", c, sum);
+	}
+
+	printf("Testing phosphor PASSED\n");
+
+	return 0;
+}
+
+int main()
+{
+	int ret;
+
+	ret = test_phosphor();
+
+	printf("%s\n", ret ? "FAILED" : "PASSED");
+
+	return ret;
+}
@@ -4,6 +4,8 @@
 #include <stdio.h>
 #include <stdlib.h> /* exit */
 #include <string.h> /* memcmp */
+#include <sys/wait.h> /* waitpid */
+#include <time.h>
 #include <unistd.h> /* fork, usleep */
 
 #include "mva_test.h"
@@ -40,6 +42,42 @@ static int test_ring_init(struct mvaring **mr)
 	return 0;
 }
 
+/* A sleeping reader is woken by a writer in another process */
+static int test_ring_wait(struct mvaring *mr)
+{
+	struct timespec t0, t1;
+	pid_t pid;
+	int ret;
+
+	ret = ring_wait(mr, 10);
+	MVA_CHECK(ret != -ETIMEDOUT, -EINVAL, "wait on empty ring returned %d\n", ret);
+
+	pid = fork();
+	MVA_CHECK(pid < 0, -errno, "fork failed\n");
+	if (pid == 0) {
+		usleep(20000);
+		ring_add(mr, &g_txdata, true);
+		exit(0);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	ret = ring_wait(mr, 2000);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	waitpid(pid, NULL, 0);
+	MVA_CHECK(ret, ret, "wait for writer returned %d\n", ret);
+	MVA_CHECK(t1.tv_sec - t0.tv_sec > 1, -ETIMEDOUT, "reader was not woken\n");
+	MVA_CHECK(mr->rsleep, -EINVAL, "reader left sleeping\n");
+
+	ret = ring_wait(mr, -1);
+	MVA_CHECK(ret, ret, "wait with data returned %d\n", ret);
+	MVA_CHECK(ring_read(mr, &g_rxdata[0], 1) != 1, -EIO, "read after wait failed\n");
+
+	/* Start the transfer test from an empty ring */
+	ring_init(g_i.buff, g_i.size);
+
+	return 0;
+}
+
 static int buffer_prepare()
 {
 	return shmem_create("/mvaringtest", sizeof(struct mvaring), &g_i);
@@ -68,7 +106,7 @@ static int test_write_item(struct mvaring *mr)
 			printf("sending\n");
 			dbg_adcdata(&g_txdata, i);
 		}*/
-		ring_add(mr, &g_txdata);
+		ring_add(mr, &g_txdata, false);
 /*		{
 			if (!foo) {
 				int ret;
@@ -179,6 +217,12 @@ int main()
 		return ret;
 	}
 
+	ret = test_ring_wait(mr);
+	if (ret) {
+		printf("ring_wait test FAILED\n");
+		goto clean_out;
+	}
+
 	set_sched();
 
 	/*
@@ -0,0 +1,200 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mva_test.h"
+#include "../adc_common.h"
+#include "../adc_trigger.h"
+#include "../mvaring.h"
+
+#define NUM_TEST_BLOCKS 8
+
+static struct adc_data g_blocks[NUM_TEST_BLOCKS];
+
+/* ADC code to the raw (byte swapped) SPI word the DMA would store */
+static uint32_t code2raw(int code)
+{
+	return ((code & 0xff) << 8) | ((code >> 8) & 0xff);
+}
+
+static void fill_blocks(int (*wave)(uint64_t n))
+{
+	uint64_t n = 0;
+	int b, i;
+
+	for (b = 0; b < NUM_TEST_BLOCKS; b++) {
+		g_blocks[b].usecs = b * 1000;
+		for (i = 0; i < MAX_SAMPS; i++)
+			g_blocks[b].samples[i] = code2raw(wave(n++));
+	}
+}
+
+/* Square wave with period of 1000 samples, rising edges at 500, 1500, ... */
+static int square(uint64_t n)
+{
+	return (n % 1000 < 500) ? 100 : 2000;
+}
+
+/* Square wave with ringing back below the level right after rising edge */
+static int noisy(uint64_t n)
+{
+	if (n % 1000 == 501)
+		return 950;
+
+	return square(n);
+}
+
+static int scan_all(struct trig_state *t, uint64_t *hits, int max_hits)
+{
+	int b, n = 0;
+
+	for (b = 0; b < NUM_TEST_BLOCKS; b++)
+		n += trig_scan(t, &g_blocks[b], &hits[n], max_hits - n);
+
+	return n;
+}
+
+static int test_edges()
+{
+	struct trig_state t;
+	struct trig_cfg cfg;
+	uint64_t hits[32];
+	int i, n;
+
+	MVA_CHECK(trig_parse(&cfg, "edge,rising,level=1024,hyst=200,pre=0,post=0"),
+		  -EINVAL, "parse failed\n");
+	MVA_CHECK(trig_init(&t, &cfg), -EINVAL, "init failed\n");
+
+	fill_blocks(noisy);
+	n = scan_all(&t, hits, ARRAY_SIZE(hits));
+	MVA_CHECK(n != 8, -EINVAL, "expected 8 rising edges, got %d\n", n);
+	for (i = 0; i < n; i++)
+		MVA_CHECK(hits[i] != 500 + i * 1000ULL, -EINVAL,
+			  "edge %d at %llu\n", i, (unsigned long long)hits[i]);
+
+	/* Without hysteresis the ringing triggers again */
+	MVA_CHECK(trig_parse(&cfg, "edge,rising,hyst=0,pre=0,post=0"), -EINVAL,
+		  "parse failed\n");
+	trig_init(&t, &cfg);
+	n = scan_all(&t, hits, ARRAY_SIZE(hits));
+	MVA_CHECK(n != 16, -EINVAL, "expected 16 edges without hyst, got %d\n", n);
+
+	MVA_CHECK(trig_parse(&cfg, "edge,falling,pre=0,post=0"), -EINVAL,
+		  "parse failed\n");
+	trig_init(&t, &cfg);
+	fill_blocks(square);
+	n = scan_all(&t, hits, ARRAY_SIZE(hits));
+	MVA_CHECK(n != 8 || hits[0] != 1000, -EINVAL, "falling edges: %d\n", n);
+
+	printf("Testing edge trigger PASSED\n");
+
+	return 0;
+}
+
+static int test_holdoff_slope()
+{
+	struct trig_state t;
+	struct trig_cfg cfg;
+	uint64_t hits[32];
+	int n;
+
+	/* Holdoff over the next edge: every other edge triggers */
+	MVA_CHECK(trig_parse(&cfg, "edge,both,pre=0,post=0,holdoff=600"),
+		  -EINVAL, "parse failed\n");
+	trig_init(&t, &cfg);
+	fill_blocks(square);
+	n = scan_all(&t, hits, ARRAY_SIZE(hits));
+	MVA_CHECK(n != 8 || hits[0] != 500 || hits[1] != 1500, -EINVAL,
+		  "holdoff: %d hits\n", n);
+
+	MVA_CHECK(trig_parse(&cfg, "slope,falling,level=-1000,hyst=10,pre=0,post=0"),
+		  -EINVAL, "parse failed\n");
+	trig_init(&t, &cfg);
+	n = scan_all(&t, hits, ARRAY_SIZE(hits));
+	MVA_CHECK(n != 8 || hits[0] != 1000, -EINVAL, "slope: %d hits\n", n);
+
+	printf("Testing holdoff and slope trigger PASSED\n");
+
+	return 0;
+}
+
+static int test_window_events()
+{
+	struct adc_trig_event ev[TRIG_MAX_PENDING], got;
+	uint32_t *win;
+	struct trig_state t;
+	struct trig_cfg cfg;
+	struct mvaring *mr;
+	unsigned int seq = 0;
+	int b, i, n, ret;
+	void *buf;
+
+	buf = malloc(sizeof(*mr));
+	MVA_CHECK(!buf, -ENOMEM, "out of memory\n");
+	mr = ring_init(buf, sizeof(*mr));
+
+	MVA_CHECK(trig_parse(&cfg, "edge,chan=1,pre=100,post=200"), -EINVAL,
+		  "parse failed\n");
+	cfg.stride = 2;
+	MVA_CHECK(trig_init(&t, &cfg), -EINVAL, "init failed\n");
+
+	/* chan 1 is a square wave in frames, chan 0 is zero */
+	for (b = 0; b < NUM_TEST_BLOCKS; b++)
+		for (i = 0; i < MAX_SAMPS; i++)
+			g_blocks[b].samples[i] = (i & 1) ?
+				code2raw(square((b * MAX_SAMPS + i) / 2)) : 0;
+
+	for (b = 0; b < NUM_TEST_BLOCKS; b++) {
+		ring_add(mr, &g_blocks[b], true);
+		n = trig_feed(&t, &g_blocks[b], ev, ARRAY_SIZE(ev));
+		for (i = 0; i < n; i++)
+			ring_trig_publish(mr, &ev[i]);
+	}
+
+	/* Frames 500, 1500, 2500, 3500 have their post samples in 8 blocks */
+	ret = ring_trig_wait(mr, &seq, &got, 0);
+	MVA_CHECK(ret, ret, "no trigger event %d\n", ret);
+	MVA_CHECK(got.trig != 1001 || got.start != 800 || got.len != 600,
+		  -EINVAL, "bad event %llu %llu %u\n", (unsigned long long)got.trig,
+		  (unsigned long long)got.start, got.len);
+	MVA_CHECK(mr->trig_seq != 4, -EINVAL, "%u events\n", mr->trig_seq);
+
+	win = calloc(got.len, sizeof(*win));
+	MVA_CHECK(!win, -ENOMEM, "out of memory\n");
+	ret = ring_copy_samples(mr, got.start, win, got.len);
+	MVA_CHECK(ret, ret, "copy failed %d\n", ret);
+	MVA_CHECK(ADC_RAW2CODE(win[199]) != 100 || ADC_RAW2CODE(win[201]) != 2000,
+		  -EINVAL, "unexpected window contents\n");
+
+	ret = ring_copy_samples(mr, NUM_TEST_BLOCKS * MAX_SAMPS - 10, win, 20);
+	MVA_CHECK(ret != -EAGAIN, -EINVAL, "copy of future samples: %d\n", ret);
+
+	ret = ring_trig_wait(mr, &seq, &got, 0);
+	MVA_CHECK(ret || got.trig != 3001, -EINVAL, "second event\n");
+
+	free(win);
+	free(buf);
+	printf("Testing trigger windows PASSED\n");
+
+	return 0;
+}
+
+int main()
+{
+	struct trig_cfg cfg;
+	int ret;
+
+	MVA_CHECK(!trig_parse(&cfg, "edge,bogus"), -EINVAL, "bad spec accepted\n");
+	MVA_CHECK(!trig_parse(&cfg, "pre=x"), -EINVAL, "bad value accepted\n");
+
+	ret = test_edges();
+	if (!ret)
+		ret = test_holdoff_slope();
+	if (!ret)
+		ret = test_window_events();
+
+	printf("%s\n", ret ? "FAILED" : "PASSED");
+
+	return ret;
+}
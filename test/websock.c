@@ -0,0 +1,56 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mva_test.h"
+#include "../adc_websock.h"
+
+static int test_websock()
+{
+	/* Examples from RFC 6455, sections 1.3 and 5.7 */
+	static const char *req = "GET /ws HTTP/1.1\r\nHost: server.example.com\r\n"
+		"Upgrade: websocket\r\nConnection: Upgrade\r\n"
+		"sec-websocket-key:  dGhlIHNhbXBsZSBub25jZQ== \r\n\r\n";
+	static uint8_t hello[] = { 0x81, 0x85, 0x37, 0xfa, 0x21, 0x3d, 0x7f, 0x9f, 0x4d, 0x51, 0x58 };
+	uint8_t hdr[WS_HDR_MAX];
+	struct ws_frame f;
+	char rsp[256];
+	int n;
+
+	n = ws_upgrade_response(req, rsp, sizeof(rsp));
+	MVA_CHECK(n < 0 || !strstr(rsp, "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"),
+		  -EINVAL, "Upgrade response: %s\n", n < 0 ? strerror(-n) : rsp);
+	n = ws_upgrade_response("GET / HTTP/1.1\r\nHost: x\r\n\r\n", rsp, sizeof(rsp));
+	MVA_CHECK(n != -ENOENT, -EINVAL, "Plain GET upgraded\n");
+
+	MVA_CHECK(ws_frame_decode(hello, sizeof(hello) - 1, &f) != -EAGAIN, -EINVAL,
+		  "Short frame decoded\n");
+	n = ws_frame_decode(hello, sizeof(hello), &f);
+	MVA_CHECK(n != sizeof(hello) || f.opcode != WS_OP_TEXT || !f.fin || f.len != 5 ||
+		  memcmp(f.data, "Hello", 5), -EINVAL, "Masked frame decoded as %d\n", n);
+	hello[1] &= 0x7f;
+	MVA_CHECK(ws_frame_decode(hello, sizeof(hello), &f) != -EPROTO, -EINVAL,
+		  "Unmasked client frame accepted\n");
+
+	MVA_CHECK(ws_frame_header(hdr, WS_OP_BINARY, 125) != 2 || hdr[0] != 0x82 || hdr[1] != 125,
+		  -EINVAL, "Short frame header\n");
+	MVA_CHECK(ws_frame_header(hdr, WS_OP_BINARY, 256) != 4 || hdr[1] != 126 || hdr[2] != 1 ||
+		  hdr[3] != 0, -EINVAL, "16-bit frame header\n");
+	MVA_CHECK(ws_frame_header(hdr, WS_OP_BINARY, 65536) != 10 || hdr[1] != 127 ||
+		  hdr[7] != 1 || hdr[9] != 0, -EINVAL, "64-bit frame header\n");
+
+	printf("Testing WebSocket PASSED\n");
+
+	return 0;
+}
+
+int main()
+{
+	int ret;
+
+	ret = test_websock();
+
+	printf("%s\n", ret ? "FAILED" : "PASSED");
+
+	return ret;
+}